@@ -23,6 +23,7 @@ VOID initialize_page_file_and_metadata(VOID) {
     pf.slot_stack = zero_malloc((MAX_WRITE_BATCH_SIZE * 2) * BYTES_PER_VA);
     pf.last_checked_bitmap_row = 0;
     pf.num_stashed_slots = 0;
+    pf.last_claimed_bitmap_row = (LONG64) pf.page_file_bitmap_rows / 2;
 
     // Initialize disk slot tracker -- minus one because we have an initially full slot at index zero.
     pf.empty_disk_slots = vm.pages_in_page_file - 1;
@@ -72,8 +73,8 @@ VOID push_slots_from_bitmap_row(ULONG64 bitmap_row) {
         // If the bit is set in the snapshot, skip it!
         if ((row_snapshot & current_bit_mask) == current_bit_mask) continue;
 
-        // Otherwise, set it and add it to our disk slots.
-        set_disk_slot(current_disk_slot);
+        // Otherwise, set it and add it to our disk slots. Someone else may have claimed it since our snapshot.
+        if (!try_set_disk_slot(current_disk_slot)) continue;
 
         // Add this slot to the stack!
         push_slot(current_disk_slot);
@@ -155,19 +156,43 @@ VOID clear_disk_slot(ULONG64 disk_slot) {
     LONG64 result = InterlockedIncrement64(&pf.empty_disk_slots);
 }
 
-VOID set_disk_slot(UINT64 disk_slot) {
+BOOL try_set_disk_slot(UINT64 disk_slot) {
     validate_disk_slot(disk_slot);
 
     ULONG64 row = BITMAP_ROW(disk_slot);
-    ULONG64 mask = 1ULL << BITMAP_OFFSET(disk_slot);
     PULONG64 bitmap = &pf.page_file_bitmaps[row];
 
-    // Now we will set the slot, saving the ORIGINAL value for debugging.
-    ULONG64 original_value = InterlockedOr64((volatile LONG64 *) bitmap, mask);
-
-    // Double-check -- the original bit SHOULD have been clear!
-    ASSERT((original_value & mask) == 0ULL);
+    // Now we will set the slot. If it was already set, another thread has claimed it.
+    if (InterlockedBitTestAndSet64((volatile LONG64 *) bitmap, (LONG64) BITMAP_OFFSET(disk_slot))) return FALSE;
 
     // Decrement the empty disk slot count without risking race conditions.
-    LONG64 result = InterlockedDecrement64(&pf.empty_disk_slots);
+    InterlockedDecrement64(&pf.empty_disk_slots);
+    return TRUE;
+}
+
+ULONG64 claim_disk_slots(PULONG64 slots, ULONG64 count) {
+
+    ULONG64 claimed = 0;
+    if (pf.empty_disk_slots < (LONG64) count) return 0;
+
+    // Start from a different row than the writer, so we rarely race it for the same bits.
+    ULONG64 row = (ULONG64) ReadNoFence64(&pf.last_claimed_bitmap_row);
+
+    for (ULONG64 i = 0; i < pf.page_file_bitmap_rows && claimed < count; i++) {
+        row = (row + 1) % pf.page_file_bitmap_rows;
+
+        ULONG64 empty = ~pf.page_file_bitmaps[row];
+        ULONG bit;
+        while (claimed < count && _BitScanForward64(&bit, empty)) {
+            empty &= empty - 1;
+            ULONG64 slot = row * BITS_PER_BITMAP_ROW + bit;
+            if (try_set_disk_slot(slot)) {
+                slots[claimed] = slot;
+                claimed++;
+            }
+        }
+    }
+
+    WriteNoFence64(&pf.last_claimed_bitmap_row, (LONG64) row);
+    return claimed;
 }
\ No newline at end of file
@@ -27,6 +27,9 @@ typedef struct __page_file_struct {
     ULONG64 last_checked_bitmap_row;
     volatile LONG64 num_stashed_slots;
 
+    // Where the last claim for slots outside the writer's stash left off.
+    volatile LONG64 last_claimed_bitmap_row;
+
 } PAGE_FILE_STRUCT, *PPAGE_FILE_STRUCT;
 
 extern PAGE_FILE_STRUCT pf;
@@ -39,7 +42,16 @@ char* get_page_file_offset(ULONG64 disk_slot);
 
 VOID clear_disk_slot(ULONG64 disk_slot);
 
-VOID set_disk_slot(UINT64 disk_slot);
+/*
+ *  Atomically sets the slot's bit. Returns FALSE if another thread set it first.
+ */
+BOOL try_set_disk_slot(UINT64 disk_slot);
+
+/*
+ *  Claims up to count empty slots and returns how many were claimed. Safe to call from any thread,
+ *  alongside the writer filling its stash.
+ */
+ULONG64 claim_disk_slots(PULONG64 slots, ULONG64 count);
 
 VOID pop_and_clear_all_slots(VOID);
 
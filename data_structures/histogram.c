@@ -0,0 +1,76 @@
+#include "histogram.h"
+
+static ULONG get_bucket_index(ULONG64 ticks) {
+
+    // Small values each get their own bucket.
+    if (ticks < HISTOGRAM_SUB_BUCKETS) return (ULONG) ticks;
+
+    // Otherwise, the highest bit picks the power of two, and the bits just beneath it the bucket within.
+    ULONG highest_bit;
+    _BitScanReverse64(&highest_bit, ticks);
+    ULONG shift = highest_bit - HISTOGRAM_SUB_BUCKET_BITS;
+    ULONG sub_bucket = (ULONG) (ticks >> shift) & (HISTOGRAM_SUB_BUCKETS - 1);
+    return (shift + 1) * HISTOGRAM_SUB_BUCKETS + sub_bucket;
+}
+
+// The smallest value in the given bucket, and its width.
+static VOID get_bucket_range(ULONG index, PULONG64 lowest, PULONG64 width) {
+    if (index < HISTOGRAM_SUB_BUCKETS) {
+        *lowest = index;
+        *width = 1;
+        return;
+    }
+
+    ULONG shift = index / HISTOGRAM_SUB_BUCKETS - 1;
+    ULONG64 sub_bucket = index % HISTOGRAM_SUB_BUCKETS;
+    *lowest = (HISTOGRAM_SUB_BUCKETS + sub_bucket) << shift;
+    *width = 1ULL << shift;
+}
+
+VOID record_latency(PLATENCY_HISTOGRAM histogram, ULONG64 ticks) {
+    ULONG index = get_bucket_index(ticks);
+    histogram->counts[index] = histogram->counts[index] + 1;
+}
+
+VOID merge_histogram(PLATENCY_HISTOGRAM destination, PLATENCY_HISTOGRAM source) {
+    for (ULONG i = 0; i < HISTOGRAM_BUCKETS; i++) destination->counts[i] += source->counts[i];
+}
+
+VOID subtract_histogram(PLATENCY_HISTOGRAM difference, PLATENCY_HISTOGRAM current, PLATENCY_HISTOGRAM previous) {
+    for (ULONG i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        ULONG64 now = current->counts[i];
+        ULONG64 before = previous->counts[i];
+        difference->counts[i] = now > before ? now - before : 0;
+    }
+}
+
+ULONG64 get_histogram_count(PLATENCY_HISTOGRAM histogram) {
+    ULONG64 count = 0;
+    for (ULONG i = 0; i < HISTOGRAM_BUCKETS; i++) count += histogram->counts[i];
+    return count;
+}
+
+ULONG64 get_histogram_percentile(PLATENCY_HISTOGRAM histogram, double fraction) {
+    ULONG64 count = get_histogram_count(histogram);
+    if (count == 0) return 0;
+
+    // Walk the buckets until we have passed the rank we are looking for.
+    ULONG64 rank = min((ULONG64) (fraction * (double) count), count - 1);
+    ULONG64 seen = 0;
+    ULONG64 lowest, width;
+    for (ULONG i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += histogram->counts[i];
+        if (seen > rank) {
+            get_bucket_range(i, &lowest, &width);
+            return lowest + width / 2;
+        }
+    }
+
+    // We only get here if the counts changed under us.
+    get_bucket_range(HISTOGRAM_BUCKETS - 1, &lowest, &width);
+    return lowest;
+}
+
+double cycles_to_microseconds(ULONG64 cycles) {
+    return (double) cycles * 1000000.0 / stats.cycles_per_second;
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include "../utils/config.h"
+
+/*
+ *  A log-linear histogram of latencies, counted in cycles (see get_cycle_count). Each power of two is split
+ *  into HISTOGRAM_SUB_BUCKETS linear buckets, so every value is placed within 1/8 (12.5%) of its size,
+ *  from a single tick up to the largest value a ULONG64 can hold.
+ *
+ *  Recording is a bit scan and an increment, cheap enough to do on every fault. A histogram has one
+ *  writer -- each user thread keeps its own -- and readers merge them, tolerating counts that are a
+ *  moment out of date.
+ */
+#define HISTOGRAM_SUB_BUCKET_BITS       3
+#define HISTOGRAM_SUB_BUCKETS           (1 << HISTOGRAM_SUB_BUCKET_BITS)
+#define HISTOGRAM_BUCKETS               ((64 - HISTOGRAM_SUB_BUCKET_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+typedef struct __latency_histogram {
+    volatile ULONG64 counts[HISTOGRAM_BUCKETS];
+} LATENCY_HISTOGRAM, *PLATENCY_HISTOGRAM;
+
+/*
+ *  Counts one latency, in cycles. Only the histogram's owner may call this.
+ */
+VOID record_latency(PLATENCY_HISTOGRAM histogram, ULONG64 ticks);
+
+/*
+ *  Adds every count in source to destination.
+ */
+VOID merge_histogram(PLATENCY_HISTOGRAM destination, PLATENCY_HISTOGRAM source);
+
+/*
+ *  Sets difference to the counts in current less those in previous: what was recorded in between.
+ */
+VOID subtract_histogram(PLATENCY_HISTOGRAM difference, PLATENCY_HISTOGRAM current, PLATENCY_HISTOGRAM previous);
+
+ULONG64 get_histogram_count(PLATENCY_HISTOGRAM histogram);
+
+/*
+ *  Returns the latency (in cycles) at or below which the given fraction of counts fall, e.g. 0.99 for p99,
+ *  or 1.0 for the largest. We return the middle of the bucket that holds it. Returns 0 for an empty histogram.
+ */
+ULONG64 get_histogram_percentile(PLATENCY_HISTOGRAM histogram, double fraction);
+
+/*
+ *  Converts cycles to microseconds, at the rate we measured at startup.
+ */
+double cycles_to_microseconds(ULONG64 cycles);
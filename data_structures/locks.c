@@ -3,21 +3,45 @@
 //
 
 #include "locks.h"
+#include "../utils/utils.h"
+#include "../threads/pressure.h"
 
 VOID initialize_byte_lock(PBYTE_LOCK lock) {
     lock->semaphore = UNLOCKED;
 }
 
 VOID lock(PBYTE_LOCK lock) {
+    lock_in_class(lock, LOCK_CLASS_OTHER);
+}
+
+BOOL try_lock(PBYTE_LOCK lock) {
+    return try_lock_in_class(lock, LOCK_CLASS_OTHER);
+}
+
+VOID lock_in_class(PBYTE_LOCK lock, ULONG lock_class) {
 
+#if LOCK_PROFILING
+    ULONG64 start = get_cycle_count();
+    ULONG64 spins = 0;
+#endif
+    BOOL stalled = FALSE;
     int backoff = 1;
     do {
         if (lock->semaphore == LOCKED) {
+            // Spinning on a lock counts as a stall, from our first spin until we have it.
+            if (!stalled) {
+                STALL_BEGIN();
+                stalled = TRUE;
+            }
+
             // In this situation, the lock is almost certainly still acquired. No need to try.
             // We will wait (and if we were here before, we will wait twice as long).
             for (int i = 0; i < backoff; i++) {
                 YieldProcessor();
             }
+#if LOCK_PROFILING
+            spins += backoff;
+#endif
             backoff = min(backoff << 1, MAX_WAIT_TIME_BEFORE_RETRY);
         }
         // Here we will try to acquire the lock. If we cannot, we will wrap around
@@ -26,17 +50,22 @@ VOID lock(PBYTE_LOCK lock) {
     } while (InterlockedCompareExchange16(&lock->semaphore,
                                             LOCKED,
                                             UNLOCKED) != UNLOCKED);
+
+    if (stalled) STALL_END();
+    LOCK_ACQUIRED(lock_class, spins, spins ? get_cycle_count() - start : 0);
 }
 
-BOOL try_lock(PBYTE_LOCK lock) {
+BOOL try_lock_in_class(PBYTE_LOCK lock, ULONG lock_class) {
 
     // If the lock is already acquired, no need to try the interlocked operation.
-    if (lock->semaphore == LOCKED)
+    if (lock->semaphore == LOCKED ||
+        InterlockedCompareExchange16(&lock->semaphore, LOCKED, UNLOCKED) != UNLOCKED) {
+        LOCK_TRY_FAILED(lock_class);
         return FALSE;
+    }
 
-    return(InterlockedCompareExchange16(&lock->semaphore,
-                                            LOCKED,
-                                            UNLOCKED) == UNLOCKED);
+    LOCK_ACQUIRED(lock_class, 0, 0);
+    return TRUE;
 }
 
 VOID unlock(PBYTE_LOCK lock) {
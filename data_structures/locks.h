@@ -4,6 +4,7 @@
 
 #include <Windows.h>
 #include "../utils/debug.h"
+#include "../utils/lock_profiler.h"
 
 #pragma once
 
@@ -29,6 +30,14 @@ VOID lock(PBYTE_LOCK lock);
 
 BOOL try_lock(PBYTE_LOCK lock);
 
+/*
+ *  The same as lock() and try_lock(), but counted under the given lock class (see lock_profiler.h).
+ *  lock() and try_lock() count under LOCK_CLASS_OTHER.
+ */
+VOID lock_in_class(PBYTE_LOCK lock, ULONG lock_class);
+
+BOOL try_lock_in_class(PBYTE_LOCK lock, ULONG lock_class);
+
 VOID unlock(PBYTE_LOCK lock);
 
 VOID wait(ULONG time);
\ No newline at end of file
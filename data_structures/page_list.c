@@ -3,10 +3,29 @@
 //
 
 #include "page_list.h"
+#include "../utils/trace.h"
+#include "../utils/probes.h"
+#include "../threads/pressure.h"
 
 PAGE_LIST zero_list;
 PAGE_LIST modified_list;
 PAGE_LIST standby_list;
+LARGE_PAGE_POOL large_page_pool;
+
+#if LOCK_PROFILING
+// The lock class of a list's SRW lock.
+static ULONG get_list_lock_class(PPAGE_LIST list) {
+    if (list == &standby_list) return LOCK_CLASS_STANDBY_LIST;
+    if (list == &modified_list) return LOCK_CLASS_MODIFIED_LIST;
+    return LOCK_CLASS_FREE_LIST;
+}
+#endif
+
+ULONG get_list_id(PPAGE_LIST list) {
+    if (list == &standby_list) return LIST_ID_STANDBY;
+    if (list == &modified_list) return LIST_ID_MODIFIED;
+    return LIST_ID_FIRST_FREE + (ULONG) (list - free_lists.list_array);
+}
 
 BOOL check_if_list_is_about_to_run_low(PPAGE_LIST list,
                                               HANDLE event_to_set,
@@ -23,21 +42,11 @@ BOOL check_if_list_is_about_to_run_low(PPAGE_LIST list,
     return (current_list_size - pages_consumed_during_event < low_page_threshold);
 }
 
-VOID signal_event_if_list_is_about_to_run_low(PPAGE_LIST list,
-                                              HANDLE event_to_set,
-                                              USHORT thread_id,
-                                              LONG64 low_page_threshold) {
-
-    // If the list is expected to run low, we will initiate our event now to counteract it
-    BOOL low = check_if_list_is_about_to_run_low(list, event_to_set, thread_id, low_page_threshold);
-    if (low) SetEvent(event_to_set);
-}
-
 VOID add_page_to_cache_or_free_list(PPFN page, ULONG first_index, PUSER_THREAD_INFO thread_info) {
 
     // First, try to add this page to your free page cache
     USHORT cache_count = thread_info->free_page_count;
-    if (cache_count < FREE_PAGE_CACHE_SIZE) {
+    if (cache_count < get_tunable(TUNE_FREE_PAGE_CACHE_SIZE)) {
         thread_info->free_page_cache[cache_count] = page;
         thread_info->free_page_count = cache_count + 1;
         return;
@@ -66,6 +75,9 @@ VOID add_page_to_cache_or_free_list(PPFN page, ULONG first_index, PUSER_THREAD_I
         increment_list_size(list);
 #endif
         increment_free_lists_total_count();
+
+        // Pages in a free page cache are not available, but pages on the free lists are.
+        increment_available_count();
         return;
     }
 }
@@ -75,7 +87,7 @@ VOID add_page_to_cache_or_free_list(PPFN page, ULONG first_index, PUSER_THREAD_I
 BOOL try_get_free_pages(PUSER_THREAD_INFO thread_info) {
 
     // First, just see if there are ANY free pages.
-    if (free_lists.page_count == 0) return FALSE;
+    if (is_counter_below(&free_lists.page_count, 1)) return FALSE;
 
     ULONG attempts = 0;
     ULONG count = free_lists.number_of_lists;
@@ -114,7 +126,7 @@ BOOL try_refill_cache_from_free_list(ULONG list_index, PUSER_THREAD_INFO thread_
     PPFN first_page;
     USHORT batch_size = remove_batch_from_list_head_exclusive(list,
                                                     &first_page,
-                                                    FREE_PAGE_CACHE_SIZE);
+                                                    get_tunable(TUNE_FREE_PAGE_CACHE_SIZE));
     unlock_free_list(list_index);
     if (batch_size == 0) return FALSE;
 
@@ -151,6 +163,72 @@ BOOL try_refill_cache_from_free_list(ULONG list_index, PUSER_THREAD_INFO thread_
     // Update metadata and return
     decrease_free_lists_total_count(batch_size);
     decrease_available_count(batch_size);
+    thread_info->pages_taken[DEMAND_FREE] += batch_size;
+    return TRUE;
+}
+
+VOID add_run_to_large_page_pool(PPFN first_pfn) {
+
+    ASSERT(get_frame_from_PFN(first_pfn) % PAGES_PER_LARGE_PAGE == 0);
+
+    lock(&large_page_pool.lock);
+    ASSERT(large_page_pool.run_count < (LONG64) large_page_pool.capacity);
+    large_page_pool.runs[large_page_pool.run_count] = first_pfn;
+    large_page_pool.run_count++;
+    unlock(&large_page_pool.lock);
+
+    InterlockedAdd64(&large_page_pool.page_count, PAGES_PER_LARGE_PAGE);
+}
+
+PPFN try_remove_run_from_large_page_pool(VOID) {
+
+    // Check without the lock first, since the pool is empty most of the time once the system warms up.
+    if (large_page_pool.run_count == 0) return NULL;
+
+    lock(&large_page_pool.lock);
+    if (large_page_pool.run_count == 0) {
+        unlock(&large_page_pool.lock);
+        return NULL;
+    }
+    large_page_pool.run_count--;
+    PPFN first_pfn = large_page_pool.runs[large_page_pool.run_count];
+    unlock(&large_page_pool.lock);
+
+    InterlockedAdd64(&large_page_pool.page_count, -(LONG64) PAGES_PER_LARGE_PAGE);
+    return first_pfn;
+}
+
+BOOL try_break_large_page_run_into_free_lists(VOID) {
+
+    PPFN first_pfn = try_remove_run_from_large_page_pool();
+    if (first_pfn == NULL) return FALSE;
+
+    // Deal the run out across the free lists, just as we do at startup. The pages are free,
+    // so no one else can be holding their PFNs.
+    ULONG count = free_lists.number_of_lists;
+    ULONG64 first_frame = get_frame_from_PFN(first_pfn);
+
+    for (ULONG index = 0; index < count; index++) {
+
+        // Free list locks are held briefly, so we spin, backing off as the lock does.
+        int backoff = 1;
+        while (!try_lock_free_list(index)) {
+            for (int i = 0; i < backoff; i++) YieldProcessor();
+            backoff = min(backoff << 1, MAX_WAIT_TIME_BEFORE_RETRY);
+        }
+
+        PPAGE_LIST list = &free_lists.list_array[index];
+        for (ULONG64 i = index; i < PAGES_PER_LARGE_PAGE; i += count) {
+            insert_to_list_tail(list, get_PFN_from_frame(first_frame + i));
+        }
+        unlock_free_list(index);
+#if DEBUG
+        change_list_size(list, PAGES_PER_LARGE_PAGE / count);
+#endif
+    }
+
+    // These pages were already counted as available while they were in the pool.
+    increase_free_lists_total_count(PAGES_PER_LARGE_PAGE);
     return TRUE;
 }
 
@@ -172,19 +250,19 @@ ULONG64 get_size(PPAGE_LIST list) {
 }
 
 VOID increment_free_lists_total_count(VOID) {
-    InterlockedIncrement64(&free_lists.page_count);
+    add_to_counter(&free_lists.page_count, 1);
 }
 
 VOID decrease_free_lists_total_count(LONG64 amt) {
-    InterlockedAdd64(&free_lists.page_count, -amt);
+    add_to_counter(&free_lists.page_count, -amt);
 }
 
 VOID decrement_free_lists_total_count(VOID) {
-    InterlockedDecrement64(&free_lists.page_count);
+    add_to_counter(&free_lists.page_count, -1);
 }
 
 VOID increase_free_lists_total_count(LONG64 amt) {
-    InterlockedAdd64(&free_lists.page_count, amt);
+    add_to_counter(&free_lists.page_count, amt);
 }
 
 VOID increment_list_size(PPAGE_LIST list) {
@@ -247,17 +325,15 @@ VOID remove_page_on_soft_fault(PPAGE_LIST list, PPFN pfn) {
 	    unlock_pfn(blink);                      // Since the writer goes forward from the head, let's unlock blinks FIRST
 	    if (flink != blink) unlock_pfn(flink);
 
-	    // Update metadata and reset events, if necessary
+	    // Update metadata
         decrement_list_size(list);
-	    if (list == &standby_list) {
-	        decrement_available_count();
-
-	        if (is_page_list_empty(&standby_list)) ResetEvent(standby_pages_ready_event);
-	    }
+	    if (list == &standby_list) decrement_available_count();
 	    return;
 	}
 
 	// If we get here, we will need to lock the list exclusively
+    TRACE_INSTANT(TRACE_LIST_EXCLUSIVE, get_list_id(list));
+    LOCK_EXCLUSIVE_FALLBACK(get_list_lock_class(list));
     lock_list_exclusive(list);
 
     // Remove our relevant page, then immediately unlock the list
@@ -269,13 +345,7 @@ VOID remove_page_on_soft_fault(PPAGE_LIST list, PPFN pfn) {
     decrement_list_size(list);
 
     // If we have pulled off the standby list, we will want to decrement our available count
-    if (list == &standby_list) {
-        decrement_available_count();
-
-        // And if it happens to be the last standby page, we will want to hold all other faulting
-        // threads until there are available standby pages.
-        if (is_page_list_empty(&standby_list)) ResetEvent(standby_pages_ready_event);
-    }
+    if (list == &standby_list) decrement_available_count();
 }
 
 /*
@@ -453,6 +523,7 @@ ULONG64 remove_batch_from_list_head(PPAGE_LIST list,
             unlock_list_shared(list);
             unlock_pfn(list_head);
             change_list_size(list, -1);
+            PROBE_LIST_BATCH(get_list_id(list), PROBE_LIST_REMOVE, 1);
             return 1;
         }
 
@@ -472,6 +543,8 @@ ULONG64 remove_batch_from_list_head(PPAGE_LIST list,
 
     // If we were NOT able to lock shared, we will need to lock exclusive
     if (!locked_shared) {
+        TRACE_INSTANT(TRACE_LIST_EXCLUSIVE, get_list_id(list));
+        LOCK_EXCLUSIVE_FALLBACK(get_list_lock_class(list));
         return remove_batch_from_list_head_exclusive(list, address_of_first_page, capacity);
     }
 
@@ -523,6 +596,7 @@ ULONG64 remove_batch_from_list_head(PPAGE_LIST list,
     // We will now save the address of the first page in our batch
     *address_of_first_page = first_page;
 
+    PROBE_LIST_BATCH(get_list_id(list), PROBE_LIST_REMOVE, num_pages_batched);
     return num_pages_batched;
 }
 
@@ -573,6 +647,7 @@ ULONG64 remove_batch_from_list_head_exclusive(PPAGE_LIST list,
     // We will now save the address of the first page in our batch
     *address_of_first_page = batch_first;
 
+    PROBE_LIST_BATCH(get_list_id(list), PROBE_LIST_REMOVE, num_pages_batched);
     return num_pages_batched;
 }
 
@@ -638,11 +713,32 @@ VOID insert_list_to_tail_list(PPAGE_LIST destination_list, PPAGE_LIST origin_lis
 }
 
 VOID lock_list_shared(PPAGE_LIST list) {
+#if LOCK_PROFILING || PRESSURE_STALL_INFO
+    // We can only see contention on an SRW lock from the outside: if a try fails, we time the blocking
+    // acquire, and count it as a stall.
+    if (TryAcquireSRWLockShared(&list->lock)) {
+        LOCK_ACQUIRED(get_list_lock_class(list), 0, 0);
+        return;
+    }
+    STALL_BEGIN();
+#if LOCK_PROFILING
+    ULONG64 start = get_cycle_count();
+#endif
+    AcquireSRWLockShared(&list->lock);
+    LOCK_ACQUIRED(get_list_lock_class(list), 0, max(get_cycle_count() - start, 1));
+    STALL_END();
+#else
     AcquireSRWLockShared(&list->lock);
+#endif
 }
 
 BOOL try_lock_list_shared(PPAGE_LIST list) {
-    return TryAcquireSRWLockShared(&list->lock);
+    if (!TryAcquireSRWLockShared(&list->lock)) {
+        LOCK_TRY_FAILED(get_list_lock_class(list));
+        return FALSE;
+    }
+    LOCK_ACQUIRED(get_list_lock_class(list), 0, 0);
+    return TRUE;
 }
 
 VOID unlock_list_shared(PPAGE_LIST list) {
@@ -650,11 +746,30 @@ VOID unlock_list_shared(PPAGE_LIST list) {
 }
 
 VOID lock_list_exclusive(PPAGE_LIST list) {
+#if LOCK_PROFILING || PRESSURE_STALL_INFO
+    if (TryAcquireSRWLockExclusive(&list->lock)) {
+        LOCK_ACQUIRED(get_list_lock_class(list), 0, 0);
+        return;
+    }
+    STALL_BEGIN();
+#if LOCK_PROFILING
+    ULONG64 start = get_cycle_count();
+#endif
+    AcquireSRWLockExclusive(&list->lock);
+    LOCK_ACQUIRED(get_list_lock_class(list), 0, max(get_cycle_count() - start, 1));
+    STALL_END();
+#else
     AcquireSRWLockExclusive(&list->lock);
+#endif
 }
 
 BOOL try_lock_list_exclusive(PPAGE_LIST list) {
-    return TryAcquireSRWLockExclusive(&list->lock);
+    if (!TryAcquireSRWLockExclusive(&list->lock)) {
+        LOCK_TRY_FAILED(get_list_lock_class(list));
+        return FALSE;
+    }
+    LOCK_ACQUIRED(get_list_lock_class(list), 0, 0);
+    return TRUE;
 }
 
 VOID unlock_list_exclusive(PPAGE_LIST list) {
@@ -703,8 +818,11 @@ VOID insert_to_list_tail(PPAGE_LIST list, PPFN page) {
 }
 
 BOOL try_lock_free_list(ULONG64 index) {
-    if (InterlockedBitTestAndSet64(&free_lists.free_list_locks, index) == 1)
+    if (InterlockedBitTestAndSet64(&free_lists.free_list_locks, index) == 1) {
+        LOCK_TRY_FAILED(LOCK_CLASS_FREE_LIST);
         return FALSE;
+    }
+    LOCK_ACQUIRED(LOCK_CLASS_FREE_LIST, 0, 0);
     return TRUE;
 }
 
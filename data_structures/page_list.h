@@ -31,28 +31,41 @@ typedef struct __page_list {
 typedef struct __page_list_array {
     volatile LONG64 low_list_bitmap;
     ULONG number_of_lists;
-    volatile LONG64 page_count;
     PAGE_LIST *list_array;
+    SHARDED_COUNTER page_count;
     LONG64 free_list_locks;
 } PAGE_LIST_ARRAY, *PPAGE_LIST_ARRAY;
 
 extern PAGE_LIST_ARRAY free_lists;
 
+// Free frames that are set aside for large pages. Each entry is the first PFN of a contiguous run of
+// PAGES_PER_LARGE_PAGE free frames, starting at a frame number aligned to PAGES_PER_LARGE_PAGE.
+// Pages in the pool are free, but on no list. The pool is filled once, at startup, and never refilled:
+// runs broken up into small pages (or split by the trimmer) do not come back, so once it is empty,
+// every fault is a regular one.
+typedef struct __large_page_pool {
+    PPFN *runs;
+    ULONG64 capacity;
+    volatile LONG64 run_count;
+    volatile LONG64 page_count;
+    BYTE_LOCK lock;
+} LARGE_PAGE_POOL, *PLARGE_PAGE_POOL;
+
+extern LARGE_PAGE_POOL large_page_pool;
+
 // Page lists
 extern PAGE_LIST zero_list;
 extern PAGE_LIST modified_list;
 extern PAGE_LIST standby_list;
 
-/*
-    Checks the given list. If it will fall below a set threshold in the given window of time,
-    initiate the given event. Checks global statistics on page consumption and thread runtimes.
- */
-VOID signal_event_if_list_is_about_to_run_low(PPAGE_LIST list,
-                                              HANDLE event_to_set,
-                                              USHORT thread_id, LONG64 low_page_threshold);
+// How we identify lists in traces and probes. Free lists are numbered from LIST_ID_FIRST_FREE by index.
+#define LIST_ID_STANDBY                 0
+#define LIST_ID_MODIFIED                1
+#define LIST_ID_FIRST_FREE              2
 
 /*
- *  Pushes a page onto a free list.
+ *  Pushes a page onto the thread's free page cache or, if that is full, onto a free list,
+ *  where it counts as available again.
  */
 VOID add_page_to_cache_or_free_list(PPFN page, ULONG first_index, PUSER_THREAD_INFO thread_info);
 
@@ -68,12 +81,34 @@ BOOL try_get_free_pages(PUSER_THREAD_INFO thread_info);
  */
 BOOL try_refill_cache_from_free_list(ULONG list_index, PUSER_THREAD_INFO thread_info);
 
+/*
+ *  Adds a contiguous, aligned run of free frames to the large page pool.
+ */
+VOID add_run_to_large_page_pool(PPFN first_pfn);
+
+/*
+ *  Pops a run of PAGES_PER_LARGE_PAGE free frames from the large page pool.
+ *  Returns NULL if the pool is empty.
+ */
+PPFN try_remove_run_from_large_page_pool(VOID);
+
+/*
+ *  When small pages run out, breaks one run from the large page pool into the free lists.
+ *  Returns FALSE if the pool is empty.
+ */
+BOOL try_break_large_page_run_into_free_lists(VOID);
+
 /*
  *  Initialize a page list. This creates the critical section, initializes the list head,
  *  and sets the size to zero.
  */
 VOID initialize_page_list(PPAGE_LIST list);
 
+/*
+ *  Returns the ID of the standby list, the modified list, or a free list (see LIST_ID_STANDBY).
+ */
+ULONG get_list_id(PPAGE_LIST list);
+
 /*
  *  Returns the length of the list when asked, with no guarantees about future length.
  */
@@ -0,0 +1,74 @@
+#include "page_waiters.h"
+
+PAGE_WAITER_QUEUE page_waiters;
+
+VOID initialize_page_waiter_queue(VOID) {
+    page_waiters.head = NULL;
+    page_waiters.tail = NULL;
+    page_waiters.count = 0;
+    initialize_byte_lock(&page_waiters.lock);
+}
+
+VOID enqueue_page_waiter(PPAGE_WAITER waiter) {
+    waiter->next = NULL;
+
+    lock(&page_waiters.lock);
+    if (page_waiters.tail == NULL) page_waiters.head = waiter;
+    else page_waiters.tail->next = waiter;
+    page_waiters.tail = waiter;
+    InterlockedIncrement64(&page_waiters.count);
+    unlock(&page_waiters.lock);
+}
+
+PPAGE_WAITER dequeue_page_waiter(VOID) {
+
+    // Most of the time, no one is waiting. We check without the lock first.
+    if (ReadNoFence64(&page_waiters.count) == 0) return NULL;
+
+    lock(&page_waiters.lock);
+    PPAGE_WAITER waiter = page_waiters.head;
+    if (waiter != NULL) {
+        page_waiters.head = waiter->next;
+        if (page_waiters.head == NULL) page_waiters.tail = NULL;
+        InterlockedDecrement64(&page_waiters.count);
+    }
+    unlock(&page_waiters.lock);
+    return waiter;
+}
+
+BOOL try_remove_page_waiter(PPAGE_WAITER waiter) {
+
+    lock(&page_waiters.lock);
+
+    // The queue is only ever as long as the number of user threads, so a walk is cheap.
+    PPAGE_WAITER previous = NULL;
+    PPAGE_WAITER current = page_waiters.head;
+    while (current != NULL && current != waiter) {
+        previous = current;
+        current = current->next;
+    }
+
+    if (current == NULL) {
+        unlock(&page_waiters.lock);
+        return FALSE;
+    }
+
+    if (previous == NULL) page_waiters.head = waiter->next;
+    else previous->next = waiter->next;
+    if (page_waiters.tail == waiter) page_waiters.tail = previous;
+    InterlockedDecrement64(&page_waiters.count);
+
+    unlock(&page_waiters.lock);
+    return TRUE;
+}
+
+VOID hand_page_to_waiter(PPAGE_WAITER waiter, PPFN page) {
+
+    // We release the page lock here, and the waiter takes it again once it wakes. No one else can find
+    // the page in the meantime: it is on no list, and no PTE points to it.
+    unlock_pfn(page);
+
+    // SetEvent is a full barrier, so the waiter sees its page once it wakes.
+    waiter->page = page;
+    SetEvent(waiter->page_ready_event);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "page_list.h"
+#include "locks.h"
+#include "../threads/threads.h"
+
+/*
+ *  Faulting threads that find no page to take join this queue, in order, and wait on their own event.
+ *  The writer hands the pages it has just written to the threads at the front of the queue before it puts
+ *  the rest on standby, and wakes only the threads it gave pages to.
+ */
+typedef struct __page_waiter_queue {
+    PPAGE_WAITER head;
+    PPAGE_WAITER tail;
+    volatile LONG64 count;
+    BYTE_LOCK lock;
+} PAGE_WAITER_QUEUE, *PPAGE_WAITER_QUEUE;
+
+extern PAGE_WAITER_QUEUE page_waiters;
+
+VOID initialize_page_waiter_queue(VOID);
+
+/*
+ *  Adds the waiter to the tail of the queue.
+ */
+VOID enqueue_page_waiter(PPAGE_WAITER waiter);
+
+/*
+ *  Removes and returns the waiter at the head of the queue, or NULL if there is none.
+ */
+PPAGE_WAITER dequeue_page_waiter(VOID);
+
+/*
+ *  Takes the waiter out of the queue. Returns FALSE if it is no longer there, which means the writer has
+ *  dequeued it and a page is on its way.
+ */
+BOOL try_remove_page_waiter(PPAGE_WAITER waiter);
+
+/*
+ *  Gives a page to the waiter and wakes it. The page must be free and locked by the caller.
+ */
+VOID hand_page_to_waiter(PPAGE_WAITER waiter, PPFN page);
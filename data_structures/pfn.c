@@ -3,6 +3,11 @@
 //
 
 #include "pfn.h"
+#include "../utils/probes.h"
+
+// List heads are PFNs, too, but live outside of our PFN array.
+#define PFN_LOCK_CLASS(pfn)     ((pfn) >= PFN_array && (pfn) <= PFN_array + vm.max_frame_number ? \
+                                    LOCK_CLASS_PFN : LOCK_CLASS_LIST_HEAD)
 
 PPFN PFN_array;
 
@@ -59,6 +64,7 @@ VOID set_PFN_active(PPFN pfn, PPTE pte) {
 
     WriteULong64NoFence(&pfn->raw_pfn_data, temp.raw_pfn_data);
     WriteULong64NoFence((DWORD64 *) &pfn->PTE, (DWORD64) pte);
+    PROBE_PFN_TRANSITION(get_frame_from_PFN(pfn), snapshot.fields.status, PFN_ACTIVE);
 }
 
 VOID set_PFN_free(PPFN pfn) {
@@ -73,6 +79,7 @@ VOID set_PFN_free(PPFN pfn) {
 
     WriteULong64NoFence(&pfn->raw_pfn_data, temp.raw_pfn_data);
     WriteULong64NoFence((DWORD64 *) &pfn->PTE, (DWORD64) NULL);
+    PROBE_PFN_TRANSITION(get_frame_from_PFN(pfn), snapshot.fields.status, PFN_FREE);
 }
 
 VOID set_pfn_standby(PPFN pfn, ULONG64 disk_index) {
@@ -86,6 +93,7 @@ VOID set_pfn_standby(PPFN pfn, ULONG64 disk_index) {
     temp.fields.disk_index = disk_index;
 
     WriteULong64NoFence(&pfn->raw_pfn_data, temp.raw_pfn_data);
+    PROBE_PFN_TRANSITION(get_frame_from_PFN(pfn), snapshot.fields.status, PFN_STANDBY);
 }
 
 VOID lock_pfn(PPFN pfn) {
@@ -99,7 +107,7 @@ VOID lock_pfn(PPFN pfn) {
     // Assert that we never acquire recursively
     ASSERT(rtl_cs->RecursionCount == 1);
 #else
-    lock(&pfn->lock);
+    lock_in_class(&pfn->lock, PFN_LOCK_CLASS(pfn));
 #endif
 }
 
@@ -116,7 +124,7 @@ BOOL try_lock_pfn(PPFN pfn) {
     }
     return success;
 #else
-    return try_lock(&pfn->lock);
+    return try_lock_in_class(&pfn->lock, PFN_LOCK_CLASS(pfn));
 #endif
 }
 
@@ -142,6 +150,7 @@ VOID set_pfn_mid_trim(PPFN pfn) {
     temp.fields.disk_index = snapshot.fields.disk_index;
 
     WriteULong64NoFence(&pfn->raw_pfn_data, temp.raw_pfn_data);
+    PROBE_PFN_TRANSITION(get_frame_from_PFN(pfn), snapshot.fields.status, PFN_MID_TRIM);
 }
 
 VOID set_pfn_mid_write(PPFN pfn) {
@@ -152,4 +161,5 @@ VOID set_pfn_mid_write(PPFN pfn) {
     temp.fields.disk_index = snapshot.fields.disk_index;
 
     WriteULong64NoFence(&pfn->raw_pfn_data, temp.raw_pfn_data);
+    PROBE_PFN_TRANSITION(get_frame_from_PFN(pfn), snapshot.fields.status, PFN_MID_WRITE);
 }
\ No newline at end of file
@@ -3,24 +3,226 @@
 //
 
 #include "pte.h"
+#include "../utils/probes.h"
+#include "../threads/pressure.h"
+
+#include <emmintrin.h>
 
 PPTE PTE_base = {0};
+PPDE PDE_base = {0};
+volatile LONG64 *active_pte_bitmap = NULL;
+ULONG64 num_pte_blocks = 0;
+// Starts at the first epoch, so that the zeroed filter entries of a new thread never match.
+volatile LONG64 accessed_bit_epoch = ACCESSED_BIT_EPOCH_ONE;
 
 VOID initialize_page_table(VOID) {
 
     vm.num_ptes = vm.va_size_in_bytes / PAGE_SIZE;
+    vm.num_page_tables = (vm.num_ptes + PTES_PER_PAGE_TABLE - 1) / PTES_PER_PAGE_TABLE;
+
+    // Reserve room for every PTE, but commit nothing. Page tables are committed one page at a time
+    // on the first fault in their range, so startup cost no longer scales with the size of the VA space.
+    PTE_base = VirtualAlloc(NULL,
+                            vm.num_page_tables * PAGE_SIZE,
+                            MEM_RESERVE,
+                            PAGE_READWRITE);
+
+    NULL_CHECK(PTE_base, "Could not reserve the PTE region.");
+
+    // Allocate and zero the page directory. A zeroed PDE describes an absent, unlocked page table.
+    PDE_base = (PPDE) zero_malloc(sizeof(PDE) * vm.num_page_tables);
+
+    // Allocate and zero the active PTE bitmap. Nothing is valid yet.
+    num_pte_blocks = vm.num_page_tables * PTE_BLOCKS_PER_PAGE_TABLE;
+    active_pte_bitmap = (volatile LONG64 *) zero_malloc(sizeof(LONG64) * ((num_pte_blocks + 63) / 64));
+}
+
+VOID mark_PTE_block_active(PPTE pte) {
+
+    ULONG64 block = PTE_BLOCK_INDEX(pte);
+    volatile LONG64 *word = &active_pte_bitmap[block / 64];
+
+    // Most faults land in blocks that are already active, so we only pay for the interlocked
+    // operation (and the cache line it dirties) when the bit is actually clear. The fence keeps our
+    // PTE write ahead of this read: otherwise a trimmer could clear the bit, miss our still-buffered
+    // PTE on its recheck, and leave a valid page in an inactive block.
+    MemoryBarrier();
+    if (*word & (1LL << (block % 64))) return;
+    InterlockedBitTestAndSet64(word, (LONG64) (block % 64));
+}
+
+ULONG64 find_next_active_PTE_block(ULONG64 block, PULONG64 words_scanned) {
+    return find_next_active_PTE_block_in_range(block, 0, num_pte_blocks, words_scanned);
+}
+
+ULONG64 find_next_active_PTE_block_in_range(ULONG64 block, ULONG64 first_block, ULONG64 end_block,
+                                            PULONG64 words_scanned) {
+
+    ASSERT(first_block % 64 == 0);
+    if (first_block >= end_block) return NO_ACTIVE_PTE_BLOCK;
+
+    ULONG64 first_word = first_block / 64;
+    ULONG64 end_word = (end_block + 63) / 64;
+    ULONG64 num_words = end_word - first_word;
+    if (block < first_block || block >= end_block) block = first_block;
+
+    ULONG64 word_index = block / 64;
+
+    // The first word is masked so we only see blocks at or after our starting point. We look at it
+    // once more at the end, unmasked, to pick up the blocks before our starting point.
+    ULONG64 word = (ULONG64) active_pte_bitmap[word_index] & (~0ULL << (block % 64));
 
-    // Allocate and zero all PTE data.
-    PTE_base = (PPTE) zero_malloc(sizeof(PTE) * vm.num_ptes);
+    for (ULONG64 i = 0; i <= num_words; i++) {
+        (*words_scanned)++;
 
-    // Initialize all PTE locks
-    for (PPTE pte = PTE_base; pte < PTE_base + vm.num_ptes; pte++) {
-        initialize_byte_lock(&pte->lock);
+        ULONG bit;
+        if (_BitScanForward64(&bit, word)) {
+            ULONG64 found = word_index * 64 + bit;
+            if (found < end_block) return found;
+        }
+
+        word_index++;
+        if (word_index == end_word) word_index = first_word;
+        word = (ULONG64) active_pte_bitmap[word_index];
     }
+    return NO_ACTIVE_PTE_BLOCK;
+}
+
+BOOL try_clear_PTE_block_active(ULONG64 block) {
+
+    InterlockedBitTestAndReset64(&active_pte_bitmap[block / 64], (LONG64) (block % 64));
+
+    // A fault may have made a PTE valid after we last looked, but before we cleared the bit. It fences
+    // between its PTE write and its look at the bit, and our interlocked clear is a full fence too, so
+    // either it sees the bit clear (and sets it again), or one more look here catches its PTE.
+    ULONG64 trimmable;
+    if (get_PTE_block_masks(block, 0, &trimmable) == 0) return TRUE;
+
+    InterlockedBitTestAndSet64(&active_pte_bitmap[block / 64], (LONG64) (block % 64));
+    return FALSE;
 }
 
-// Returns the pte associated with the faulting VA. Divides the offset of the VA within the VA space
-// by the page_size, resulting in the index of the VA within the PTE array.
+ULONG64 get_PTE_block_masks(ULONG64 block, ULONG64 age_bits, PULONG64 trimmable) {
+
+    ASSERT(block < num_pte_blocks);
+    ASSERT(PDE_base[block / PTE_BLOCKS_PER_PAGE_TABLE].table_format.committed);
+
+    // The fields we test: valid, accessed, the lock bit and the given age bits.
+    // A trimmable PTE has only the valid bit set among them.
+    PTE test_bits = {0};
+    test_bits.memory_format.valid = PTE_VALID;
+    test_bits.memory_format.accessed = PTE_ACCESSED;
+    test_bits.memory_format.age = age_bits;
+    test_bits.memory_format.lock = PTE_LOCKED;
+
+    PTE valid_bit = {0};
+    valid_bit.memory_format.valid = PTE_VALID;
+
+    __m128i test_mask = _mm_set1_epi64x((LONG64) test_bits.entire_pte);
+    __m128i valid_mask = _mm_set1_epi64x((LONG64) valid_bit.entire_pte);
+
+    // Two PTEs per 128-bit load. SSE2 has no 64-bit compare, so we compare both 32-bit halves
+    // and require all eight byte-mask bits of a PTE to be set.
+    const __m128i *pte_pair = (const __m128i *) (PTE_base + block * PTES_PER_PTE_BLOCK);
+    ULONG64 valid = 0;
+    ULONG64 candidates = 0;
+
+    for (ULONG64 i = 0; i < PTES_PER_PTE_BLOCK; i += 2, pte_pair++) {
+        __m128i ptes = _mm_load_si128(pte_pair);
+
+        int valid_bytes = _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(ptes, valid_mask), valid_mask));
+        int trimmable_bytes = _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(ptes, test_mask), valid_mask));
+
+        valid |= (ULONG64) ((valid_bytes & 0xFF) == 0xFF) << i;
+        valid |= (ULONG64) ((valid_bytes >> 8) == 0xFF) << (i + 1);
+        candidates |= (ULONG64) ((trimmable_bytes & 0xFF) == 0xFF) << i;
+        candidates |= (ULONG64) ((trimmable_bytes >> 8) == 0xFF) << (i + 1);
+    }
+
+    *trimmable = candidates;
+    return valid;
+}
+
+PPDE get_PDE_from_PTE(PPTE pte) {
+    ASSERT(pte >= PTE_base && pte < PTE_base + vm.num_page_tables * PTES_PER_PAGE_TABLE);
+    return PDE_base + PAGE_TABLE_INDEX(pte);
+}
+
+PPDE get_PDE_from_VA(PULONG_PTR va) {
+    ASSERT(va >= vm.application_va_base && va <= vm.application_va_base + vm.va_size_in_bytes);
+    ULONG_PTR pte_index = ((ULONG_PTR)va - (ULONG_PTR)vm.application_va_base) / PAGE_SIZE;
+    return PDE_base + pte_index / PTES_PER_PAGE_TABLE;
+}
+
+PULONG_PTR get_VA_from_PDE(PPDE pde) {
+    ULONG64 index = (ULONG64) (pde - PDE_base);
+    return (PULONG_PTR) ((ULONG_PTR) vm.application_va_base + index * PTES_PER_PAGE_TABLE * PAGE_SIZE);
+}
+
+BOOL compare_and_swap_pde(PPDE pde, PDE expected, PDE desired) {
+    return InterlockedCompareExchange64((volatile LONG64 *) &pde->entire_pde,
+                                        (LONG64) desired.entire_pde,
+                                        (LONG64) expected.entire_pde) == (LONG64) expected.entire_pde;
+}
+
+VOID lock_pde(PPDE pde) {
+
+#if LOCK_PROFILING
+    ULONG64 start = get_cycle_count();
+    ULONG64 spins = 0;
+#endif
+    BOOL stalled = FALSE;
+    ULONG backoff = 1;
+    while (IS_PDE_LOCKED(pde) ||
+           InterlockedBitTestAndSet64((volatile LONG64 *) &pde->entire_pde, PDE_LOCK_BIT_POSITION)) {
+        if (!stalled) {
+            STALL_BEGIN();
+            stalled = TRUE;
+        }
+        wait(backoff);
+#if LOCK_PROFILING
+        spins += backoff;
+#endif
+        backoff = min(backoff << 1, MAX_WAIT_TIME_BEFORE_RETRY);
+    }
+    if (stalled) STALL_END();
+    LOCK_ACQUIRED(LOCK_CLASS_OTHER, spins, spins ? get_cycle_count() - start : 0);
+}
+
+VOID unlock_pde(PPDE pde) {
+    BOOLEAN was_locked = InterlockedBitTestAndReset64((volatile LONG64 *) &pde->entire_pde, PDE_LOCK_BIT_POSITION);
+    ASSERT(was_locked);
+}
+
+VOID create_page_table(PPDE pde) {
+
+    lock_pde(pde);
+
+    // Someone else may have created it while we waited for the lock, or mapped the whole region as a large page.
+    if (IS_PDE_PRESENT(pde) || IS_PDE_LARGE(pde)) {
+        unlock_pde(pde);
+        return;
+    }
+
+    // Commit the page table's memory, unless that was done before.
+    if (!pde->table_format.committed) {
+        PPTE page_table = PTE_base + (pde - PDE_base) * PTES_PER_PAGE_TABLE;
+        if (VirtualAlloc(page_table, PAGE_SIZE, MEM_COMMIT, PAGE_READWRITE) == NULL) {
+            fatal_error("Could not commit a page table.");
+        }
+    }
+
+    // We hold the lock, so only the pin count can change underneath us. Set both bits atomically.
+    PDE present_bits = {0};
+    present_bits.table_format.present = PDE_PRESENT;
+    present_bits.table_format.committed = TRUE;
+    InterlockedOr64((volatile LONG64 *) &pde->entire_pde, (LONG64) present_bits.entire_pde);
+    ASSERT(IS_PDE_PRESENT(pde) && pde->table_format.committed);
+
+    unlock_pde(pde);
+}
+
+// Walks the directory to find the page table holding this VA, then indexes into it.
 PPTE get_PTE_from_VA(PULONG_PTR va) {
 
     PULONG_PTR application_va_base = vm.application_va_base;
@@ -30,10 +232,128 @@ PPTE get_PTE_from_VA(PULONG_PTR va) {
     ULONG_PTR va_offset = (ULONG_PTR)va - (ULONG_PTR)application_va_base;
     ULONG_PTR pte_index = va_offset / PAGE_SIZE;
 
+    PPDE pde = PDE_base + pte_index / PTES_PER_PAGE_TABLE;
+    if (!IS_PDE_PRESENT(pde)) return NULL;
+
     return PTE_base + pte_index;
 }
 
-// Returns the VA associated with the beginning of the region of VAs for this PTE.
+PPTE get_or_create_PTE_from_VA(PULONG_PTR va) {
+
+    PPTE pte = get_PTE_from_VA(va);
+    if (pte != NULL) return pte;
+
+    ULONG_PTR pte_index = ((ULONG_PTR)va - (ULONG_PTR)vm.application_va_base) / PAGE_SIZE;
+    PPDE pde = PDE_base + pte_index / PTES_PER_PAGE_TABLE;
+    create_page_table(pde);
+
+    // A large page needs no PTE -- the VA is already mapped.
+    if (IS_PDE_LARGE(pde)) return NULL;
+
+    return PTE_base + pte_index;
+}
+
+BOOL pin_page_table(PPTE pte) {
+
+    PPDE pde = get_PDE_from_PTE(pte);
+    PDE snapshot;
+    PDE pinned;
+    ULONG backoff = 1;
+
+    while (TRUE) {
+        snapshot.entire_pde = ReadULong64NoFence(&pde->entire_pde);
+
+        // If the page table is being created (or its region mapped as a large page), wait for that to finish.
+        if (IS_PDE_LOCKED(&snapshot)) {
+            wait(backoff);
+            backoff = min(backoff << 1, MAX_WAIT_TIME_BEFORE_RETRY);
+            continue;
+        }
+
+        // If the region was mapped as a large page, our PTE no longer describes it.
+        if (IS_PDE_LARGE(&snapshot)) return FALSE;
+
+        // If the page table is not there yet, create it.
+        if (!IS_PDE_PRESENT(&snapshot)) {
+            create_page_table(pde);
+            continue;
+        }
+
+        ASSERT(snapshot.table_format.pte_count < PTES_PER_PAGE_TABLE * 2);
+        pinned.entire_pde = snapshot.entire_pde + PDE_ONE_PTE;
+        if (compare_and_swap_pde(pde, snapshot, pinned)) return TRUE;
+    }
+}
+
+VOID unpin_page_table(PPTE pte) {
+    PPDE pde = get_PDE_from_PTE(pte);
+    ASSERT(pde->table_format.pte_count > 0);
+    InterlockedAdd64((volatile LONG64 *) &pde->entire_pde, -(LONG64) PDE_ONE_PTE);
+}
+
+PPTE get_first_PTE_of_next_page_table(PPTE pte) {
+    ULONG64 next_page_table = PAGE_TABLE_INDEX(pte) + 1;
+    if (next_page_table >= vm.num_page_tables) next_page_table = 0;
+    return PTE_base + next_page_table * PTES_PER_PAGE_TABLE;
+}
+
+VOID set_PDE_to_large_page_and_unlock(PPDE pde, ULONG_PTR first_frame_number) {
+
+    ASSERT(IS_PDE_LOCKED(pde));
+    ASSERT(first_frame_number % PAGES_PER_LARGE_PAGE == 0);
+
+    // Keep the committed bit, so a later split or fault can reuse the page table's memory.
+    PDE large = {0};
+    large.large_format.committed = pde->table_format.committed;
+    large.large_format.large = PDE_LARGE_PAGE;
+    large.large_format.accessed = PTE_ACCESSED;
+    large.large_format.frame_number = first_frame_number;
+
+    // The release write publishes the zeroed contents before the large page becomes visible.
+    WriteULong64Release(&pde->entire_pde, large.entire_pde);
+}
+
+BOOL try_split_large_page(PPDE pde) {
+
+    PDE snapshot;
+    snapshot.entire_pde = ReadULong64NoFence(&pde->entire_pde);
+    if (!IS_PDE_LARGE(&snapshot) || IS_PDE_LOCKED(&snapshot)) return FALSE;
+
+    PDE locked = snapshot;
+    locked.large_format.lock = PDE_LOCKED;
+    if (!compare_and_swap_pde(pde, snapshot, locked)) return FALSE;
+
+    PPTE page_table = PTE_base + (pde - PDE_base) * PTES_PER_PAGE_TABLE;
+    if (!snapshot.large_format.committed) {
+        if (VirtualAlloc(page_table, PAGE_SIZE, MEM_COMMIT, PAGE_READWRITE) == NULL) {
+            fatal_error("Could not commit a page table.");
+        }
+    }
+
+    // No one else can reach these PTEs until the page table is marked present, so plain writes will do.
+    // Each PTE starts out unaccessed (but young), since the large page's accessed bit says nothing about any one page.
+    for (ULONG64 i = 0; i < PAGES_PER_LARGE_PAGE; i++) {
+        PTE valid = {0};
+        valid.memory_format.valid = PTE_VALID;
+        valid.memory_format.status = PTE_STATUS_BIT_FOR_VALID;
+        valid.memory_format.frame_number = snapshot.large_format.frame_number + i;
+        valid.memory_format.age = PTE_AGE_YOUNGEST;
+        WriteULong64NoFence(&page_table[i].entire_pte, valid.entire_pte);
+    }
+
+    // Every PTE is now in use, so the count starts full.
+    PDE split = {0};
+    split.table_format.present = PDE_PRESENT;
+    split.table_format.committed = TRUE;
+    split.table_format.pte_count = PAGES_PER_LARGE_PAGE;
+    WriteULong64Release(&pde->entire_pde, split.entire_pde);
+
+    InterlockedIncrement64(&stats.n_large_page_splits);
+    return TRUE;
+}
+
+// Returns the VA associated with the beginning of the region of VAs for this PTE. Since every page table
+// lives at a fixed spot in the PTE region, this needs no walk -- just the PTE's offset in that region.
 PVOID get_VA_from_PTE(PPTE pte) {
 
     ASSERT(pte >= PTE_base && pte <= PTE_base + vm.num_ptes);
@@ -42,66 +362,176 @@ PVOID get_VA_from_PTE(PPTE pte) {
     return (PVOID) ((ULONG_PTR) vm.application_va_base + index * PAGE_SIZE);
 }
 
-void set_PTE_to_transition(PPTE pte) {
+BOOL compare_and_swap_pte(PPTE pte, PTE expected, PTE desired) {
+    return InterlockedCompareExchange64((volatile LONG64 *) &pte->entire_pte,
+                                        (LONG64) desired.entire_pte,
+                                        (LONG64) expected.entire_pte) == (LONG64) expected.entire_pte;
+}
+
+void set_PTE_to_transition(PPTE pte, ULONG64 eviction_stamp) {
+
+    PTE snapshot;
+    PTE temp;
 
-    // Start by copying the whole PTE
-    ULONG64 raw = ReadULong64NoFence((ULONG64 *) pte);
-    PTE temp = {0};
-    temp.entire_pte = raw;
+    // Build the new PTE from a snapshot of the whole word, then swap it in. If anyone touched
+    // the word in the meantime (an accessed bit, a failed lock attempt), we simply rebuild and retry.
+    do {
+        snapshot.entire_pte = ReadULong64NoFence((ULONG64 *) pte);
+        temp = snapshot;
 
-    // Update our two fields
-    temp.transition_format.valid = PTE_INVALID;
-    temp.transition_format.status = PTE_IN_TRANSITION;
+        // Update our two fields
+        temp.transition_format.valid = PTE_INVALID;
+        temp.transition_format.status = PTE_IN_TRANSITION;
 
-    // Write back all bits at once to avoid partial modification
-    WriteULong64NoFence((ULONG64 *) pte, temp.entire_pte);
+        // Remember where (and when) the page was trimmed from. This replaces its age, which is no use to us now.
+        temp.transition_format.evicted_class = snapshot.memory_format.policy_class;
+        temp.transition_format.eviction_stamp = eviction_stamp;
+        temp.transition_format.reserved = 0;
+
+    } while (!compare_and_swap_pte(pte, snapshot, temp));
+
+    PROBE_PTE_TRANSITION(pte - PTE_base, PROBE_PTE_STATE_TRANSITION);
 }
 
 void set_PTE_to_valid(PPTE pte, ULONG_PTR frame_number) {
 
-    // Start by copying the whole PTE
-    ULONG64 raw = ReadULong64NoFence((ULONG64 *) pte);
-    PTE temp = {0};
-    temp.entire_pte = raw;
+    PTE snapshot;
+    PTE temp;
+
+    do {
+        snapshot.entire_pte = ReadULong64NoFence((ULONG64 *) pte);
+        temp = snapshot;
+
+        // Set valid bit, set frame number. The page starts young.
+        temp.memory_format.valid = PTE_VALID;
+        temp.memory_format.status = PTE_STATUS_BIT_FOR_VALID;
+        temp.memory_format.frame_number = frame_number;
+        temp.memory_format.age = PTE_AGE_YOUNGEST;
+        temp.memory_format.policy_class = 0;
+        temp.memory_format.reserved = 0;
+
+    } while (!compare_and_swap_pte(pte, snapshot, temp));
+
+    mark_PTE_block_active(pte);
+    PROBE_PTE_TRANSITION(pte - PTE_base, PROBE_PTE_STATE_VALID);
+}
+
+void set_PTE_to_valid_and_unlock(PPTE pte, ULONG_PTR frame_number, ULONG policy_class) {
 
-    // Set valid bit, set frame number
+    // Since we own the lock and the PTE is not yet valid, no one else can change this word:
+    // accessed bits are only set on valid PTEs, and only the owner of a standby page can
+    // move a transition PTE to disk. Failed lock attempts leave the word as it was.
+    PTE temp;
+    temp.entire_pte = ReadULong64NoFence((ULONG64 *) pte);
+
+    ASSERT(IS_PTE_LOCKED(&temp));
+    ASSERT(!IS_PTE_VALID(&temp));
+
+    // Set valid bit, set frame number, and drop the lock in the same write. The page starts young.
     temp.memory_format.valid = PTE_VALID;
     temp.memory_format.status = PTE_STATUS_BIT_FOR_VALID;
     temp.memory_format.frame_number = frame_number;
+    temp.memory_format.age = PTE_AGE_YOUNGEST;
+    temp.memory_format.policy_class = policy_class;
+    temp.memory_format.reserved = 0;
+    temp.memory_format.lock = PTE_UNLOCKED;
 
-    // Write back all bits at once to avoid partial modification
-    WriteULong64NoFence((DWORD64*) pte, temp.entire_pte);
+    // The release write publishes the page contents before the PTE becomes valid.
+    WriteULong64Release((DWORD64 *) pte, temp.entire_pte);
+
+    // Mark the block only after the PTE is valid, so the trimmer's clear-and-recheck cannot miss it.
+    mark_PTE_block_active(pte);
+    PROBE_PTE_TRANSITION(pte - PTE_base, PROBE_PTE_STATE_VALID);
 }
 
 void map_pte_to_disk(PPTE pte, UINT64 disk_index) {
 
     validate_disk_slot(disk_index);
 
-    // Start by copying the whole PTE
-    ULONG64 raw = ReadULong64NoFence((ULONG64 *) pte);
-    PTE temp = {0};
-    temp.entire_pte = raw;
+    PTE snapshot;
+    PTE temp;
+
+    // This is called WITHOUT the PTE lock, while a soft-faulting thread may be holding it.
+    // The compare-exchange guarantees we never write back a stale lock bit.
+    do {
+        snapshot.entire_pte = ReadULong64NoFence((ULONG64 *) pte);
+        ASSERT(IS_PTE_TRANSITION(&snapshot));
+        temp = snapshot;
+
+        // Clear the frame number, add the disk index, update the status bits
+        temp.memory_format.frame_number = NO_FRAME_ASSIGNED;
+        temp.disk_format.valid = PTE_INVALID;
+        temp.disk_format.status = PTE_ON_DISK;
+        temp.disk_format.disk_index = disk_index;
+
+    } while (!compare_and_swap_pte(pte, snapshot, temp));
+
+    PROBE_PTE_TRANSITION(pte - PTE_base, PROBE_PTE_STATE_ON_DISK);
+}
+
+// One attempt at the PTE lock, which lock_pte() and try_lock_pte() count in their own ways.
+static BOOL attempt_pte_lock(PPTE pte) {
 
-    // Clear the frame number, add the disk index, update the status bits
-    temp.memory_format.frame_number = NO_FRAME_ASSIGNED;
-    temp.disk_format.valid = PTE_INVALID;
-    temp.disk_format.status = PTE_ON_DISK;
-    temp.disk_format.disk_index = disk_index;
+    // If the lock is already acquired, no need to try the interlocked operation.
+    if (IS_PTE_LOCKED(pte)) return FALSE;
 
-    // Write back all bits at once to avoid partial modification
-    WriteULong64NoFence((DWORD64*) pte, temp.entire_pte);
+    return !InterlockedBitTestAndSet64((volatile LONG64 *) &pte->entire_pte, PTE_LOCK_BIT_POSITION);
 }
 
 VOID lock_pte(PPTE pte) {
-    lock(&pte->lock);
+
+#if LOCK_PROFILING
+    ULONG64 start = get_cycle_count();
+    ULONG64 spins = 0;
+#endif
+    BOOL stalled = FALSE;
+    ULONG backoff = 1;
+    while (!attempt_pte_lock(pte)) {
+        if (!stalled) {
+            STALL_BEGIN();
+            stalled = TRUE;
+        }
+
+        // Same exponential backoff as our byte locks.
+        wait(backoff);
+#if LOCK_PROFILING
+        spins += backoff;
+#endif
+        backoff = min(backoff << 1, MAX_WAIT_TIME_BEFORE_RETRY);
+    }
+    if (stalled) STALL_END();
+    LOCK_ACQUIRED(LOCK_CLASS_PTE, spins, spins ? get_cycle_count() - start : 0);
 }
 
 BOOL try_lock_pte(PPTE pte) {
-    return try_lock(&pte->lock);
+
+    if (!attempt_pte_lock(pte)) {
+        LOCK_TRY_FAILED(LOCK_CLASS_PTE);
+        return FALSE;
+    }
+    LOCK_ACQUIRED(LOCK_CLASS_PTE, 0, 0);
+    return TRUE;
+}
+
+BOOL try_lock_pte_if_unchanged(PPTE pte, PTE expected) {
+
+    ASSERT(!IS_PTE_LOCKED(&expected));
+
+    PTE locked = expected;
+    locked.memory_format.lock = PTE_LOCKED;
+    if (compare_and_swap_pte(pte, expected, locked)) {
+        LOCK_ACQUIRED(LOCK_CLASS_PTE, 0, 0);
+        return TRUE;
+    }
+
+    // The PTE may simply have changed. We only count a failure if someone holds its lock.
+    if (IS_PTE_LOCKED(pte)) LOCK_TRY_FAILED(LOCK_CLASS_PTE);
+    return FALSE;
 }
 
 VOID unlock_pte(PPTE pte) {
-    unlock(&pte->lock);
+    BOOLEAN was_locked = InterlockedBitTestAndReset64((volatile LONG64 *) &pte->entire_pte, PTE_LOCK_BIT_POSITION);
+    ASSERT(was_locked);
 }
 
 VOID map_single_page_from_pte(PPTE pte) {
@@ -116,9 +546,24 @@ VOID map_single_page_from_pte(PPTE pte) {
  */
 VOID set_accessed_bit(PULONG_PTR va) {
 
-    // Get a snapshot of the PTE of the VA
+    // Get a snapshot of the PTE of the VA. If its page table is absent, it cannot be valid.
     PPTE pte = get_PTE_from_VA(va);
-    PTE snapshot = *pte;
+    if (pte == NULL) {
+#if LARGE_PAGES
+        // ...unless the whole region is one large page, which keeps a single accessed bit in its PDE.
+        PPDE pde = get_PDE_from_VA(va);
+        PDE pde_snapshot;
+        pde_snapshot.entire_pde = ReadULong64NoFence(&pde->entire_pde);
+        if (!IS_PDE_LARGE(&pde_snapshot) || IS_PDE_ACCESSED(&pde_snapshot)) return;
+
+        PDE accessed_pde = pde_snapshot;
+        accessed_pde.large_format.accessed = PTE_ACCESSED;
+        compare_and_swap_pde(pde, pde_snapshot, accessed_pde);
+#endif
+        return;
+    }
+    PTE snapshot;
+    snapshot.entire_pte = ReadULong64NoFence((ULONG64 *) pte);
 
     // If the PTE is no longer valid, do not set its access bit
     if (!IS_PTE_VALID(&snapshot)) return;
@@ -126,13 +571,22 @@ VOID set_accessed_bit(PULONG_PTR va) {
     // If the PTE is already accessed, return. It could be trimmed immediately, but that's okay.
     if (IS_PTE_ACCESSED(&snapshot)) return;
 
-    // Set the access bit atomically. If the PTE is made invalid along the way,
+    // Set the access bit atomically. If the PTE is made invalid (or locked) along the way,
     // abort the process and return.
     PTE accessed = snapshot;
     accessed.memory_format.accessed = PTE_ACCESSED;
-    InterlockedCompareExchange64((volatile LONG64 *) pte,
-                        (LONG64) &accessed,
-                        (LONG64) &snapshot);
+    compare_and_swap_pte(pte, snapshot, accessed);
+}
+
+VOID begin_accessed_bit_pass(VOID) {
+    // The interlocked increment is a full fence, so no accessed bit we clear afterward can be
+    // skipped by a thread that has not seen our pass begin.
+    InterlockedIncrement64(&accessed_bit_epoch);
+}
+
+VOID end_accessed_bit_pass(VOID) {
+    // A single add ends our pass and starts a new epoch, so no filter entry from before our clears can match.
+    InterlockedAdd64(&accessed_bit_epoch, ACCESSED_BIT_EPOCH_ONE - 1);
 }
 
 VOID clear_accessed_bit(PPTE pte) {
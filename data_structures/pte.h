@@ -25,6 +25,26 @@
 
 #define ACCESSED_BIT_POSITION   4
 
+// Valid and transition PTEs keep a history of their accessed bits from the ager's recent sweeps.
+// Each sweep shifts the history right and puts the accessed bit in the top. A history of zero means
+// the page went untouched for all of the last PTE_AGE_BITS sweeps.
+#define PTE_AGE_BITS            8
+#define PTE_AGE_YOUNGEST        (1ULL << (PTE_AGE_BITS - 1))      // Just accessed, and nothing known before that
+
+// Replacement policies may sort valid pages into a few classes (hot and cold, for instance).
+// When a page is trimmed, its class and a stamp from the eviction clock are kept in the invalid PTE,
+// so a policy can recognize the page if it faults back in soon after (a "ghost" hit).
+#define PTE_POLICY_CLASS_BITS   2
+#define PTE_EVICTION_STAMP_BITS 14
+
+// The PTE lock lives in the top bit of the PTE itself, so every PTE is a single 64-bit word.
+// All state transitions are compare-exchanges that carry the lock bit across unchanged.
+#define PTE_LOCK_BITS           1
+#define PTE_LOCK_BIT_POSITION   63
+#define PTE_LOCK_MASK           (1ULL << PTE_LOCK_BIT_POSITION)
+#define PTE_UNLOCKED            0
+#define PTE_LOCKED              1
+
 // This is the default value given to the frame_number field for a PTE that has no connected frame.
 #define NO_FRAME_ASSIGNED       0
 
@@ -37,7 +57,10 @@ typedef struct {
     UINT64 dirty : 1;                       // Dirty bit -- 0 for unmodified, 1 for modified
     UINT64 accessed : 1;                    // Accessed bit -- indicates if the page has been accessed to track frequency
     UINT64 frame_number : FRAME_NUMBER_BITS;// 40 bits to hold the frame number
-    UINT64 reserved : (64 - STATE_BITS - FRAME_NUMBER_BITS); // Remaining bits reserved for later
+    UINT64 age : PTE_AGE_BITS;              // Accessed bits from recent aging sweeps, most recent on top
+    UINT64 policy_class : PTE_POLICY_CLASS_BITS;    // Which of its policy's classes the page is in
+    UINT64 reserved : (64 - STATE_BITS - FRAME_NUMBER_BITS - PTE_AGE_BITS - PTE_POLICY_CLASS_BITS - PTE_LOCK_BITS); // Remaining bits reserved for later
+    UINT64 lock : PTE_LOCK_BITS;            // Lock bit -- 1 while a thread owns the PTE
 } VALID_PTE;
 
 typedef struct {
@@ -47,7 +70,10 @@ typedef struct {
     UINT64 dirty : 1;                       // Dirty bit -- 0 for unmodified, 1 for modified
     UINT64 accessed : 1;                    // Accessed bit -- indicates if the page has been accessed to track frequency
     UINT64 frame_number : FRAME_NUMBER_BITS;// 40 bits to hold the frame number
-    UINT64 reserved : (64 - STATE_BITS - FRAME_NUMBER_BITS); // Remaining bits reserved for later
+    UINT64 evicted_class : PTE_POLICY_CLASS_BITS;   // The policy class the page was trimmed from
+    UINT64 eviction_stamp : PTE_EVICTION_STAMP_BITS;// The eviction clock when the page was trimmed
+    UINT64 reserved : (64 - STATE_BITS - FRAME_NUMBER_BITS - PTE_POLICY_CLASS_BITS - PTE_EVICTION_STAMP_BITS - PTE_LOCK_BITS); // Remaining bits reserved for later
+    UINT64 lock : PTE_LOCK_BITS;            // Lock bit -- 1 while a thread owns the PTE
 } TRANSITION_PTE;
 
 typedef struct {
@@ -56,8 +82,11 @@ typedef struct {
     UINT64 readwrite : 1;                   // Read/Write bit -- 0 for read privileges, 1 for write privileges
     UINT64 dirty : 1;                       // Dirty bit -- 0 for unmodified, 1 for modified
     UINT64 accessed : 1;                    // Accessed bit -- indicates if the page has been accessed to track frequency
-    UINT64 disk_index : DISK_INDEX_BITS;    // 22 bits to hold the disk index
-    UINT64 reserved : (64 - STATE_BITS - DISK_INDEX_BITS);  // Remaining bits reserved for later
+    UINT64 disk_index : DISK_INDEX_BITS;    // 40 bits to hold the disk index
+    UINT64 evicted_class : PTE_POLICY_CLASS_BITS;   // Carried over from the transition PTE
+    UINT64 eviction_stamp : PTE_EVICTION_STAMP_BITS;// Carried over from the transition PTE
+    UINT64 reserved : (64 - STATE_BITS - DISK_INDEX_BITS - PTE_POLICY_CLASS_BITS - PTE_EVICTION_STAMP_BITS - PTE_LOCK_BITS);  // Remaining bits reserved for later
+    UINT64 lock : PTE_LOCK_BITS;            // Lock bit -- 1 while a thread owns the PTE
 } INVALID_PTE;
 
 typedef struct {
@@ -67,48 +96,239 @@ typedef struct {
         INVALID_PTE disk_format;
         ULONG_PTR entire_pte;
     };
-    BYTE_LOCK lock;
 } PTE, *PPTE;
 
-#define IS_PTE_ZEROED(pte)      ((pte)->entire_pte == ZERO_PTE)
+// A zeroed PTE may still be locked by the thread resolving its first fault.
+#define IS_PTE_ZEROED(pte)      (((pte)->entire_pte & ~PTE_LOCK_MASK) == ZERO_PTE)
+#define IS_PTE_LOCKED(pte)      ((pte)->memory_format.lock == PTE_LOCKED)
 #define IS_PTE_VALID(pte)       ((pte)->memory_format.valid == PTE_VALID)
 #define IS_PTE_TRANSITION(pte)  ((pte)->transition_format.valid == PTE_INVALID && (pte)->transition_format.status == PTE_IN_TRANSITION && (pte)->transition_format.frame_number != NO_FRAME_ASSIGNED)
 #define IS_PTE_ON_DISK(pte)     ((pte)->disk_format.valid == PTE_INVALID && (pte)->disk_format.status == PTE_ON_DISK)
 #define IS_PTE_ACCESSED(pte)    ((pte)->memory_format.accessed == PTE_ACCESSED)
 
+// Our page table has two levels. Each page directory entry (PDE) describes one page table:
+// a single page of PTEs, which covers PTES_PER_PAGE_TABLE virtual pages. A page table is committed on
+// its region's first fault, and stays: once faulted, a PTE never returns to zero (its page is either
+// resident or on the disk), so the count of PTEs in use never falls back to zero.
+#define PTES_PER_PAGE_TABLE         (PAGE_SIZE / sizeof(PTE))
+
+#define PDE_NOT_PRESENT             0
+#define PDE_PRESENT                 1
+#define PDE_UNLOCKED                0
+#define PDE_LOCKED                  1
+#define PDE_LOCK_BIT_POSITION       1
+
+#define PDE_PTE_COUNT_BITS          16
+#define PDE_PTE_COUNT_SHIFT         (64 - PDE_PTE_COUNT_BITS)
+#define PDE_ONE_PTE                 (1ULL << PDE_PTE_COUNT_SHIFT)
+
+#define PAGE_TABLE_INDEX(pte)       ((ULONG64) ((pte) - PTE_base) / PTES_PER_PAGE_TABLE)
+
+// The active PTE bitmap has one bit per block of 64 PTEs (eight cache lines). A set bit means the block
+// may hold valid PTEs; a clear bit means it definitely does not. Bits are set on every valid transition,
+// and cleared lazily by the trimmer when it finds a block with nothing valid left in it.
+#define PTES_PER_PTE_BLOCK          64
+#define PTE_BLOCKS_PER_PAGE_TABLE   (PTES_PER_PAGE_TABLE / PTES_PER_PTE_BLOCK)
+#define CACHE_LINE_SIZE             64
+#define CACHE_LINES_PER_PTE_BLOCK   (PTES_PER_PTE_BLOCK * sizeof(PTE) / CACHE_LINE_SIZE)
+#define PTE_BLOCK_INDEX(pte)        ((ULONG64) ((pte) - PTE_base) / PTES_PER_PTE_BLOCK)
+#define NO_ACTIVE_PTE_BLOCK         ULLONG_MAX
+
+// A large page maps a whole page table's worth of VA (2 MB) to one contiguous, aligned run of frames.
+#define PAGES_PER_LARGE_PAGE        PTES_PER_PAGE_TABLE
+#define PDE_LARGE_PAGE              1
+
+typedef struct {
+    UINT64 present : 1;                     // 1 if the page table is committed and in use
+    UINT64 lock : 1;                        // Held while the page table is created, or a large page mapped
+    UINT64 committed : 1;                   // 1 once memory has been committed for the page table
+    UINT64 large : 1;                       // 0 -- this PDE points to a page table
+    UINT64 reserved : (64 - 4 - PDE_PTE_COUNT_BITS);
+    UINT64 pte_count : PDE_PTE_COUNT_BITS;  // Non-zero PTEs in the page table, plus first faults in flight
+} PAGE_TABLE_PDE;
+
+typedef struct {
+    UINT64 present : 1;                     // 0 -- there is no page table in use beneath a large page
+    UINT64 lock : 1;                        // Held while the large page is mapped or split
+    UINT64 committed : 1;                   // Carried over from the page table that used to be here
+    UINT64 large : 1;                       // 1 -- this PDE maps a large page directly
+    UINT64 accessed : 1;                    // Accessed bit for the whole large page
+    UINT64 frame_number : FRAME_NUMBER_BITS;// The first frame of the run
+    UINT64 reserved : (64 - 5 - FRAME_NUMBER_BITS - PDE_PTE_COUNT_BITS);
+    UINT64 pte_count : PDE_PTE_COUNT_BITS;  // Always zero for a large page
+} LARGE_PAGE_PDE;
+
+typedef struct {
+    union {
+        PAGE_TABLE_PDE table_format;
+        LARGE_PAGE_PDE large_format;
+        ULONG64 entire_pde;
+    };
+} PDE, *PPDE;
+
+#define IS_PDE_PRESENT(pde)     ((pde)->table_format.present == PDE_PRESENT)
+#define IS_PDE_LOCKED(pde)      ((pde)->table_format.lock == PDE_LOCKED)
+#define IS_PDE_LARGE(pde)       ((pde)->large_format.large == PDE_LARGE_PAGE)
+#define IS_PDE_ACCESSED(pde)    ((pde)->large_format.accessed == PTE_ACCESSED)
+
+// A region can become a large page only if it has never been touched: no page table in use and nothing in flight.
+#define IS_PDE_UNTOUCHED(pde)   (!IS_PDE_PRESENT(pde) && !IS_PDE_LARGE(pde) && !IS_PDE_LOCKED(pde) && (pde)->table_format.pte_count == 0)
+
 /*
- *  This represents the base of our page table. For now, it is simply
- *  an array of PTEs, each of which contains information about its
- *  corresponding virtual page.
+ *  This represents the base of our page tables. The PTEs for the whole VA space live in one
+ *  reserved (but uncommitted) region, so a PTE's address still tells us its VA. Each page of
+ *  PTEs is only committed once something in its range faults.
  */
 extern PPTE PTE_base;
 
 /*
- *  Initializes the above array of PTEs to be large enough to provide a PTE for each
- *  virtual page in the VA space.
+ *  The page directory: one PDE per page of PTEs.
+ */
+extern PPDE PDE_base;
+
+/*
+ *  The active PTE bitmap, and the number of PTE blocks it covers.
+ */
+extern volatile LONG64 *active_pte_bitmap;
+extern ULONG64 num_pte_blocks;
+
+/*
+ *  Reserves the region of PTEs and allocates the page directory. No page tables are committed yet.
  */
 VOID initialize_page_table(VOID);
 
 /*
- *  Provides a translation from the given VA to its associated PTE.
+ *  Marks the block holding this PTE as possibly holding valid PTEs. Called after the PTE becomes valid.
+ */
+VOID mark_PTE_block_active(PPTE pte);
+
+/*
+ *  Starting at the given block and wrapping around, returns the first block whose active bit is set.
+ *  Adds the number of bitmap words read to words_scanned. Returns NO_ACTIVE_PTE_BLOCK if no bit is set.
+ */
+ULONG64 find_next_active_PTE_block(ULONG64 block, PULONG64 words_scanned);
+
+/*
+ *  As above, but only looks at blocks in [first_block, end_block), wrapping around within them.
+ *  The first block must start a word of the bitmap (a multiple of 64).
+ */
+ULONG64 find_next_active_PTE_block_in_range(ULONG64 block, ULONG64 first_block, ULONG64 end_block,
+                                            PULONG64 words_scanned);
+
+/*
+ *  Clears the block's active bit if it holds no valid PTEs. Returns TRUE if the bit was cleared
+ *  and stayed clear, or FALSE if a PTE in the block became valid in the meantime.
+ */
+BOOL try_clear_PTE_block_active(ULONG64 block);
+
+/*
+ *  Tests every PTE in the block at once. Returns a mask with one bit per valid PTE,
+ *  and sets trimmable to the mask of valid PTEs that are neither accessed nor locked,
+ *  and that have none of the bits in age_bits set in their history.
+ *  The block's page table must be committed.
+ */
+ULONG64 get_PTE_block_masks(ULONG64 block, ULONG64 age_bits, PULONG64 trimmable);
+
+/*
+ *  Walks the page directory to translate the given VA to its associated PTE.
+ *  Returns NULL if the page table covering the VA has not been created (or a large page covers it).
  */
 PPTE get_PTE_from_VA(PULONG_PTR va);
 
+/*
+ *  Walks the page directory to translate the given VA to its PTE, creating the page table if necessary.
+ *  Returns NULL if the VA is covered by a large page, which needs no PTE.
+ */
+PPTE get_or_create_PTE_from_VA(PULONG_PTR va);
+
+/*
+ *  Returns the PDE that describes the page table holding this PTE.
+ */
+PPDE get_PDE_from_PTE(PPTE pte);
+
+/*
+ *  Returns the PDE that covers this VA.
+ */
+PPDE get_PDE_from_VA(PULONG_PTR va);
+
+/*
+ *  Returns the VA at the start of the region described by this PDE.
+ */
+PULONG_PTR get_VA_from_PDE(PPDE pde);
+
+/*
+ *  Atomically replaces the PDE with desired, if and only if it still holds expected.
+ */
+BOOL compare_and_swap_pde(PPDE pde, PDE expected, PDE desired);
+
+/*
+ *  Waits for, or releases, the lock bit in the given PDE.
+ */
+VOID lock_pde(PPDE pde);
+VOID unlock_pde(PPDE pde);
+
+/*
+ *  Commits the page table described by this PDE, if it is not already present.
+ *  Does nothing if the region is mapped by a large page.
+ */
+VOID create_page_table(PPDE pde);
+
+/*
+ *  Counts a zeroed PTE that is being faulted in, so its region cannot be mapped as a large page meanwhile.
+ *  The pin becomes the PTE's permanent count if the PTE leaves its zeroed state.
+ *  Returns FALSE (without a pin) if the region has since been mapped by a large page.
+ */
+BOOL pin_page_table(PPTE pte);
+
+/*
+ *  Releases a pin taken above, when the PTE was left zeroed.
+ */
+VOID unpin_page_table(PPTE pte);
+
+/*
+ *  Returns the first PTE of the next page table after the given PTE, wrapping around.
+ */
+PPTE get_first_PTE_of_next_page_table(PPTE pte);
+
+/*
+ *  Publishes a large page in a PDE locked by the caller, releasing the lock in the same write.
+ */
+VOID set_PDE_to_large_page_and_unlock(PPDE pde, ULONG_PTR first_frame_number);
+
+/*
+ *  Replaces a large page with a page table of valid PTEs for the same frames, so its pages
+ *  can be trimmed one at a time. The mappings themselves do not change.
+ *  Returns FALSE if the PDE is not an unlocked large page.
+ */
+BOOL try_split_large_page(PPDE pde);
+
 /*
  *  Provides a translation from the given VA to its corresponding PTE.
  */
 PVOID get_VA_from_PTE(PPTE pte);
 
 /*
- *  Moves an active PTE into the transition state.
+ *  Atomically replaces the PTE with desired, if and only if it still holds expected.
+ *  Returns TRUE if the swap took place.
+ */
+BOOL compare_and_swap_pte(PPTE pte, PTE expected, PTE desired);
+
+/*
+ *  Moves an active PTE into the transition state, recording its policy class and the given eviction stamp.
  */
-void set_PTE_to_transition(PPTE pte);
+void set_PTE_to_transition(PPTE pte, ULONG64 eviction_stamp);
 
 /*
  *  Moves an invalid PTE into the valid state.
  */
 void set_PTE_to_valid(PPTE pte, ULONG_PTR frame_number);
 
+/*
+ *  Moves a PTE locked by the caller into the valid state (in the given policy class)
+ *  and releases its lock, all in one 64-bit write.
+ */
+void set_PTE_to_valid_and_unlock(PPTE pte, ULONG_PTR frame_number, ULONG policy_class);
+
 /*
  *  These will likely be replaced with a call to the page file metadata
  */
@@ -124,6 +344,12 @@ VOID lock_pte(PPTE pte);
  */
 BOOL try_lock_pte(PPTE pte);
 
+/*
+ *  Locks the PTE only if it still holds the given (unlocked) value. This folds the state
+ *  check and the lock acquire into a single compare-exchange.
+ */
+BOOL try_lock_pte_if_unchanged(PPTE pte, PTE expected);
+
 /*
  *  Releases the lock held on the given PTE.
  */
@@ -142,4 +368,21 @@ VOID set_accessed_bit(PULONG_PTR va);
 /*
     Clears the accessed bit -- called by trimmer.
  */
-VOID clear_accessed_bit(PPTE pte);
\ No newline at end of file
+VOID clear_accessed_bit(PPTE pte);
+
+/*
+    The accessed bit epoch. User threads remember which pages they have already marked
+    in the current epoch, and skip marking them again. Anyone who clears accessed bits must
+    do so in a pass: begin_accessed_bit_pass before the first clear, and end_accessed_bit_pass
+    after the last. While any pass runs, user threads mark every access and remember none,
+    and each pass ends in a new epoch. So a page is only ever skipped if it was marked after
+    its last clear.
+
+    The low bits count the passes running; the rest are the epoch.
+ */
+#define ACCESSED_BIT_PASSES_MASK        0xFFFFLL
+#define ACCESSED_BIT_EPOCH_ONE          (ACCESSED_BIT_PASSES_MASK + 1)
+
+extern volatile LONG64 accessed_bit_epoch;
+VOID begin_accessed_bit_pass(VOID);
+VOID end_accessed_bit_pass(VOID);
\ No newline at end of file
@@ -0,0 +1,49 @@
+#include "sharded_counter.h"
+
+// Each thread takes the next shard the first time it updates any counter, and keeps it. Zero means none yet.
+static __declspec(thread) ULONG thread_shard;
+static volatile LONG next_shard;
+
+static ULONG get_thread_shard(VOID) {
+    if (thread_shard == 0) thread_shard = (ULONG) InterlockedIncrement(&next_shard);
+    return thread_shard % COUNTER_SHARDS;
+}
+
+VOID add_to_counter(PSHARDED_COUNTER counter, LONG64 amount) {
+    COUNTER_SHARD *shard = &counter->shards[get_thread_shard()];
+
+    // The shard is almost always ours alone, so this interlocked add stays on our own cache line.
+    // It is only interlocked for when more threads than shards share one.
+    LONG64 value = InterlockedAdd64(&shard->value, amount);
+    if (value < COUNTER_SHARD_BATCH && value > -COUNTER_SHARD_BATCH) return;
+
+    // Fold what our shard holds into the total.
+    value = InterlockedExchange64(&shard->value, 0);
+    InterlockedAdd64(&counter->total, value);
+}
+
+LONG64 read_counter_approximate(PSHARDED_COUNTER counter) {
+    return ReadNoFence64(&counter->total);
+}
+
+LONG64 read_counter_exact(PSHARDED_COUNTER counter) {
+    LONG64 sum = ReadNoFence64(&counter->total);
+    for (ULONG i = 0; i < COUNTER_SHARDS; i++) sum += ReadNoFence64(&counter->shards[i].value);
+    return sum;
+}
+
+BOOL is_counter_below(PSHARDED_COUNTER counter, LONG64 threshold) {
+    LONG64 total = ReadNoFence64(&counter->total);
+
+    // Each shard holds less than COUNTER_SHARD_BATCH either way, so this far out the shards cannot matter.
+    LONG64 margin = COUNTER_SHARDS * COUNTER_SHARD_BATCH;
+    if (total < threshold - margin) return TRUE;
+    if (total >= threshold + margin) return FALSE;
+
+    return read_counter_exact(counter) < threshold;
+}
+
+VOID set_counter(PSHARDED_COUNTER counter, LONG64 value) {
+    for (ULONG i = 0; i < COUNTER_SHARDS; i++) counter->shards[i].value = 0;
+    counter->total = value;
+}
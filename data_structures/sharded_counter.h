@@ -0,0 +1,50 @@
+#pragma once
+#include <Windows.h>
+
+/*
+ *  A counter that many threads update often. A single interlocked counter moves its cache line from
+ *  core to core on every update. Instead, each thread adds to its own shard, on its own cache line, and
+ *  only folds its shard into the shared total once the shard holds COUNTER_SHARD_BATCH or more.
+ *
+ *  Reading the total alone is cheap, and off by less than COUNTER_SHARD_BATCH for each shard -- close
+ *  enough for reporting while we run, but not for a yes or no answer near a threshold. Reading it exactly
+ *  means summing every shard, which we only do when the total is too close to call.
+ */
+#define COUNTER_SHARDS                  64
+#define COUNTER_SHARD_BATCH             16
+
+__declspec(align(64))
+typedef struct __counter_shard {
+    volatile LONG64 value;
+} COUNTER_SHARD;
+
+typedef struct __sharded_counter {
+    __declspec(align(64)) volatile LONG64 total;
+    COUNTER_SHARD shards[COUNTER_SHARDS];
+} SHARDED_COUNTER, *PSHARDED_COUNTER;
+
+/*
+ *  Adds amount (which may be negative) to this thread's shard.
+ */
+VOID add_to_counter(PSHARDED_COUNTER counter, LONG64 amount);
+
+/*
+ *  Returns the total without looking at the shards. Cheap enough to call on every fault.
+ */
+LONG64 read_counter_approximate(PSHARDED_COUNTER counter);
+
+/*
+ *  Returns the total plus every shard. Exact once updates stop, and close while they are running.
+ */
+LONG64 read_counter_exact(PSHARDED_COUNTER counter);
+
+/*
+ *  Returns whether the counter is below threshold. Reads only the total while it is too far from threshold
+ *  for the shards to change the answer, and the exact count otherwise.
+ */
+BOOL is_counter_below(PSHARDED_COUNTER counter, LONG64 threshold);
+
+/*
+ *  Sets the counter to value. Only call while no other thread is updating it.
+ */
+VOID set_counter(PSHARDED_COUNTER counter, LONG64 value);
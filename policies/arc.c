@@ -0,0 +1,72 @@
+#include "policy.h"
+
+/*
+ *  ARC, in its clock-based form (CAR). T1 holds pages seen once recently, T2 pages seen at least twice.
+ *  The hand moves accessed T1 pages to T2, and takes unaccessed pages from whichever list is over its
+ *  target. The target for T1 adapts: a ghost hit on a page trimmed from T1 (B1) says T1 is too small,
+ *  and one on a page trimmed from T2 (B2) says T2 is.
+ */
+
+#define ARC_T1                  0
+#define ARC_T2                  1
+
+volatile LONG64 arc_t1_target;
+
+VOID arc_initialize(VOID) {
+    arc_t1_target = 0;
+}
+
+VOID adjust_arc_t1_target(LONG64 change) {
+    LONG64 target = arc_t1_target + change;
+    target = max(0, min(target, (LONG64) vm.allocated_frame_count));
+    WriteNoFence64(&arc_t1_target, target);
+}
+
+ULONG arc_on_fault(PTE previous) {
+
+    if (!is_recently_evicted(previous, vm.allocated_frame_count)) return ARC_T1;
+
+    LONG64 b1 = max(1, ghost_class_counts[ARC_T1]);
+    LONG64 b2 = max(1, ghost_class_counts[ARC_T2]);
+
+    if (previous.transition_format.evicted_class == ARC_T1) {
+        adjust_arc_t1_target(max(1, b2 / b1));
+    } else {
+        adjust_arc_t1_target(-max(1, b1 / b2));
+    }
+    return ARC_T2;
+}
+
+BOOL arc_decide(PPTE pte) {
+
+    BOOL t1_over_target = resident_class_counts[ARC_T1] >= max(1, arc_t1_target);
+
+    if (pte->memory_format.policy_class == ARC_T1) {
+        if (IS_PTE_ACCESSED(pte)) {
+            pte->memory_format.accessed = !PTE_ACCESSED;
+            pte->memory_format.policy_class = ARC_T2;
+            return FALSE;
+        }
+        return t1_over_target;
+    }
+
+    if (IS_PTE_ACCESSED(pte)) {
+        pte->memory_format.accessed = !PTE_ACCESSED;
+        return FALSE;
+    }
+    return !t1_over_target;
+}
+
+ULONG64 arc_select_victims(PPOLICY_HAND hand, PPTE *victims, ULONG64 capacity) {
+    return clock_select_victims(hand, arc_decide, victims, capacity);
+}
+
+REPLACEMENT_POLICY arc_policy = {
+    .name = "arc",
+    .uses_ager = FALSE,
+    .class_names = {"T1", "T2"},
+    .initialize = arc_initialize,
+    .on_access = set_accessed_bit,
+    .on_fault = arc_on_fault,
+    .select_victims = arc_select_victims,
+};
@@ -0,0 +1,45 @@
+#include "policy.h"
+
+/*
+ *  CLOCK with multi-bit ages. The hand clears the accessed bit of each page it passes and counts the
+ *  revolutions the page has gone without one in its age. A page is taken once it has been idle for
+ *  CLOCK_VICTIM_AGE revolutions -- one more than plain second-chance CLOCK.
+ */
+
+#define CLOCK_VICTIM_AGE        2
+
+ULONG clock_on_fault(PTE previous) {
+    return 0;
+}
+
+BOOL clock_decide(PPTE pte) {
+
+    if (IS_PTE_ACCESSED(pte)) {
+        pte->memory_format.accessed = !PTE_ACCESSED;
+        pte->memory_format.age = 0;
+        return FALSE;
+    }
+
+    // A page that has not been passed by the hand yet still carries the age it was faulted in with.
+    if (pte->memory_format.age >= PTE_AGE_YOUNGEST) pte->memory_format.age = 0;
+
+    if (pte->memory_format.age + 1 < CLOCK_VICTIM_AGE) {
+        pte->memory_format.age++;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+ULONG64 clock_select_pages(PPOLICY_HAND hand, PPTE *victims, ULONG64 capacity) {
+    return clock_select_victims(hand, clock_decide, victims, capacity);
+}
+
+REPLACEMENT_POLICY clock_policy = {
+    .name = "clock",
+    .uses_ager = FALSE,
+    .class_names = {"all"},
+    .initialize = NULL,
+    .on_access = set_accessed_bit,
+    .on_fault = clock_on_fault,
+    .select_victims = clock_select_pages,
+};
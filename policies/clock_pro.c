@@ -0,0 +1,85 @@
+#include "policy.h"
+
+/*
+ *  CLOCK-Pro, approximated with a single hand. Cold pages are trimmed when the hand finds them idle.
+ *  A new cold page starts a test period; if it is accessed during the test it becomes hot, and if it
+ *  is trimmed during the test but faults back in while still a ghost, it comes back hot. Hot pages are
+ *  demoted to cold when there are more of them than their share. The cold share adapts: it grows on
+ *  each ghost hit, and shrinks as pages are trimmed during their test. We cannot see a ghost's test
+ *  period expire, so we charge each test a fraction of a page up front instead.
+ */
+
+#define CLOCK_PRO_COLD          0
+#define CLOCK_PRO_COLD_IN_TEST  1
+#define CLOCK_PRO_HOT           2
+
+#define CLOCK_PRO_INITIAL_COLD_FRACTION     0.125
+#define CLOCK_PRO_MINIMUM_COLD_PAGES        64
+#define CLOCK_PRO_TESTS_PER_SHRINK          2
+
+volatile LONG64 clock_pro_cold_target;
+
+VOID clock_pro_initialize(VOID) {
+    clock_pro_cold_target = (LONG64) (CLOCK_PRO_INITIAL_COLD_FRACTION * vm.allocated_frame_count);
+}
+
+VOID adjust_clock_pro_cold_target(LONG64 change) {
+    LONG64 target = clock_pro_cold_target + change;
+    target = max(CLOCK_PRO_MINIMUM_COLD_PAGES, min(target, (LONG64) vm.allocated_frame_count));
+    WriteNoFence64(&clock_pro_cold_target, target);
+}
+
+ULONG clock_pro_on_fault(PTE previous) {
+    if (is_recently_evicted(previous, vm.allocated_frame_count) &&
+        previous.transition_format.evicted_class == CLOCK_PRO_COLD_IN_TEST) {
+        adjust_clock_pro_cold_target(1);
+        return CLOCK_PRO_HOT;
+    }
+    return CLOCK_PRO_COLD_IN_TEST;
+}
+
+BOOL clock_pro_decide(PPTE pte) {
+
+    ULONG policy_class = pte->memory_format.policy_class;
+    BOOL accessed = IS_PTE_ACCESSED(pte);
+    pte->memory_format.accessed = !PTE_ACCESSED;
+
+    if (policy_class == CLOCK_PRO_HOT) {
+        LONG64 hot_target = (LONG64) vm.allocated_frame_count - clock_pro_cold_target;
+        if (!accessed && resident_class_counts[CLOCK_PRO_HOT] > hot_target) {
+            pte->memory_format.policy_class = CLOCK_PRO_COLD;
+        }
+        return FALSE;
+    }
+
+    if (accessed) {
+        pte->memory_format.policy_class = (policy_class == CLOCK_PRO_COLD_IN_TEST) ? CLOCK_PRO_HOT : CLOCK_PRO_COLD_IN_TEST;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+ULONG64 clock_pro_select_victims(PPOLICY_HAND hand, PPTE *victims, ULONG64 capacity) {
+
+    ULONG64 victim_count = clock_select_victims(hand, clock_pro_decide, victims, capacity);
+
+    // Charge every test that is about to be trimmed. A ghost hit later pays it back (and more).
+    LONG64 tests = 0;
+    for (ULONG64 i = 0; i < victim_count; i++) {
+        if (victims[i]->memory_format.policy_class == CLOCK_PRO_COLD_IN_TEST) tests++;
+    }
+    if (tests >= CLOCK_PRO_TESTS_PER_SHRINK) adjust_clock_pro_cold_target(-tests / CLOCK_PRO_TESTS_PER_SHRINK);
+
+    return victim_count;
+}
+
+REPLACEMENT_POLICY clock_pro_policy = {
+    .name = "clock-pro",
+    .uses_ager = FALSE,
+    .class_names = {"cold", "cold (test)", "hot"},
+    .initialize = clock_pro_initialize,
+    .on_access = set_accessed_bit,
+    .on_fault = clock_pro_on_fault,
+    .select_victims = clock_pro_select_victims,
+};
@@ -0,0 +1,243 @@
+#include "policy.h"
+#include "../threads/ager.h"
+#include <string.h>
+
+PREPLACEMENT_POLICY replacement_policy = &sweep_policy;
+
+volatile LONG64 resident_class_counts[POLICY_CLASSES];
+volatile LONG64 ghost_class_counts[POLICY_CLASSES];
+
+// Faults on pages trimmed from each class: soft (still in memory) and hard (read back from the disk).
+// Faults on pages never trimmed are zero-fills, and belong to no class. These are updated on every fault.
+SHARDED_COUNTER class_soft_faults[POLICY_CLASSES];
+SHARDED_COUNTER class_hard_faults[POLICY_CLASSES];
+SHARDED_COUNTER class_ghost_hits[POLICY_CLASSES];
+SHARDED_COUNTER zero_fill_faults;
+
+// The eviction clock counts every page ever trimmed. PTEs only have room for a few of its bits, so we keep
+// the bits above eviction_stamp_shift -- chosen so a stamp wraps long after any ghost window has passed.
+volatile LONG64 eviction_clock;
+ULONG eviction_stamp_shift;
+
+PREPLACEMENT_POLICY all_policies[] = {
+    &sweep_policy,
+    &clock_policy,
+    &clock_pro_policy,
+    &two_queue_policy,
+    &arc_policy,
+};
+
+BOOL select_replacement_policy(const char *name) {
+    for (ULONG i = 0; i < ARRAYSIZE(all_policies); i++) {
+        if (_stricmp(name, all_policies[i]->name) == 0) {
+            replacement_policy = all_policies[i];
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+VOID print_replacement_policies(VOID) {
+    printf("Replacement policies:");
+    for (ULONG i = 0; i < ARRAYSIZE(all_policies); i++) {
+        printf(" %s", all_policies[i]->name);
+    }
+    printf("\n");
+}
+
+VOID initialize_replacement_policy(VOID) {
+
+    // Stamps must cover at least four times physical memory before they wrap, since our
+    // largest ghost window is the size of physical memory.
+    eviction_stamp_shift = 0;
+    while (((1ULL << PTE_EVICTION_STAMP_BITS) << eviction_stamp_shift) < 4 * vm.allocated_frame_count) {
+        eviction_stamp_shift++;
+    }
+
+    if (replacement_policy->initialize) replacement_policy->initialize();
+}
+
+ULONG64 get_current_eviction_stamp(VOID) {
+    return ((ULONG64) ReadNoFence64(&eviction_clock) >> eviction_stamp_shift) & ((1ULL << PTE_EVICTION_STAMP_BITS) - 1);
+}
+
+BOOL is_recently_evicted(PTE previous, ULONG64 window) {
+
+    // A zeroed PTE has never been trimmed.
+    if (IS_PTE_ZEROED(&previous) || IS_PTE_VALID(&previous)) return FALSE;
+
+    ULONG64 stamp_mask = (1ULL << PTE_EVICTION_STAMP_BITS) - 1;
+    ULONG64 age_in_stamps = (get_current_eviction_stamp() - previous.transition_format.eviction_stamp) & stamp_mask;
+    return (age_in_stamps << eviction_stamp_shift) < window;
+}
+
+VOID record_evictions(LONG64 evicted[POLICY_CLASSES]) {
+
+    LONG64 total = 0;
+    for (ULONG i = 0; i < POLICY_CLASSES; i++) {
+        if (evicted[i] == 0) continue;
+        InterlockedAdd64(&resident_class_counts[i], -evicted[i]);
+        InterlockedAdd64(&ghost_class_counts[i], evicted[i]);
+        total += evicted[i];
+    }
+    InterlockedAdd64(&eviction_clock, total);
+
+    // We cannot see ghosts expire, so we age them out by keeping the total within physical memory.
+    LONG64 ghosts = 0;
+    for (ULONG i = 0; i < POLICY_CLASSES; i++) ghosts += ghost_class_counts[i];
+    LONG64 excess = ghosts - (LONG64) vm.allocated_frame_count;
+    if (excess > 0) {
+        for (ULONG i = 0; i < POLICY_CLASSES; i++) {
+            LONG64 share = ghost_class_counts[i] * excess / ghosts;
+            InterlockedAdd64(&ghost_class_counts[i], -share);
+        }
+    }
+}
+
+ULONG policy_on_fault(PTE previous) {
+
+    // Transition and disk PTEs keep the evicted class in the same bits.
+    ULONG evicted_class = previous.transition_format.evicted_class;
+    if (IS_PTE_ZEROED(&previous)) add_to_counter(&zero_fill_faults, 1);
+    else if (IS_PTE_ON_DISK(&previous)) add_to_counter(&class_hard_faults[evicted_class], 1);
+    else add_to_counter(&class_soft_faults[evicted_class], 1);
+
+    // For our statistics, a ghost hit is any fault on a page trimmed within the size of physical memory.
+    if (is_recently_evicted(previous, vm.allocated_frame_count)) {
+        InterlockedIncrement64(&stats.n_ghost_hits);
+        add_to_counter(&class_ghost_hits[evicted_class], 1);
+        if (ghost_class_counts[evicted_class] > 0) {
+            InterlockedDecrement64(&ghost_class_counts[evicted_class]);
+        }
+    }
+
+    ULONG policy_class = replacement_policy->on_fault(previous);
+    ASSERT(policy_class < POLICY_CLASSES);
+    InterlockedIncrement64(&resident_class_counts[policy_class]);
+    return policy_class;
+}
+
+VOID print_policy_classes(VOID) {
+    printf("\nPOLICY CLASSES (%s):\n", replacement_policy->name);
+    printf("\t%-12s\t%12s\t%12s\t%12s\t%12s\t%12s\n",
+           "class", "resident", "ghosts", "soft faults", "hard faults", "ghost hits");
+    for (ULONG i = 0; i < POLICY_CLASSES; i++) {
+        if (replacement_policy->class_names[i] == NULL) continue;
+        printf("\t%-12s\t%12lld\t%12lld\t%12lld\t%12lld\t%12lld\n", replacement_policy->class_names[i],
+               resident_class_counts[i], ghost_class_counts[i], read_counter_exact(&class_soft_faults[i]),
+               read_counter_exact(&class_hard_faults[i]), read_counter_exact(&class_ghost_hits[i]));
+    }
+    printf("\t%-12s\t%12s\t%12s\t%12s\t%12lld\n", "zero-filled", "", "", "",
+           read_counter_exact(&zero_fill_faults));
+    printf("GHOST HITS:\t%llu\n", stats.n_ghost_hits);
+}
+
+VOID begin_policy_pass(PPOLICY_HAND hand) {
+    hand->cache_lines_scanned = 0;
+    hand->bitmap_words_scanned = 0;
+}
+
+ULONG64 advance_policy_hand(PPOLICY_HAND hand, ULONG64 age_bits, PULONG64 trimmable) {
+
+    // Our budget is in cache lines touched, not PTEs visited, so a batch costs the same
+    // no matter how sparse the address space is.
+    while (hand->cache_lines_scanned + hand->bitmap_words_scanned / WORDS_PER_CACHE_LINE < MAX_TRIM_CACHE_LINES) {
+
+        ULONG64 block = find_next_active_PTE_block_in_range(hand->block, hand->first_block, hand->end_block,
+                                                            &hand->bitmap_words_scanned);
+        if (block == NO_ACTIVE_PTE_BLOCK) return 0;
+        hand->block = block;
+
+        PPTE first_pte = PTE_base + block * PTES_PER_PTE_BLOCK;
+
+#if LARGE_PAGES
+        PPDE pde = get_PDE_from_PTE(first_pte);
+
+        // A large page is aged as a whole. If it has not been accessed since it was last checked,
+        // we split it into regular PTEs, which the policy then sees like any others.
+        if (IS_PDE_LARGE(pde)) {
+            PDE pde_snapshot;
+            pde_snapshot.entire_pde = ReadULong64NoFence(&pde->entire_pde);
+            BOOL skip_large_page = FALSE;
+#if AGING
+            skip_large_page = IS_PDE_ACCESSED(&pde_snapshot);
+
+            // Policies without the ager give the large page its second chance themselves.
+            if (skip_large_page && !replacement_policy->uses_ager) {
+                PDE cleared = pde_snapshot;
+                cleared.large_format.accessed = !PTE_ACCESSED;
+                compare_and_swap_pde(pde, pde_snapshot, cleared);
+            }
+#endif
+            if (skip_large_page || !try_split_large_page(pde)) {
+                hand->block = (PAGE_TABLE_INDEX(first_pte) + 1) * PTE_BLOCKS_PER_PAGE_TABLE;
+                continue;
+            }
+        }
+#endif
+        // Test the whole block at once.
+        ULONG64 valid = get_PTE_block_masks(block, age_bits, trimmable);
+        hand->cache_lines_scanned += CACHE_LINES_PER_PTE_BLOCK;
+        if (valid != 0) return valid;
+
+        // Nothing valid is left here. Take the block out of the bitmap.
+        try_clear_PTE_block_active(block);
+        hand->block++;
+    }
+    return 0;
+}
+
+// Applies the decision to a copy of the PTE and swaps it in, retrying if the PTE changes underneath us.
+// Returns TRUE if the page should be trimmed.
+BOOL apply_pte_decision(PPTE pte, PTE_DECISION decide) {
+
+    PTE snapshot;
+    PTE decided;
+    BOOL victim;
+
+    do {
+        snapshot.entire_pte = ReadULong64NoFence((ULONG64 *) pte);
+        if (!IS_PTE_VALID(&snapshot)) return FALSE;
+
+        decided = snapshot;
+        victim = decide(&decided);
+
+        if (decided.entire_pte == snapshot.entire_pte) return victim;
+
+    } while (!compare_and_swap_pte(pte, snapshot, decided));
+
+    // Keep the class counts in step with the pages that moved.
+    if (decided.memory_format.policy_class != snapshot.memory_format.policy_class) {
+        InterlockedDecrement64(&resident_class_counts[snapshot.memory_format.policy_class]);
+        InterlockedIncrement64(&resident_class_counts[decided.memory_format.policy_class]);
+    }
+    return victim;
+}
+
+ULONG64 clock_select_victims(PPOLICY_HAND hand, PTE_DECISION decide, PPTE *victims, ULONG64 capacity) {
+
+    ULONG64 victim_count = 0;
+    begin_policy_pass(hand);
+
+    while (victim_count < capacity) {
+
+        ULONG64 trimmable;
+        ULONG64 valid = advance_policy_hand(hand, 0, &trimmable);
+        if (valid == 0) break;
+
+        PPTE first_pte = PTE_base + hand->block * PTES_PER_PTE_BLOCK;
+        ULONG index;
+        while (victim_count < capacity && _BitScanForward64(&index, valid)) {
+            valid &= valid - 1;
+            if (apply_pte_decision(first_pte + index, decide)) {
+                victims[victim_count] = first_pte + index;
+                victim_count++;
+            }
+        }
+
+        // Even if we filled our batch partway through this block, the next batch starts at the
+        // following one. Deciding twice on the same PTE would age it twice.
+        hand->block++;
+    }
+    return victim_count;
+}
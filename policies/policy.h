@@ -0,0 +1,137 @@
+#pragma once
+
+#include "../data_structures/pte.h"
+#include "../threads/threads.h"
+
+struct __policy_hand;
+
+/*
+ *  A replacement policy decides which valid pages the trimmer takes. The trimmer itself still does the
+ *  trimming (locks, transition PTEs, the modified list); the policy only chooses victims and keeps
+ *  whatever per-page state it needs in the PTE's accessed bit, age and policy class.
+ *
+ *  Policies are chosen at startup by name (see select_replacement_policy). The default is the sweep.
+ */
+
+// The number of classes a policy may sort its pages into.
+#define POLICY_CLASSES              (1 << PTE_POLICY_CLASS_BITS)
+
+// Victim selection reads at most this many cache lines of PTEs and bitmap per batch.
+#define MAX_TRIM_CACHE_LINES        (get_tunable(TUNE_TRIM_BATCH_SIZE) * 4 * sizeof(PTE) / CACHE_LINE_SIZE)
+#define WORDS_PER_CACHE_LINE        (CACHE_LINE_SIZE / sizeof(ULONG64))
+
+typedef struct __replacement_policy {
+    const char *name;
+
+    // TRUE if the policy relies on the ager thread's sweeps (and their accessed-bit clears).
+    BOOL uses_ager;
+
+    // The name of each class the policy uses, for our statistics. Unused classes are NULL.
+    const char *class_names[POLICY_CLASSES];
+
+    // Called once, after physical pages have been allocated.
+    VOID (*initialize)(VOID);
+
+    // Called by a user thread when it accesses a page it has not marked in the current epoch.
+    // Our policies all keep their access state in the accessed bit, so they use set_accessed_bit.
+    VOID (*on_access)(PULONG_PTR va);
+
+    // Called with the PTE as it was before a fault, while the faulting thread holds its lock.
+    // Returns the policy class the page will be mapped in.
+    ULONG (*on_fault)(PTE previous);
+
+    // Fills victims with up to capacity valid PTEs to trim, from the hand's range of PTEs. The PTEs are
+    // not locked, so the trimmer must check each one again once it has the lock.
+    ULONG64 (*select_victims)(struct __policy_hand *hand, PPTE *victims, ULONG64 capacity);
+} REPLACEMENT_POLICY, *PREPLACEMENT_POLICY;
+
+// The policies we have
+extern REPLACEMENT_POLICY sweep_policy;
+extern REPLACEMENT_POLICY clock_policy;
+extern REPLACEMENT_POLICY clock_pro_policy;
+extern REPLACEMENT_POLICY two_queue_policy;
+extern REPLACEMENT_POLICY arc_policy;
+
+// The policy in use
+extern PREPLACEMENT_POLICY replacement_policy;
+
+// The number of resident pages in each class, and an estimate of the number of recently trimmed
+// ("ghost") pages from each class. Both are approximate. A large page counts all its pages in class 0.
+extern volatile LONG64 resident_class_counts[POLICY_CLASSES];
+extern volatile LONG64 ghost_class_counts[POLICY_CLASSES];
+
+/*
+ *  Chooses the policy with the given name. Returns FALSE if there is no such policy.
+ */
+BOOL select_replacement_policy(const char *name);
+
+/*
+ *  Prints the names of every policy.
+ */
+VOID print_replacement_policies(VOID);
+
+/*
+ *  Sets up the eviction clock and calls the chosen policy's initializer.
+ */
+VOID initialize_replacement_policy(VOID);
+
+/*
+ *  Called by the fault handler, with the PTE locked, before the PTE becomes valid.
+ *  Detects ghost hits, counts the fault by the class the page was trimmed from, calls the policy,
+ *  and returns the policy class for the page.
+ */
+ULONG policy_on_fault(PTE previous);
+
+/*
+ *  Prints, for each of the policy's classes, its resident pages and ghosts, and the soft faults,
+ *  hard faults and ghost hits on pages trimmed from it.
+ */
+VOID print_policy_classes(VOID);
+
+/*
+ *  Returns the eviction stamp the trimmer should put in the PTEs of the batch it is about to trim.
+ */
+ULONG64 get_current_eviction_stamp(VOID);
+
+/*
+ *  Called by the trimmer after each batch, with the number of pages it trimmed from each class.
+ */
+VOID record_evictions(LONG64 evicted[POLICY_CLASSES]);
+
+/*
+ *  Returns TRUE if the page described by this invalid PTE was trimmed within the last window evictions.
+ */
+BOOL is_recently_evicted(PTE previous, ULONG64 window);
+
+// A clock hand over the active PTE blocks in [first_block, end_block). Each trimmer partition has its own.
+typedef struct __policy_hand {
+    ULONG64 first_block;
+    ULONG64 end_block;
+    ULONG64 block;
+    ULONG64 cache_lines_scanned;
+    ULONG64 bitmap_words_scanned;
+} POLICY_HAND, *PPOLICY_HAND;
+
+/*
+ *  Resets the hand's budget for a new batch.
+ */
+VOID begin_policy_pass(PPOLICY_HAND hand);
+
+/*
+ *  Moves the hand to the next block holding valid PTEs, retiring empty blocks and handling large pages
+ *  on the way. Returns the block's valid mask (and sets trimmable, as get_PTE_block_masks does),
+ *  or zero once the budget is spent or nothing is active.
+ */
+ULONG64 advance_policy_hand(PPOLICY_HAND hand, ULONG64 age_bits, PULONG64 trimmable);
+
+/*
+ *  A policy's decision for one valid PTE. It may change the copy's accessed bit, age and class.
+ *  Returns TRUE if the page should be trimmed.
+ */
+typedef BOOL (*PTE_DECISION)(PPTE pte);
+
+/*
+ *  Sweeps valid PTEs with the hand, applying the decision to each one atomically.
+ *  Returns the number of victims found.
+ */
+ULONG64 clock_select_victims(PPOLICY_HAND hand, PTE_DECISION decide, PPTE *victims, ULONG64 capacity);
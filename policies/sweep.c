@@ -0,0 +1,58 @@
+#include "policy.h"
+#include "../threads/ager.h"
+
+/*
+ *  The sweep: walk the active PTE blocks in order, taking every page that is unlocked, unaccessed and
+ *  at least as old as the ager's histogram says we need. This is what the trimmer always did.
+ */
+
+ULONG sweep_on_fault(PTE previous) {
+    return 0;
+}
+
+ULONG64 sweep_select_victims(PPOLICY_HAND hand, PPTE *victims, ULONG64 capacity) {
+
+    // Only trim pages at least this old, so the oldest pages go first. Without aging, any page will do.
+    // Our hand only sees one partition, so we ask for enough old pages to fill a batch in each of them.
+    ULONG64 age_bits = 0;
+#if AGING
+    age_bits = get_trimmable_age_bits(capacity * NUM_TRIMMER_THREADS);
+#endif
+
+    ULONG64 victim_count = 0;
+    begin_policy_pass(hand);
+
+    while (victim_count < capacity) {
+
+        ULONG64 trimmable;
+        if (advance_policy_hand(hand, age_bits, &trimmable) == 0) break;
+
+        PPTE first_pte = PTE_base + hand->block * PTES_PER_PTE_BLOCK;
+        ULONG index;
+        while (victim_count < capacity && _BitScanForward64(&index, trimmable)) {
+            trimmable &= trimmable - 1;
+            victims[victim_count] = first_pte + index;
+            victim_count++;
+        }
+
+        // If we filled our batch partway through this block, the next batch starts here again.
+        if (trimmable == 0) hand->block++;
+    }
+
+#if AGING
+    // If we came up short, our idea of which pages are old may be stale. Ask for a fresh sweep.
+    if (victim_count < capacity) SetEvent(initiate_aging_event);
+#endif
+
+    return victim_count;
+}
+
+REPLACEMENT_POLICY sweep_policy = {
+    .name = "sweep",
+    .uses_ager = TRUE,
+    .class_names = {"all"},
+    .initialize = NULL,
+    .on_access = set_accessed_bit,
+    .on_fault = sweep_on_fault,
+    .select_victims = sweep_select_victims,
+};
@@ -0,0 +1,67 @@
+#include "policy.h"
+
+/*
+ *  2Q, approximated with a clock hand. New pages go on A1in, which is trimmed in (roughly) FIFO order
+ *  whenever it holds more than its share of memory, whether or not its pages have been accessed.
+ *  A page that faults back in while it is still remembered on A1out (a ghost) has proven itself,
+ *  so it goes on Am, which is managed with second-chance CLOCK.
+ */
+
+#define TWO_QUEUE_A1IN          0
+#define TWO_QUEUE_AM            1
+
+// Kin and Kout, as fractions of physical memory (the values suggested by the 2Q paper).
+#define TWO_QUEUE_A1IN_FRACTION     0.25
+#define TWO_QUEUE_A1OUT_FRACTION    0.5
+
+LONG64 two_queue_a1in_target;
+ULONG64 two_queue_a1out_window;
+
+VOID two_queue_initialize(VOID) {
+    two_queue_a1in_target = (LONG64) (TWO_QUEUE_A1IN_FRACTION * vm.allocated_frame_count);
+    two_queue_a1out_window = (ULONG64) (TWO_QUEUE_A1OUT_FRACTION * vm.allocated_frame_count);
+}
+
+ULONG two_queue_on_fault(PTE previous) {
+    if (is_recently_evicted(previous, two_queue_a1out_window) &&
+        previous.transition_format.evicted_class == TWO_QUEUE_A1IN) {
+        return TWO_QUEUE_AM;
+    }
+
+    // Pages trimmed from Am come back through A1in, like new ones.
+    return TWO_QUEUE_A1IN;
+}
+
+BOOL two_queue_decide(PPTE pte) {
+
+    BOOL a1in_too_large = resident_class_counts[TWO_QUEUE_A1IN] > two_queue_a1in_target;
+
+    if (pte->memory_format.policy_class == TWO_QUEUE_A1IN) {
+        if (a1in_too_large) return TRUE;
+        pte->memory_format.accessed = !PTE_ACCESSED;
+        return FALSE;
+    }
+
+    // While A1in is over its share, Am is left alone.
+    if (a1in_too_large) return FALSE;
+
+    if (IS_PTE_ACCESSED(pte)) {
+        pte->memory_format.accessed = !PTE_ACCESSED;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+ULONG64 two_queue_select_victims(PPOLICY_HAND hand, PPTE *victims, ULONG64 capacity) {
+    return clock_select_victims(hand, two_queue_decide, victims, capacity);
+}
+
+REPLACEMENT_POLICY two_queue_policy = {
+    .name = "2q",
+    .uses_ager = FALSE,
+    .class_names = {"A1in", "Am"},
+    .initialize = two_queue_initialize,
+    .on_access = set_accessed_bit,
+    .on_fault = two_queue_on_fault,
+    .select_victims = two_queue_select_victims,
+};
@@ -3,9 +3,157 @@
 //
 
 #include "ager.h"
+#include "../utils/trace.h"
+#include "working_set.h"
 
+volatile LONG64 age_histogram[PTE_AGE_CLASSES];
+
+// The age class of a history is the number of sweeps since its most recent access, capped at PTE_AGE_BITS.
+ULONG get_age_class(ULONG64 history) {
+    ULONG highest_bit;
+    if (!_BitScanReverse64(&highest_bit, history)) return PTE_AGE_BITS;
+    return PTE_AGE_BITS - 1 - highest_bit;
+}
+
+// Shifts the accessed bit into the PTE's history and clears it. Returns the PTE's new age class,
+// or PTE_AGE_CLASSES if the PTE is no longer valid.
+ULONG age_pte(PPTE pte) {
+
+    PTE snapshot;
+    PTE aged;
+
+    // The trimmer and faulting threads change these PTEs with compare-exchanges too, so we rebuild
+    // from a snapshot and retry, exactly as the other transitions do.
+    do {
+        snapshot.entire_pte = ReadULong64NoFence((ULONG64 *) pte);
+        if (!IS_PTE_VALID(&snapshot)) return PTE_AGE_CLASSES;
+
+        aged = snapshot;
+        aged.memory_format.age = (snapshot.memory_format.age >> 1) |
+                                 (snapshot.memory_format.accessed ? PTE_AGE_YOUNGEST : 0);
+        aged.memory_format.accessed = !PTE_ACCESSED;
+
+        // A page that has been idle for every sweep we remember has nothing left to change.
+        if (aged.entire_pte == snapshot.entire_pte) break;
+
+    } while (!compare_and_swap_pte(pte, snapshot, aged));
+
+    return get_age_class(aged.memory_format.age);
+}
 
-// For now, no aging takes place. All active PTEs can be trimmed.
 VOID age_active_ptes(VOID) {
-    return;
-}
\ No newline at end of file
+
+    LONG64 histogram[PTE_AGE_CLASSES] = {0};
+    ULONG64 bitmap_words_scanned = 0;
+
+    // Begin our pass before we clear any accessed bits, so user threads mark every access until it ends.
+    begin_accessed_bit_pass();
+#if WSS_SAMPLING
+    begin_working_set_sweep();
+#endif
+
+    // Sweep every active block once, in order.
+    ULONG64 block = 0;
+    while (block < num_pte_blocks) {
+
+        ULONG64 next = find_next_active_PTE_block(block, &bitmap_words_scanned);
+        if (next == NO_ACTIVE_PTE_BLOCK || next < block) break;
+        block = next;
+
+        PPTE first_pte = PTE_base + block * PTES_PER_PTE_BLOCK;
+        PPDE pde = get_PDE_from_PTE(first_pte);
+
+#if LARGE_PAGES
+        // A large page only has the one accessed bit. We clear it, and the trimmer splits the
+        // large page if it is still clear on its next visit.
+        if (IS_PDE_LARGE(pde)) {
+            PDE pde_snapshot;
+            pde_snapshot.entire_pde = ReadULong64NoFence(&pde->entire_pde);
+            if (IS_PDE_LARGE(&pde_snapshot) && IS_PDE_ACCESSED(&pde_snapshot)) {
+                PDE cleared = pde_snapshot;
+                cleared.large_format.accessed = !PTE_ACCESSED;
+                compare_and_swap_pde(pde, pde_snapshot, cleared);
+            }
+            block = (PAGE_TABLE_INDEX(first_pte) + 1) * PTE_BLOCKS_PER_PAGE_TABLE;
+            continue;
+        }
+#endif
+        // Only the valid PTEs have anything to age.
+        ULONG64 trimmable;
+        ULONG64 valid = get_PTE_block_masks(block, 0, &trimmable);
+
+        ULONG index;
+        while (_BitScanForward64(&index, valid)) {
+            valid &= valid - 1;
+
+            ULONG age_class = age_pte(first_pte + index);
+            if (age_class < PTE_AGE_CLASSES) {
+                histogram[age_class]++;
+#if WSS_SAMPLING
+                record_working_set_page(block * PTES_PER_PTE_BLOCK + index, age_class);
+#endif
+            }
+        }
+
+        block++;
+    }
+
+    // With every bit cleared, a new epoch begins.
+    end_accessed_bit_pass();
+
+#if WSS_SAMPLING
+    end_working_set_sweep(histogram);
+#endif
+
+    // Publish the new histogram for the trimmer.
+    for (ULONG i = 0; i < PTE_AGE_CLASSES; i++) {
+        WriteNoFence64(&age_histogram[i], histogram[i]);
+    }
+}
+
+ULONG64 get_trimmable_age_bits(ULONG64 pages_wanted) {
+
+    // Walk down from the oldest class until we have covered enough pages. Trimming only pages
+    // at least that old means the oldest pages go first, wherever the trimmer happens to be.
+    ULONG64 pages = 0;
+    ULONG age_class = PTE_AGE_BITS;
+    while (age_class > 0) {
+        pages += (ULONG64) ReadNoFence64(&age_histogram[age_class]);
+        if (pages >= pages_wanted) break;
+        age_class--;
+    }
+
+    // A page is in this class or older if and only if the top age_class bits of its history are clear.
+    return ((1ULL << age_class) - 1) << (PTE_AGE_BITS - age_class);
+}
+
+VOID age_pages_thread(VOID) {
+
+    // We wait to age or to exit.
+    HANDLE events[2];
+    events[ACTIVE_EVENT_INDEX] = initiate_aging_event;
+    events[EXIT_EVENT_INDEX] = system_exit_event;
+
+    // Wait for system start event before entering waiting state!
+    WaitForSingleObject(system_start_event, INFINITE);
+    TRACE_THREAD_NAME("ager", 0);
+
+    while (TRUE) {
+
+        TRACE_BEGIN(TRACE_WAIT, TRACE_WAIT_WORK);
+        if (WaitForMultipleObjects(ARRAYSIZE(events), events, FALSE, INFINITE)
+            == EXIT_EVENT_INDEX) return;
+        TRACE_END(TRACE_WAIT, TRACE_WAIT_WORK);
+
+        LONGLONG start = get_timestamp();
+
+        TRACE_BEGIN(TRACE_AGE_SWEEP, 0);
+        age_active_ptes();
+        TRACE_END(TRACE_AGE_SWEEP, 0);
+
+        // Record the runtime and update the future runtime estimate
+        LONGLONG end = get_timestamp();
+        update_estimated_job_time(AGING_THREAD_ID, get_time_difference(end, start));
+        InterlockedAdd64(&stats.age_time, end - start);
+    }
+}
@@ -5,8 +5,28 @@
 #pragma once
 #include "initializer.h"
 
+// Age classes run from 0 (accessed during the most recent sweep) to PTE_AGE_BITS (idle for every sweep we remember).
+#define PTE_AGE_CLASSES         (PTE_AGE_BITS + 1)
 
 /*
- *  Ages all active PTEs, which can then be trimmed by the trimmer.
+ *  The number of valid pages in each age class, as of the end of the most recent sweep.
+ */
+extern volatile LONG64 age_histogram[PTE_AGE_CLASSES];
+
+/*
+ *  Ages all active PTEs, which can then be trimmed by the trimmer. Each valid PTE has its accessed bit
+ *  shifted into its history, and then cleared.
  */
 VOID age_active_ptes(VOID);
+
+/*
+ *  Returns the history bits that must be clear for a page to be trimmed, so that (according to the
+ *  last sweep) at least pages_wanted pages qualify, and they are the oldest ones we have.
+ */
+ULONG64 get_trimmable_age_bits(ULONG64 pages_wanted);
+
+/*
+ *  This is the function called by CreateThread. It waits for the system start event, then sweeps
+ *  once each time the aging event is set, until the system exit event.
+ */
+VOID age_pages_thread(VOID);
@@ -0,0 +1,54 @@
+#include "fault_latency.h"
+
+#if TIME_FAULTS
+#define NUMBER_OF_REPORTED_PERCENTILES      5
+static const double reported_percentiles[NUMBER_OF_REPORTED_PERCENTILES] = { 0.5, 0.9, 0.99, 0.999, 1.0 };
+
+VOID merge_fault_latencies(PLATENCY_HISTOGRAM merged, ULONG outcome) {
+    for (ULONG i = 0; i < vm.num_user_threads; i++) {
+        merge_histogram(merged, &user_thread_info[i].fault_latencies[outcome]);
+    }
+}
+
+VOID print_fault_latencies(VOID) {
+    LATENCY_HISTOGRAM merged;
+
+    printf("\nFault latency (us)\t\tcount\t\tp50\tp90\tp99\tp999\tmax\n");
+    for (ULONG outcome = 0; outcome < FAULT_OUTCOMES; outcome++) {
+        memset(&merged, 0, sizeof(merged));
+        merge_fault_latencies(&merged, outcome);
+
+        ULONG64 count = get_histogram_count(&merged);
+        if (count == 0) continue;
+
+        printf("%-28s\t%llu", fault_outcome_names[outcome], count);
+        for (ULONG i = 0; i < NUMBER_OF_REPORTED_PERCENTILES; i++) {
+            printf("\t%.1f", cycles_to_microseconds(get_histogram_percentile(&merged, reported_percentiles[i])));
+        }
+        printf("\n");
+    }
+}
+
+VOID write_fault_latency_csv(const char *file_name) {
+    FILE *file = fopen(file_name, "w");
+    if (file == NULL) {
+        printf("Could not write fault latencies to %s.\n", file_name);
+        return;
+    }
+
+    LATENCY_HISTOGRAM merged;
+    fprintf(file, "outcome,count,p50_us,p90_us,p99_us,p999_us,max_us\n");
+    for (ULONG outcome = 0; outcome < FAULT_OUTCOMES; outcome++) {
+        memset(&merged, 0, sizeof(merged));
+        merge_fault_latencies(&merged, outcome);
+
+        fprintf(file, "%s,%llu", fault_outcome_names[outcome], get_histogram_count(&merged));
+        for (ULONG i = 0; i < NUMBER_OF_REPORTED_PERCENTILES; i++) {
+            fprintf(file, ",%.3f", cycles_to_microseconds(get_histogram_percentile(&merged, reported_percentiles[i])));
+        }
+        fprintf(file, "\n");
+    }
+
+    fclose(file);
+}
+#endif
@@ -0,0 +1,26 @@
+#pragma once
+#include "../data_structures/histogram.h"
+#include "threads.h"
+
+/*
+ *  Each user thread times every fault into a histogram for its outcome (see FAULT_SOFT_MODIFIED and
+ *  the rest in threads.h). At the end of the run we merge them across threads and print percentiles
+ *  for each outcome -- and, with FAULT_LATENCY_CSV on, write them to a file too.
+ */
+
+#if TIME_FAULTS
+/*
+ *  Adds every user thread's histogram for this outcome into merged.
+ */
+VOID merge_fault_latencies(PLATENCY_HISTOGRAM merged, ULONG outcome);
+
+/*
+ *  Prints count, p50, p90, p99, p999 and max for each outcome.
+ */
+VOID print_fault_latencies(VOID);
+
+/*
+ *  Writes the same percentiles as comma-separated values, one outcome per row.
+ */
+VOID write_fault_latency_csv(const char *file_name);
+#endif
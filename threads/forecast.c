@@ -0,0 +1,56 @@
+#include "forecast.h"
+#include "watermarks.h"
+
+HOLT_FORECAST demand_forecasts[DEMAND_LISTS];
+
+// Until the scheduler predicts a shortfall, these leave our tuned batch sizes as they are.
+static volatile LONG64 write_batch_target = MAX_WRITE_BATCH_SIZE;
+static volatile LONG64 trim_batch_target = MAX_TRIM_BATCH_SIZE;
+
+VOID update_forecast(PHOLT_FORECAST forecast, double observed_rate) {
+    double previous_level = forecast->level;
+
+    forecast->level = FORECAST_LEVEL_SMOOTHING * observed_rate +
+                      (1 - FORECAST_LEVEL_SMOOTHING) * (previous_level + forecast->trend);
+    forecast->trend = FORECAST_TREND_SMOOTHING * (forecast->level - previous_level) +
+                      (1 - FORECAST_TREND_SMOOTHING) * forecast->trend;
+}
+
+double forecast_pages(PHOLT_FORECAST forecast, double horizon_in_seconds, double tick_in_seconds) {
+
+    // Summing level + k * trend over the k = 1..n ticks in our horizon gives us the average rate
+    // level + trend * (n + 1) / 2. We never forecast pages coming back.
+    double ticks = horizon_in_seconds / tick_in_seconds;
+    double rate = forecast->level + forecast->trend * (ticks + 1) / 2;
+    return rate > 0 ? rate * horizon_in_seconds : 0;
+}
+
+ULONG64 get_write_batch_target(VOID) {
+    ULONG64 batch_size = get_tunable(TUNE_WRITE_BATCH_SIZE);
+    if (ReadNoFence(&reclaim_active)) return batch_size;
+    return min((ULONG64) ReadNoFence64(&write_batch_target), batch_size);
+}
+
+ULONG64 get_trim_batch_target(VOID) {
+    ULONG64 batch_size = get_tunable(TUNE_TRIM_BATCH_SIZE);
+    if (ReadNoFence(&reclaim_active)) return batch_size;
+    return min((ULONG64) ReadNoFence64(&trim_batch_target), batch_size);
+}
+
+VOID set_write_batch_target(ULONG64 page_count) {
+    page_count = max(MIN_WRITE_BATCH_SIZE, min(page_count, MAX_WRITE_BATCH_SIZE));
+    WriteNoFence64(&write_batch_target, (LONG64) page_count);
+}
+
+VOID set_trim_batch_target(ULONG64 page_count) {
+    page_count = max(1, min(page_count, MAX_TRIM_BATCH_SIZE));
+    WriteNoFence64(&trim_batch_target, (LONG64) page_count);
+}
+
+VOID reset_write_batch_target(VOID) {
+    WriteNoFence64(&write_batch_target, MAX_WRITE_BATCH_SIZE);
+}
+
+VOID reset_trim_batch_target(VOID) {
+    WriteNoFence64(&trim_batch_target, MAX_TRIM_BATCH_SIZE);
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include "../utils/config.h"
+#include "threads.h"
+
+/*
+ *  The scheduler forecasts how many pages the user threads will take from each list with
+ *  Holt's double exponential smoothing: a smoothed level (pages per second) and a smoothed trend
+ *  (change in that rate per tick). Unlike a plain moving average, this lets us see a burst coming
+ *  while it is still building, rather than after it has already drained our available pages.
+ */
+#define FORECAST_LEVEL_SMOOTHING        0.05
+#define FORECAST_TREND_SMOOTHING        0.01
+
+typedef struct __holt_forecast {
+    double level;
+    double trend;
+} HOLT_FORECAST, *PHOLT_FORECAST;
+
+// One forecast each for the free, standby and modified lists.
+extern HOLT_FORECAST demand_forecasts[DEMAND_LISTS];
+
+/*
+ *  Folds the most recent observed rate (pages per second) into the forecast.
+ */
+VOID update_forecast(PHOLT_FORECAST forecast, double observed_rate);
+
+/*
+ *  Returns the number of pages we expect to be taken over the next horizon_in_seconds,
+ *  given that the forecast is updated once every tick_in_seconds.
+ */
+double forecast_pages(PHOLT_FORECAST forecast, double horizon_in_seconds, double tick_in_seconds);
+
+/*
+ *  The batch sizes the scheduler has asked the writer and trimmers for, to cover the shortfall it
+ *  predicts, capped by our tuned batch sizes. The trim target is per trimmer. While background reclaim is
+ *  active, they always work in full batches.
+ */
+ULONG64 get_write_batch_target(VOID);
+ULONG64 get_trim_batch_target(VOID);
+
+VOID set_write_batch_target(ULONG64 page_count);
+VOID set_trim_batch_target(ULONG64 page_count);
+
+/*
+ *  Drops a target once the scheduler no longer predicts a shortfall, so that the next batch is the tuned size.
+ */
+VOID reset_write_batch_target(VOID);
+VOID reset_trim_batch_target(VOID);
@@ -1,5 +1,6 @@
 
 #include "initializer.h"
+#include "working_set.h"
 
 // Initializing global structs
 STATS stats = {0};
@@ -106,21 +107,31 @@ void initialize_statistics(void) {
     stats.n_free = &free_lists.page_count;
     stats.n_modified = &modified_list.list_size;
     stats.n_standby = &standby_list.list_size;
-    stats.n_hard = 0;
-    stats.n_soft = 0;
+    set_counter(&stats.n_hard, 0);
+    set_counter(&stats.n_soft, 0);
 
-    stats.n_available = *stats.n_free;
+    LONG64 available = read_counter_exact(stats.n_free);
+#if LARGE_PAGES
+    // Pages set aside for large pages are free, too.
+    available += large_page_pool.page_count;
+#endif
+    set_counter(&stats.n_available, available);
 
     // Get the frequency of the performance counter
     LARGE_INTEGER lpFrequency;
     QueryPerformanceFrequency(&lpFrequency);
     stats.timer_frequency = lpFrequency.QuadPart;
+    calibrate_cycle_counter();
 
     // Initialize consumption rate
     stats.page_consumption_per_second = DEFAULT_PAGE_CONSUMPTION_RATE;
     stats.worker_runtimes[TRIMMING_THREAD_ID] = DEFAULT_TRIM_DURATION;
     stats.worker_runtimes[WRITING_THREAD_ID] = DEFAULT_WRITE_DURATION;
     stats.worker_runtimes[PRUNING_THREAD_ID] = DEFAULT_PRUNE_DURATION;
+    stats.worker_runtimes[AGING_THREAD_ID] = DEFAULT_AGE_DURATION;
+
+    // Set our first watermarks from the default consumption rate.
+    update_watermarks(stats.page_consumption_per_second);
 }
 
 HANDLE CreateSharedMemorySection (VOID) {
@@ -185,16 +196,44 @@ void initialize_page_lists(void) {
     initialize_page_list(&modified_list);
     initialize_page_list(&standby_list);
 
+    // Initialize the queue of threads waiting for pages
+    initialize_page_waiter_queue();
+
     // Initialize group of free lists
     free_lists.number_of_lists = FREE_LIST_COUNT;
-    free_lists.page_count = 0;
+    set_counter(&free_lists.page_count, 0);
     free_lists.free_list_locks = 0;
     free_lists.list_array = zero_malloc(sizeof(PAGE_LIST) * FREE_LIST_COUNT);
     for (int i = 0; i < FREE_LIST_COUNT; i++) {
         initialize_page_list(&free_lists.list_array[i]);
     }
+#if LARGE_PAGES
+    // Initialize the pool of contiguous runs for large pages
+    large_page_pool.capacity = vm.allocated_frame_count / PAGES_PER_LARGE_PAGE + 1;
+    large_page_pool.runs = zero_malloc(sizeof(PPFN) * large_page_pool.capacity);
+    large_page_pool.run_count = 0;
+    large_page_pool.page_count = 0;
+    initialize_byte_lock(&large_page_pool.lock);
+#endif
+}
+
+#if LARGE_PAGES
+int compare_frame_numbers(const void *a, const void *b) {
+    ULONG_PTR first = *(const ULONG_PTR *) a;
+    ULONG_PTR second = *(const ULONG_PTR *) b;
+    return (first > second) - (first < second);
 }
 
+// Returns TRUE if the frames starting at this index form a contiguous run, aligned for a large page.
+// Assumes the frame numbers are sorted (and, being frame numbers, unique).
+BOOL is_start_of_large_page_run(ULONG64 index) {
+    ULONG_PTR first_frame = vm.allocated_frame_numbers[index];
+    if (first_frame % PAGES_PER_LARGE_PAGE != 0) return FALSE;
+    if (index + PAGES_PER_LARGE_PAGE > vm.allocated_frame_count) return FALSE;
+    return vm.allocated_frame_numbers[index + PAGES_PER_LARGE_PAGE - 1] == first_frame + PAGES_PER_LARGE_PAGE - 1;
+}
+#endif
+
 void initialize_PFN_data(void) {
 
     // Initialize PFN sparse array
@@ -213,6 +252,14 @@ void initialize_PFN_data(void) {
     ULONG list_index = 0;
     ULONG num_lists = free_lists.number_of_lists;
 
+#if LARGE_PAGES
+    // Sorting the frame numbers lets us find contiguous, aligned runs in a single pass. The OS
+    // does not care about the order of this array when we free the pages.
+    qsort(vm.allocated_frame_numbers, vm.allocated_frame_count, sizeof(ULONG_PTR), compare_frame_numbers);
+    ULONG64 max_pool_pages = (ULONG64) (LARGE_PAGE_POOL_FRACTION * vm.allocated_frame_count);
+    ULONG64 run_pages_remaining = 0;
+#endif
+
     for (ULONG64 i = 0; i < vm.allocated_frame_count; i++) {
 
         LPVOID result = VirtualAlloc((LPVOID)(PFN_array + vm.allocated_frame_numbers[i]),
@@ -227,6 +274,20 @@ void initialize_PFN_data(void) {
         PPFN new_pfn = PFN_array + vm.allocated_frame_numbers[i];
         create_zeroed_pfn(new_pfn);
 
+#if LARGE_PAGES
+        // Set aside aligned runs for large pages (up to our limit). Their pages go on no list.
+        if (run_pages_remaining == 0 &&
+            (ULONG64) large_page_pool.page_count + PAGES_PER_LARGE_PAGE <= max_pool_pages &&
+            is_start_of_large_page_run(i)) {
+            run_pages_remaining = PAGES_PER_LARGE_PAGE;
+            add_run_to_large_page_pool(new_pfn);
+        }
+        if (run_pages_remaining > 0) {
+            run_pages_remaining--;
+            continue;
+        }
+#endif
+
         // Add the page to one of the free lists
         PPAGE_LIST list = &free_lists.list_array[list_index];
         insert_to_list_tail(list, new_pfn);
@@ -299,6 +360,29 @@ void initialize_threads(void) {
                                                                 &vm.virtual_alloc_shared_parameter,
                                                     1);
 
+#if LARGE_PAGES
+        // Each thread zeroes new large pages through its own 2 MB kernel VA
+        user_thread_info[i].large_page_kernel_va = VirtualAlloc2 (NULL,
+                                                    NULL,
+                                                            PAGE_SIZE * PAGES_PER_LARGE_PAGE,
+                                                    MEM_RESERVE | MEM_PHYSICAL,
+                                                    PAGE_READWRITE,
+                                                                &vm.virtual_alloc_shared_parameter,
+                                                    1);
+        NULL_CHECK(user_thread_info[i].large_page_kernel_va, "Could not reserve large page kernel VA space.");
+#endif
+#if DIRECT_RECLAIM
+        // Each thread copies the pages it reclaims to the page file through its own kernel VA
+        user_thread_info[i].direct_reclaim_kernel_va = VirtualAlloc2 (NULL,
+                                                    NULL,
+                                                            PAGE_SIZE * DIRECT_RECLAIM_BATCH_SIZE,
+                                                    MEM_RESERVE | MEM_PHYSICAL,
+                                                    PAGE_READWRITE,
+                                                                &vm.virtual_alloc_shared_parameter,
+                                                    1);
+        NULL_CHECK(user_thread_info[i].direct_reclaim_kernel_va, "Could not reserve direct reclaim kernel VA space.");
+#endif
+
         // While we're here, update the thread IDs and seed the random number
         user_thread_info[i].thread_id = i;
         LARGE_INTEGER counter;
@@ -306,6 +390,10 @@ void initialize_threads(void) {
         ULONG64 seed = counter.QuadPart ^ ((ULONG64) i << 32) ^ (counter.QuadPart >> 16);
         user_thread_info[i].random_seed = seed;
 
+        // Each thread waits for pages on its own event, so the writer can wake exactly the threads it serves
+        user_thread_info[i].page_waiter.page_ready_event = CreateEvent(NULL, AUTO_RESET, FALSE, NULL);
+        NULL_CHECK(user_thread_info[i].page_waiter.page_ready_event, "Could not initialize page waiter event.");
+
         // And we will fill the initial free page caches of the threads, too
         // We will find the correct free list by wrapping around (since the number of
         // user threads will likely be greater than the number of free lists).
@@ -314,10 +402,10 @@ void initialize_threads(void) {
         PPAGE_LIST free_list = &free_lists.list_array[index];
         ULONG64 num_pages = remove_batch_from_list_head_exclusive(free_list,
                                                         &first_page,
-                                                        FREE_PAGE_CACHE_SIZE);
+                                                        get_tunable(TUNE_FREE_PAGE_CACHE_SIZE));
 
         // Decrement the total free count
-        free_lists.page_count -= (LONG64) num_pages;
+        add_to_counter(&free_lists.page_count, -(LONG64) num_pages);
 
         // Add all removed pages to the free cache and unlock them
         PPFN pfn = first_page;
@@ -355,15 +443,30 @@ void initialize_threads(void) {
 
     ASSERT(scheduling_thread);
 #endif
-    // Create system trimming thread
-    trimming_thread = CreateThread (DEFAULT_SECURITY,
+    // Create system trimming threads, each with its own index. The lead trimmer keeps the trimming runtime estimate.
+    initialize_trimmers();
+    for (ULONG_PTR i = 0; i < NUM_TRIMMER_THREADS; i++) {
+        trimming_threads[i] = CreateThread (DEFAULT_SECURITY,
+                                   DEFAULT_STACK_SIZE,
+                                   (LPTHREAD_START_ROUTINE) trim_pages_thread,
+                                   (LPVOID) i,
+                                   DEFAULT_CREATION_FLAGS,
+                                   &trimmer_thread_ids[i]);
+
+        ASSERT(trimming_threads[i]);
+    }
+
+#if AGING
+    // Create system aging thread
+    aging_thread = CreateThread (DEFAULT_SECURITY,
                                DEFAULT_STACK_SIZE,
-                               (LPTHREAD_START_ROUTINE) trim_pages_thread,
+                               (LPTHREAD_START_ROUTINE) age_pages_thread,
                                NULL,
                                DEFAULT_CREATION_FLAGS,
-                               &worker_thread_ids[TRIMMING_THREAD_ID]);
+                               &worker_thread_ids[AGING_THREAD_ID]);
 
-    ASSERT(trimming_thread);
+    ASSERT(aging_thread);
+#endif
 
     // Create system writing thread
     writing_thread = CreateThread (DEFAULT_SECURITY,
@@ -419,8 +522,8 @@ void initialize_events(void) {
     initiate_pruning_event = CreateEvent(NULL, AUTO_RESET, FALSE, NULL);
     NULL_CHECK(initiate_pruning_event, "Could not initialize writing event.");
 
-    standby_pages_ready_event = CreateEvent(NULL, MANUAL_RESET, FALSE, NULL);
-    NULL_CHECK(standby_pages_ready_event, "Could not intialize standby pages ready event.");
+    above_min_watermark_event = CreateEvent(NULL, MANUAL_RESET, TRUE, NULL);
+    NULL_CHECK(above_min_watermark_event, "Could not initialize above min watermark event.");
 
     system_exit_event = CreateEvent(NULL, MANUAL_RESET, FALSE, NULL);
     NULL_CHECK(system_exit_event, "Could not intialize standby pages ready event.");
@@ -462,6 +565,14 @@ void initialize_system(void) {
     // Initialize all PFN data
     initialize_PFN_data();
 
+    // Initialize the replacement policy (some size their targets by physical memory)
+    initialize_replacement_policy();
+
+#if AGING && WSS_SAMPLING
+    // Initialize the working-set samples (faults stamp them, so before any thread starts)
+    initialize_working_set();
+#endif
+
     // Initialize all page file and metadata
     initialize_page_file_and_metadata();
 
@@ -473,8 +584,4 @@ void initialize_system(void) {
 
     // Initialize statistics to track page consumption (for scheduler).
     initialize_statistics();
-
-#if DEBUG
-    g_traceIndex = -1;
-#endif
 }
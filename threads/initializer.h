@@ -15,11 +15,15 @@
 #include "../data_structures/pfn.h"
 #include "../data_structures/pte.h"
 #include "../data_structures/page_list.h"
+#include "../data_structures/page_waiters.h"
 #include "../data_structures/disk.h"
 #include "threads.h"
 #include "trimmer.h"
 #include "page_fault_handler.h"
 #include "ager.h"
+#include "watermarks.h"
+#include "latency_slo.h"
+#include "fault_latency.h"
 #include "scheduler.h"
 #include "simulator.h"
 #include "writer.h"
@@ -0,0 +1,88 @@
+#include "latency_slo.h"
+
+volatile double reclaim_aggressiveness = 1.0;
+double p99_target_in_microseconds = DEFAULT_P99_TARGET_IN_MICROSECONDS;
+
+#if LATENCY_SLO
+// Only the scheduler touches these.
+static LATENCY_HISTOGRAM current_latencies;
+static LATENCY_HISTOGRAM previous_latencies;
+static LATENCY_HISTOGRAM interval_latencies;
+
+static slo_report slo_reports[NUMBER_OF_SLO_REPORTS];
+static ULONG64 slo_report_count;
+static double run_time_in_seconds;
+
+static VOID merge_user_thread_latencies(PLATENCY_HISTOGRAM merged) {
+    memset(merged, 0, sizeof(LATENCY_HISTOGRAM));
+    for (ULONG outcome = 0; outcome < FAULT_OUTCOMES; outcome++) merge_fault_latencies(merged, outcome);
+}
+
+VOID update_latency_slo(double elapsed_seconds) {
+    run_time_in_seconds += elapsed_seconds;
+
+    // Find what was recorded since we last looked.
+    merge_user_thread_latencies(&current_latencies);
+    subtract_histogram(&interval_latencies, &current_latencies, &previous_latencies);
+    previous_latencies = current_latencies;
+
+    ULONG64 fault_count = get_histogram_count(&interval_latencies);
+    if (fault_count < SLO_MIN_FAULTS_PER_INTERVAL) return;
+
+    slo_report report;
+    report.time_in_seconds = run_time_in_seconds;
+    report.fault_count = fault_count;
+    report.p50 = cycles_to_microseconds(get_histogram_percentile(&interval_latencies, 0.5));
+    report.p99 = cycles_to_microseconds(get_histogram_percentile(&interval_latencies, 0.99));
+    report.p999 = cycles_to_microseconds(get_histogram_percentile(&interval_latencies, 0.999));
+
+    // Missing the target costs us straight away, so we tighten quickly. We relax slowly, and only with room to spare.
+    double aggressiveness = reclaim_aggressiveness;
+    if (report.p99 > p99_target_in_microseconds) {
+        aggressiveness = min(aggressiveness * SLO_TIGHTEN_FACTOR, SLO_MAX_AGGRESSIVENESS);
+    } else if (report.p99 < SLO_SLACK * p99_target_in_microseconds) {
+        aggressiveness = max(aggressiveness * SLO_RELAX_FACTOR, SLO_MIN_AGGRESSIVENESS);
+    }
+    reclaim_aggressiveness = aggressiveness;
+
+    report.aggressiveness = aggressiveness;
+    slo_reports[slo_report_count % NUMBER_OF_SLO_REPORTS] = report;
+    slo_report_count++;
+}
+
+VOID print_latency_slo_status(VOID) {
+    if (slo_report_count == 0) return;
+    slo_report *report = &slo_reports[(slo_report_count - 1) % NUMBER_OF_SLO_REPORTS];
+    printf("FAULT LATENCY (us):\tp50 %.1f\tp99 %.1f\tp999 %.1f\t(target p99 %.1f, aggressiveness %.2f)\n",
+        report->p50, report->p99, report->p999, p99_target_in_microseconds, report->aggressiveness);
+}
+
+VOID print_latency_slo_summary(VOID) {
+    merge_user_thread_latencies(&current_latencies);
+
+    ULONG64 count = min(NUMBER_OF_SLO_REPORTS, slo_report_count);
+    ULONG64 intervals_met = 0;
+    for (ULONG64 i = 0; i < count; i++) {
+        if (slo_reports[i].p99 <= p99_target_in_microseconds) intervals_met++;
+    }
+
+    printf("Fault latency: p50 %.1f us, p99 %.1f us, p999 %.1f us (target p99 %.1f us, met in %llu of %llu intervals)\n",
+        cycles_to_microseconds(get_histogram_percentile(&current_latencies, 0.5)),
+        cycles_to_microseconds(get_histogram_percentile(&current_latencies, 0.99)),
+        cycles_to_microseconds(get_histogram_percentile(&current_latencies, 0.999)),
+        p99_target_in_microseconds, intervals_met, count);
+}
+
+VOID print_latency_slo_reports(VOID) {
+    ULONG64 count = min(NUMBER_OF_SLO_REPORTS, slo_report_count);
+    ULONG64 first = slo_report_count - count;
+
+    for (ULONG64 i = first; i < slo_report_count; i++) {
+        slo_report *report = &slo_reports[i % NUMBER_OF_SLO_REPORTS];
+        printf("%.1f s:\t%llu faults\tp50 %.1f us\tp99 %.1f us\tp999 %.1f us\taggressiveness %.2f\n",
+            report->time_in_seconds, report->fault_count, report->p50, report->p99, report->p999,
+            report->aggressiveness);
+    }
+    printf("~~~~~~~~~~~~~~~~~~~~~\n");
+}
+#endif
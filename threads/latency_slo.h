@@ -0,0 +1,60 @@
+#pragma once
+#include "../data_structures/histogram.h"
+#include "threads.h"
+#include "fault_latency.h"
+
+/*
+ *  In latency SLO mode, the scheduler holds p99 fault latency to a target while doing as little
+ *  background reclaim as it can. Each user thread times every fault into its own histogram. Once per
+ *  report interval, the scheduler merges them, takes the p99 of the interval just ended, and moves
+ *  reclaim_aggressiveness:
+ *
+ *      above target:                   multiply by SLO_TIGHTEN_FACTOR, straight away
+ *      below SLO_SLACK * target:       multiply by SLO_RELAX_FACTOR, slowly giving back background CPU
+ *
+ *  Aggressiveness scales the gaps between our watermarks, the number of trimmers we run, and the
+ *  horizon the scheduler sizes its trim and write batches to cover. Outside SLO mode it stays at 1.
+ */
+#define SLO_TIGHTEN_FACTOR              1.5
+#define SLO_RELAX_FACTOR                0.95
+#define SLO_SLACK                       0.8
+#define SLO_MIN_AGGRESSIVENESS          0.25
+#define SLO_MAX_AGGRESSIVENESS          16.0
+
+// An interval with fewer faults than this tells us too little about its tail to act on.
+#define SLO_MIN_FAULTS_PER_INTERVAL     100
+
+#define NUMBER_OF_SLO_REPORTS           512
+
+typedef struct {
+    double time_in_seconds;
+    ULONG64 fault_count;
+    double p50;
+    double p99;
+    double p999;
+    double aggressiveness;
+} slo_report;
+
+extern volatile double reclaim_aggressiveness;
+extern double p99_target_in_microseconds;
+
+/*
+ *  Called by the scheduler once per report interval. Measures the interval just ended and adjusts
+ *  reclaim_aggressiveness.
+ */
+VOID update_latency_slo(double elapsed_seconds);
+
+/*
+ *  Prints the latest interval's p50/p99/p999 against the target.
+ */
+VOID print_latency_slo_status(VOID);
+
+/*
+ *  Prints the whole run's p50/p99/p999 against the target, and how many intervals met it.
+ */
+VOID print_latency_slo_summary(VOID);
+
+/*
+ *  Prints every interval's p50/p99/p999 and aggressiveness.
+ */
+VOID print_latency_slo_reports(VOID);
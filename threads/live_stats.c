@@ -0,0 +1,128 @@
+#include "live_stats.h"
+#include "watermarks.h"
+#include "pressure.h"
+#include "../data_structures/disk.h"
+#include "../data_structures/page_list.h"
+
+#if PUBLISH_LIVE_STATS
+static HANDLE live_stats_section;
+static PLIVE_STATS live_stats;
+
+// Where our rates start from.
+static LONGLONG live_stats_start;
+static LONG64 previous_hard_faults;
+static LONG64 previous_soft_faults;
+
+VOID create_live_stats(VOID) {
+    live_stats_section = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                                            0, sizeof(LIVE_STATS), LIVE_STATS_MAPPING_NAME);
+    if (live_stats_section == NULL) {
+        printf("Could not create the live stats section. Live stats are off.\n");
+        return;
+    }
+
+    live_stats = MapViewOfFile(live_stats_section, FILE_MAP_WRITE, 0, 0, sizeof(LIVE_STATS));
+    if (live_stats == NULL) {
+        printf("Could not map the live stats section. Live stats are off.\n");
+        CloseHandle(live_stats_section);
+        live_stats_section = NULL;
+        return;
+    }
+
+    // A section left over from an earlier run may still be open in a reader. We start it over, as one
+    // update that lasts until our first publish: the sequence stays odd until every field is written.
+    if ((live_stats->sequence & 1) == 0) InterlockedIncrement64(&live_stats->sequence);
+    live_stats->magic = 0;
+    live_stats->version = 0;
+    memset(&live_stats->process_id, 0, sizeof(LIVE_STATS) - FIELD_OFFSET(LIVE_STATS, process_id));
+    live_stats->process_id = GetCurrentProcessId();
+    live_stats->version = LIVE_STATS_VERSION;
+    live_stats_start = get_timestamp();
+
+    // Readers check the magic number last, so it is only there once the rest is.
+    WriteRelease((volatile LONG *) &live_stats->magic, LIVE_STATS_MAGIC);
+}
+
+// Our two halves of the sequence lock. The interlocked increments are full fences, so no field
+// we write can move outside of them.
+static VOID begin_live_stats_update(VOID) {
+    // Our first update finishes the one create_live_stats began, so the sequence is already odd.
+    if ((live_stats->sequence & 1) == 0) InterlockedIncrement64(&live_stats->sequence);
+}
+
+static VOID end_live_stats_update(VOID) {
+    InterlockedIncrement64(&live_stats->sequence);
+}
+
+VOID publish_live_stats(double seconds_since_last_update) {
+    if (live_stats == NULL) return;
+
+    // Read everything first, so the update itself is as short as we can make it.
+    LONG64 free_pages = read_counter_approximate(stats.n_free);
+    LONG64 standby_pages = *stats.n_standby;
+    LONG64 modified_pages = *stats.n_modified;
+    LONG64 hard_faults = read_counter_approximate(&stats.n_hard);
+    LONG64 soft_faults = read_counter_approximate(&stats.n_soft);
+    double seconds = max(seconds_since_last_update, 1e-9);
+
+    LONG64 active_pages = (LONG64) vm.allocated_frame_count - (free_pages + standby_pages + modified_pages);
+#if LARGE_PAGES
+    // Pages held in the large page pool are free, but on no list.
+    active_pages -= large_page_pool.page_count;
+#endif
+
+    begin_live_stats_update();
+
+    live_stats->seconds_elapsed = get_time_difference(get_timestamp(), live_stats_start);
+    live_stats->allocated_pages = vm.allocated_frame_count;
+    live_stats->free_pages = free_pages;
+    live_stats->standby_pages = standby_pages;
+    live_stats->modified_pages = modified_pages;
+    live_stats->active_pages = active_pages;
+    live_stats->available_pages = read_counter_approximate(&stats.n_available);
+    live_stats->empty_disk_slots = pf.empty_disk_slots;
+
+    live_stats->min_watermark = watermarks.min;
+    live_stats->low_watermark = watermarks.low;
+    live_stats->high_watermark = watermarks.high;
+    live_stats->reclaim_active = reclaim_active;
+
+    live_stats->hard_faults = hard_faults;
+    live_stats->soft_faults = soft_faults;
+    live_stats->hard_faults_per_second = (double) (hard_faults - previous_hard_faults) / seconds;
+    live_stats->soft_faults_per_second = (double) (soft_faults - previous_soft_faults) / seconds;
+    live_stats->pages_consumed_per_second = stats.page_consumption_per_second;
+
+    live_stats->trim_runtime = stats.worker_runtimes[TRIMMING_THREAD_ID];
+    live_stats->write_runtime = stats.worker_runtimes[WRITING_THREAD_ID];
+
+    live_stats->pages_trimmed = stats.n_trimmed;
+    live_stats->pages_written = stats.n_written;
+    live_stats->throttled_faults = stats.n_throttled;
+
+#if PRESSURE_STALL_INFO
+    for (ULONG window = 0; window < PRESSURE_WINDOWS; window++) {
+        live_stats->pressure_some[window] = get_pressure(PRESSURE_SOME, window);
+        live_stats->pressure_all[window] = get_pressure(PRESSURE_ALL, window);
+    }
+#endif
+
+    end_live_stats_update();
+
+    previous_hard_faults = hard_faults;
+    previous_soft_faults = soft_faults;
+}
+
+VOID close_live_stats(VOID) {
+    if (live_stats == NULL) return;
+
+    begin_live_stats_update();
+    live_stats->finished = TRUE;
+    end_live_stats_update();
+
+    UnmapViewOfFile(live_stats);
+    CloseHandle(live_stats_section);
+    live_stats = NULL;
+    live_stats_section = NULL;
+}
+#endif
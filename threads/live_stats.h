@@ -0,0 +1,27 @@
+#pragma once
+#include "../utils/live_stats_layout.h"
+#include "threads.h"
+
+/*
+ *  Publishes our counters to a named shared-memory section (see live_stats_layout.h), so a run can be
+ *  watched from outside with tools/stats_reader.c -- without any console I/O on our side. The scheduler
+ *  creates the section, updates it every LIVE_STATS_INTERVAL_IN_MILLISECONDS, and closes it at exit.
+ */
+#define LIVE_STATS_INTERVAL_IN_MILLISECONDS     100
+
+#if PUBLISH_LIVE_STATS
+/*
+ *  Creates and maps the section. If we cannot, we carry on without live stats.
+ */
+VOID create_live_stats(VOID);
+
+/*
+ *  Takes a fresh copy of our counters. Rates are over the given seconds since the last update.
+ */
+VOID publish_live_stats(double seconds_since_last_update);
+
+/*
+ *  Marks the run finished, then unmaps and closes the section.
+ */
+VOID close_live_stats(VOID);
+#endif
@@ -1,5 +1,10 @@
 
 #include "page_fault_handler.h"
+#include "../utils/phase_profiler.h"
+#include "../utils/trace.h"
+#include "../utils/cpu_counters.h"
+#include "pressure.h"
+#include "working_set.h"
 
 #include <sys/stat.h>
 
@@ -32,10 +37,11 @@ BOOL va_faults_on_access(PPTE pte) {
     return pte->memory_format.valid == PTE_INVALID;
 }
 
-BOOL resolve_soft_fault(PPTE pte) {
+BOOL resolve_soft_fault(PPTE pte, PUSER_THREAD_INFO thread_info) {
 
     // Now we will catch a snapshot of the PTE, because it CAN be changed without the lock
     // when we are sending it to the disk.
+    PHASE_BEGIN(PHASE_SOFT_LOCKS);
     lock_pte(pte);
     PTE pte_snapshot = *pte;
 
@@ -58,6 +64,7 @@ BOOL resolve_soft_fault(PPTE pte) {
 
     // Now we will lock the pfn
     lock_pfn(available_pfn);
+    PHASE_END(PHASE_SOFT_LOCKS);
 
 #if DEBUG
     validate_pfn(available_pfn);
@@ -90,6 +97,7 @@ BOOL resolve_soft_fault(PPTE pte) {
 
     // If the PFN is mid-trim or mid-write, then we will not need to remove it from any list.
     //But if it is in its standby or modified states, we will need to remove it from the list!
+    SET_FAULT_OUTCOME(thread_info, FAULT_SOFT_IN_FLIGHT);
     if (!IS_PFN_MID_WRITE(available_pfn) && !IS_PFN_MID_TRIM(available_pfn)) {
 
         // This page list variable is necessary to know which page list we will remove from.
@@ -101,12 +109,6 @@ BOOL resolve_soft_fault(PPTE pte) {
         // Since it is not in the disk slot yet, there is no need to update its disk metadata.
         if (IS_PFN_MODIFIED(available_pfn)) {
             list_to_decrement = &modified_list;
-
-            // Check to see if the modified list needs to be refilled
-            signal_event_if_list_is_about_to_run_low(   list_to_decrement,
-                                                        initiate_trimming_event,
-                                                        TRIMMING_THREAD_ID,
-                                                        LOW_PAGE_THRESHOLD);
         }
 
         else {
@@ -116,30 +118,35 @@ BOOL resolve_soft_fault(PPTE pte) {
             // We can do this lockless because we hold the PTE and PFN locks.
             clear_disk_slot(available_pfn->fields.disk_index);
             list_to_decrement = &standby_list;
-
-            // Check to see if the standby list needs to be refilled
-            signal_event_if_list_is_about_to_run_low(   list_to_decrement,
-                                                        initiate_writing_event,
-                                                        WRITING_THREAD_ID,
-                                                        LOW_PAGE_THRESHOLD);
         }
 
         // Remove the page from its list (standby or modified)
+        PHASE_BEGIN(PHASE_SOFT_LIST_REMOVE);
         remove_page_on_soft_fault(list_to_decrement, available_pfn);
+        PHASE_END(PHASE_SOFT_LIST_REMOVE);
+        thread_info->pages_taken[list_to_decrement == &standby_list ? DEMAND_STANDBY : DEMAND_MODIFIED]++;
+        SET_FAULT_OUTCOME(thread_info, list_to_decrement == &standby_list ? FAULT_SOFT_STANDBY : FAULT_SOFT_MODIFIED);
+
+        // Taking a standby page leaves one fewer available, which may start reclaim.
+        if (list_to_decrement == &standby_list) wake_reclaim_if_below_low();
     }
 
     // Regardless, these steps should happen to perform a soft fault!
     // Update the PTE and PFN to the active state. Map the page!
+    PHASE_BEGIN(PHASE_SOFT_MAP);
     map_single_page_from_pte(pte);
+    PHASE_END(PHASE_SOFT_MAP);
     set_PFN_active(available_pfn, pte);
-    set_PTE_to_valid(pte, pte->memory_format.frame_number);
 
-    // Release locks and return!
+    // Release locks and return! The PTE becomes valid and unlocked in a single write.
     unlock_pfn(available_pfn);
-    unlock_pte(pte);
+    set_PTE_to_valid_and_unlock(pte, pte->memory_format.frame_number, policy_on_fault(pte_snapshot));
+#if AGING && WSS_SAMPLING
+    record_working_set_fault(pte - PTE_base);
+#endif
 
     // Update statistics
-    InterlockedIncrement64(&stats.n_soft);
+    add_to_counter(&stats.n_soft, 1);
 
     return TRUE;
 }
@@ -174,13 +181,10 @@ BOOL move_batch_from_standby_to_cache(PUSER_THREAD_INFO thread_info) {
     // Grab a batch of pages from the standby list
     USHORT batch_size = remove_batch_from_list_head(&standby_list,
                                                     &pfn,
-                                                    FREE_PAGE_CACHE_SIZE / 4);
+                                                    get_tunable(TUNE_FREE_PAGE_CACHE_SIZE) / 4);
 
-    // Using recent consumption, decide if we need to signal the writer to bring in more standby pages!
-    signal_event_if_list_is_about_to_run_low(   &standby_list,
-                                                initiate_writing_event,
-                                                WRITING_THREAD_ID,
-                                                LOW_PAGE_THRESHOLD);
+    // If we have fallen below our low watermark, start reclaiming more.
+    wake_reclaim_if_below_low();
 
     if (batch_size == 0) return FALSE;
 
@@ -210,9 +214,105 @@ BOOL move_batch_from_standby_to_cache(PUSER_THREAD_INFO thread_info) {
 
     ASSERT(thread_info->free_page_count == 0);
     thread_info->free_page_count = batch_size;
+    thread_info->pages_taken[DEMAND_STANDBY] += batch_size;
+
+    // Pages in our cache are no longer available to anyone else.
+    decrease_available_count(batch_size);
     return TRUE;
 }
 
+#if DIRECT_RECLAIM
+BOOL direct_reclaim_to_cache(PUSER_THREAD_INFO thread_info) {
+
+    LONGLONG start = get_timestamp();
+
+    // Claim our disk slots first. Without them, there is nothing we can reclaim.
+    ULONG64 disk_slots[DIRECT_RECLAIM_BATCH_SIZE];
+    ULONG64 slot_count = claim_disk_slots(disk_slots, DIRECT_RECLAIM_BATCH_SIZE);
+    if (slot_count == 0) return FALSE;
+
+    // Take a few pages from the modified list. If it is empty, trim a few ourselves, straight into our
+    // batch: they never go near the modified list, and the trimmers and writer are left to themselves.
+    // We hold no PTE or PFN locks here, so the trimmer's PTE -> PFN order is safe for us, too.
+    PPFN pages[DIRECT_RECLAIM_BATCH_SIZE];
+    PPFN pfn;
+    ULONG64 batch_size = remove_batch_from_list_head(&modified_list, &pfn, slot_count);
+    for (ULONG64 i = 0; i < batch_size; i++) {
+        pages[i] = pfn;
+        pfn = pfn->flink;
+    }
+    if (batch_size == 0) {
+        batch_size = trim_pages_for_direct_reclaim(thread_info->thread_id, pages, slot_count);
+
+        // Pages we trim count as trimmed, just like the trimmers' own.
+        InterlockedAdd64(&stats.n_trimmed, (LONG64) batch_size);
+    }
+
+    // Give back the slots we will not use
+    for (ULONG64 i = batch_size; i < slot_count; i++) clear_disk_slot(disk_slots[i]);
+    if (batch_size == 0) return FALSE;
+
+    // Our pages are locked, and on no list. Gather their frames.
+    ULONG_PTR frame_numbers[DIRECT_RECLAIM_BATCH_SIZE];
+    for (ULONG64 i = 0; i < batch_size; i++) {
+#if DEBUG
+        validate_pfn(pages[i]);
+#endif
+        frame_numbers[i] = get_frame_from_PFN(pages[i]);
+    }
+
+    // Copy the pages to the page file through our own kernel VA
+    PULONG_PTR kernel_va = thread_info->direct_reclaim_kernel_va;
+    map_pages(batch_size, kernel_va, frame_numbers);
+    for (ULONG64 i = 0; i < batch_size; i++) {
+        memcpy(get_page_file_offset(disk_slots[i]), kernel_va + i * PAGE_SIZE / 8, PAGE_SIZE);
+    }
+    unmap_pages(batch_size, kernel_va);
+
+    // Each page's contents are on the disk now, so its old PTE can point there, just as when we take
+    // a page from standby. We hold the page lock, so a soft fault on the old PTE will see the disk format.
+    ASSERT(thread_info->free_page_count == 0);
+    for (ULONG64 i = 0; i < batch_size; i++) {
+        map_pte_to_disk(pages[i]->PTE, disk_slots[i]);
+        thread_info->free_page_cache[i] = pages[i];
+        set_PFN_free(pages[i]);
+        unlock_pfn(pages[i]);
+    }
+    thread_info->free_page_count = (USHORT) batch_size;
+    thread_info->pages_taken[DEMAND_MODIFIED] += batch_size;
+
+    LONGLONG end = get_timestamp();
+    InterlockedIncrement64(&stats.n_direct_reclaims);
+    InterlockedAdd64(&stats.direct_reclaim_time, end - start);
+    return TRUE;
+}
+#endif
+
+PPFN wait_for_page_handoff(PUSER_THREAD_INFO thread_info) {
+    PPAGE_WAITER waiter = &thread_info->page_waiter;
+    waiter->page = NULL;
+    enqueue_page_waiter(waiter);
+
+    // Pages may have gone to standby after we last looked, but before we joined the queue.
+    // If so, we leave the queue and look again, rather than wait for the next batch.
+    if ((!is_page_list_empty(&standby_list) || !is_counter_below(&free_lists.page_count, 1)) && try_remove_page_waiter(waiter)) {
+        return NULL;
+    }
+
+    // We wait for the writer to serve us. If we time out and are still in the queue, we leave and look again.
+    TRACE_BEGIN(TRACE_WAIT, TRACE_WAIT_PAGE);
+    STALL_BEGIN();
+    if (WaitForSingleObject(waiter->page_ready_event, PAGE_WAIT_TIMEOUT_IN_MILLISECONDS) == WAIT_TIMEOUT &&
+        !try_remove_page_waiter(waiter)) {
+
+        // The writer took us out of the queue just as we timed out. Our page is on its way.
+        WaitForSingleObject(waiter->page_ready_event, INFINITE);
+    }
+    STALL_END();
+    TRACE_END(TRACE_WAIT, TRACE_WAIT_PAGE);
+    return waiter->page;
+}
+
 /*
     Unmaps all the thread's kernal VAs if they have all been used.
     If they haven't all been used -- it does nothing.
@@ -247,8 +347,12 @@ BOOL resolve_hard_fault(PPTE pte, PUSER_THREAD_INFO thread_info) {
     // The PFN associated with the page that will be mapped to the faulting VA.
     PPFN available_pfn;
 
+    // If we are almost out of pages, wait for reclaim to catch up before we take one.
+    if (throttle_if_below_min()) SET_FAULT_WAITED(thread_info);
+
     // First, we will attempt to grab a free page from our cache or from a free list
     BOOL free_page_acquired;
+    PHASE_BEGIN(PHASE_HARD_ACQUIRE_PAGE);
     while (TRUE) {
         free_page_acquired = acquire_free_page(thread_info, &available_pfn);
         if (free_page_acquired) break;
@@ -258,28 +362,50 @@ BOOL resolve_hard_fault(PPTE pte, PUSER_THREAD_INFO thread_info) {
         // If we are NOT able to get a page, we will break and set an event for the trimmer.
         BOOL standby_page_acquired = move_batch_from_standby_to_cache(thread_info);
         if (!standby_page_acquired) {
-            // If no pages can be grabbed from the standby list, we will reset its event
-            // so we will wait (and effectively track latency).
-            ResetEvent(standby_pages_ready_event);
+#if LARGE_PAGES
+            // Rather than wait, we can give up one of our large page runs to the free lists.
+            if (try_break_large_page_run_into_free_lists()) continue;
+#endif
+#if DIRECT_RECLAIM
+            // Rather than wait for the trimmer and writer, we can do a little of their work ourselves.
+            // We are stalled on memory all the same, so it counts toward our pressure.
+            STALL_BEGIN();
+            BOOL reclaimed = direct_reclaim_to_cache(thread_info);
+            STALL_END();
+            if (reclaimed) continue;
+#endif
+            // If no pages can be grabbed from the standby list, we will wait (and effectively track latency).
             break;
         }
     }
+    PHASE_END(PHASE_HARD_ACQUIRE_PAGE);
+
+    // Every page we take brings us closer to our low watermark.
+    wake_reclaim_if_below_low();
 
-    // If no pages are available, release locks and wait for pages available event.
+    // If no pages are available, we join the queue of waiting threads.
     // We will MANUALLY initiate trimming here, although we were hoping to avoid it.
-    // Once the event is triggered, return to the beginning of the loop, then wait for
-    // the page fault lock again.
+    // If the writer hands us a page, we carry on with it. Otherwise, we return to the
+    // beginning of the loop and try again.
     if (!free_page_acquired) {
         SetEvent(initiate_trimming_event);
 
         LONGLONG start = get_timestamp();
-        WaitForSingleObject(standby_pages_ready_event, INFINITE);
+        SET_FAULT_WAITED(thread_info);
+        available_pfn = wait_for_page_handoff(thread_info);
 
         LONGLONG end = get_timestamp();
+        InterlockedIncrement64(&stats.n_page_waits);
         InterlockedAdd64(&stats.wait_time, (end - start));
-        InterlockedIncrement64(&stats.hard_faults_missed);
 
-        return FALSE;
+        if (available_pfn == NULL) {
+            InterlockedIncrement64(&stats.hard_faults_missed);
+            return FALSE;
+        }
+        lock_pfn(available_pfn);
+
+        // Our page would have gone to standby, had we not been waiting for it.
+        thread_info->pages_taken[DEMAND_STANDBY]++;
     }
     // At this point, we KNOW we have an available page. It is locked.
     // Let's now resolve the fault.
@@ -291,19 +417,35 @@ BOOL resolve_hard_fault(PPTE pte, PUSER_THREAD_INFO thread_info) {
     // Get the frame number
     frame_number_to_map = get_frame_from_PFN(available_pfn);
 
-    // Now we will finally try to acquire the PTE lock
-    // If we cannot get it, we will try again.
-    BOOL pte_lock_acquired = try_lock_pte(pte);
+    // Now we will finally try to acquire the PTE lock. We only want it if the PTE is still
+    // hard faulting (zeroed or on disk), so the state check and the lock acquire are folded
+    // into one compare-exchange against this snapshot. If we cannot get it, we will try again.
+    PHASE_BEGIN(PHASE_HARD_PTE_LOCK);
+    PTE pte_snapshot;
+    pte_snapshot.entire_pte = ReadULong64NoFence((ULONG64 *) pte);
+    BOOL hard_faulting = !IS_PTE_LOCKED(&pte_snapshot) &&
+                         (IS_PTE_ZEROED(&pte_snapshot) || IS_PTE_ON_DISK(&pte_snapshot));
+
+    // A zeroed PTE's region could still be mapped as a large page by someone else.
+    // We pin the page table first, which rules that out while we lock the PTE.
+    BOOL page_table_pinned = hard_faulting && IS_PTE_ZEROED(&pte_snapshot);
+    if (page_table_pinned && !pin_page_table(pte)) {
+        // The region was mapped as a large page while we were getting our page, so this PTE is not in use.
+        hard_faulting = FALSE;
+        page_table_pinned = FALSE;
+    }
+
+    BOOL pte_lock_acquired = hard_faulting && try_lock_pte_if_unchanged(pte, pte_snapshot);
+    PHASE_END(PHASE_HARD_PTE_LOCK);
 
     // If the pte is no longer hard faulting, add the page to the free list and return
-    if (!pte_lock_acquired || IS_PTE_VALID(pte) || IS_PTE_TRANSITION(pte)) {
+    if (!pte_lock_acquired) {
 
-        // If we were able to get the lock, release it. There is no need for it.
-        if (pte_lock_acquired) unlock_pte(pte);
+        // The PTE is still zeroed (or was never ours), so it does not hold a place in its page table.
+        if (page_table_pinned) unpin_page_table(pte);
 
         // Add the page to the free list and update its status
         add_page_to_cache_or_free_list(available_pfn, thread_info->thread_id, thread_info);
-        increment_available_count();
         set_PFN_free(available_pfn);
 
         // Unlock the page
@@ -313,20 +455,26 @@ BOOL resolve_hard_fault(PPTE pte, PUSER_THREAD_INFO thread_info) {
 
     // Since we have the PTE and page locks, we can now safely map the page.
     // We map the available frame to the kernel VA AND the faulting VA at the same time (for efficiency)
+    PHASE_BEGIN(PHASE_HARD_MAP);
     map_both_va_to_same_page(kernel_read_va, get_VA_from_PTE(pte), frame_number_to_map);
+    PHASE_END(PHASE_HARD_MAP);
 
     // Since we are committing to using this read va, we will need to increase the count.
     thread_info->kernel_va_index++;
 
     // Now that we have the page in memory, let's check if we need to do a disk read.
     // If PTE is zeroed, do not do the disk read. But if the PTE is on the disk, read its contents back!
-    if (IS_PTE_ON_DISK(pte)) {
+    if (IS_PTE_ON_DISK(&pte_snapshot)) {
+
+        SET_FAULT_OUTCOME(thread_info, FAULT_HARD_DISK);
 
         // Get location of new pte on disk
-        UINT64 disk_slot = pte->disk_format.disk_index;
+        UINT64 disk_slot = pte_snapshot.disk_format.disk_index;
 
         // Copy data from page file into physical pages
+        PHASE_BEGIN(PHASE_HARD_DISK_READ);
         memcpy(kernel_read_va, get_page_file_offset(disk_slot), PAGE_SIZE);
+        PHASE_END(PHASE_HARD_DISK_READ);
 
         // Mark disk slot as available. We can do this lockless
         // because we hold the PTE & PFN locks.
@@ -335,34 +483,112 @@ BOOL resolve_hard_fault(PPTE pte, PUSER_THREAD_INFO thread_info) {
     // Otherwise, our PTE is in its zeroed state. In this case, it is possible we are about to give it a page that
     // has memory on it that needs to be zeroed. Let's zero that memory now.
     else {
-        ASSERT(IS_PTE_ZEROED(pte));
+        ASSERT(IS_PTE_ZEROED(&pte_snapshot));
+        SET_FAULT_OUTCOME(thread_info, FAULT_ZERO_FILL);
 
         // Zero the page
+        PHASE_BEGIN(PHASE_HARD_ZERO);
         memset(kernel_read_va, 0, PAGE_SIZE);
+        PHASE_END(PHASE_HARD_ZERO);
     }
 
 #if 0
     // Ensure that the page contents correctly contain the relevant VA!
     ASSERT(validate_page(get_VA_from_PTE(pte)));
 #endif
-    // Update PTE and PFN
-    set_PTE_to_valid(pte, frame_number_to_map);
+    // Update PFN, then release locks. The PTE becomes valid and unlocked in a single write,
+    // so a first-touch fault costs one compare-exchange on the PTE in total.
     set_PFN_active(available_pfn, pte);
-
-    // Release locks
     unlock_pfn(available_pfn);
-    unlock_pte(pte);
+    set_PTE_to_valid_and_unlock(pte, frame_number_to_map, policy_on_fault(pte_snapshot));
+#if AGING && WSS_SAMPLING
+    record_working_set_fault(pte - PTE_base);
+#endif
 
     // Update statistics
-    InterlockedIncrement64(&stats.n_hard);
+    add_to_counter(&stats.n_hard, 1);
 
     // If we need to unmap ALL the kernel read VAs, we will do so in one big batch
+    PHASE_BEGIN(PHASE_HARD_KERNEL_UNMAP);
     unmap_and_reset_all_kernal_va_for_this_thread(thread_info);
+    PHASE_END(PHASE_HARD_KERNEL_UNMAP);
 
     return TRUE;
 }
 
-BOOL page_fault_handler(PULONG_PTR faulting_va, PUSER_THREAD_INFO user_thread_info) {
+#if LARGE_PAGES
+/*
+ *  If the faulting VA lies in an untouched, aligned 2 MB region, maps the whole region with one large page.
+ *  We only map large pages eagerly, on a region's first fault: regions already resident are never promoted.
+ *  Returns FALSE if the region is not eligible or no contiguous run is available, in which case
+ *  we fall back to a regular fault.
+ */
+BOOL try_map_large_page(PULONG_PTR faulting_va, PUSER_THREAD_INFO thread_info) {
+
+    // Only whole regions can be large pages -- the last, partial page table never qualifies.
+    PPDE pde = get_PDE_from_VA(faulting_va);
+    if ((ULONG64) (pde - PDE_base + 1) * PTES_PER_PAGE_TABLE > vm.num_ptes) return FALSE;
+
+    PDE pde_snapshot;
+    pde_snapshot.entire_pde = ReadULong64NoFence(&pde->entire_pde);
+    if (!IS_PDE_UNTOUCHED(&pde_snapshot)) return FALSE;
+
+    PPFN first_pfn = try_remove_run_from_large_page_pool();
+    if (first_pfn == NULL) return FALSE;
+
+    // Lock the PDE, but only if the region is still untouched. No one can create its page table while we hold it.
+    PDE locked = pde_snapshot;
+    locked.table_format.lock = PDE_LOCKED;
+    if (!compare_and_swap_pde(pde, pde_snapshot, locked)) {
+        add_run_to_large_page_pool(first_pfn);
+        return FALSE;
+    }
+
+    ULONG_PTR first_frame = get_frame_from_PFN(first_pfn);
+    ULONG_PTR frames[PAGES_PER_LARGE_PAGE];
+    for (ULONG64 i = 0; i < PAGES_PER_LARGE_PAGE; i++) {
+        frames[i] = first_frame + i;
+    }
+
+    // Zero the whole run through our own kernel VA, so no one can see stale data in the user's region.
+    if (MapUserPhysicalPages(thread_info->large_page_kernel_va, PAGES_PER_LARGE_PAGE, frames) == FALSE) {
+        fatal_error("Could not map large page to kernel VA.");
+    }
+    memset(thread_info->large_page_kernel_va, 0, PAGE_SIZE * PAGES_PER_LARGE_PAGE);
+    if (MapUserPhysicalPages(thread_info->large_page_kernel_va, PAGES_PER_LARGE_PAGE, NULL) == FALSE) {
+        fatal_error("Could not unmap large page from kernel VA.");
+    }
+
+    // Map the whole region in one call
+    PULONG_PTR region_va = get_VA_from_PDE(pde);
+    map_pages(PAGES_PER_LARGE_PAGE, region_va, frames);
+
+    // Each PFN still points at the PTE it would have, so the pages can be trimmed once the large page is split.
+    PPTE first_pte = PTE_base + (pde - PDE_base) * PTES_PER_PAGE_TABLE;
+    for (ULONG64 i = 0; i < PAGES_PER_LARGE_PAGE; i++) {
+        set_PFN_active(get_PFN_from_frame(first_frame + i), first_pte + i);
+    }
+
+    set_PDE_to_large_page_and_unlock(pde, first_frame);
+
+    // The trimmer finds large pages through the active bitmap, like anything else that is mapped.
+    for (ULONG64 i = 0; i < PAGES_PER_LARGE_PAGE; i += PTES_PER_PTE_BLOCK) {
+        mark_PTE_block_active(first_pte + i);
+    }
+
+    // Its pages start in the policies' first class, like any newly faulted page, and stay there once split.
+    InterlockedAdd64(&resident_class_counts[0], PAGES_PER_LARGE_PAGE);
+
+    // Update statistics
+    decrease_available_count(PAGES_PER_LARGE_PAGE);
+    add_to_counter(&stats.n_hard, 1);
+    InterlockedIncrement64(&stats.n_large_page_maps);
+
+    return TRUE;
+}
+#endif
+
+static BOOL handle_page_fault(PULONG_PTR faulting_va, PUSER_THREAD_INFO user_thread_info) {
 
     // When should the fault handler be allowed to fail? There are only two situations:
         // A - a hardware failure. This is beyond the scope of this program.
@@ -373,7 +599,18 @@ BOOL page_fault_handler(PULONG_PTR faulting_va, PUSER_THREAD_INFO user_thread_in
 
     // This is the PTE of our faulting VA. We will need him. But we will lock him as little
     // as possible, as there is a lot of locking of PTEs.
-    PPTE pte = get_PTE_from_VA(faulting_va);
+#if LARGE_PAGES
+    // A first touch in an untouched region tries to map the whole region at once.
+    if (try_map_large_page(faulting_va, user_thread_info)) {
+        SET_FAULT_OUTCOME(user_thread_info, FAULT_ZERO_FILL);
+        return TRUE;
+    }
+#endif
+
+    PPTE pte = get_or_create_PTE_from_VA(faulting_va);
+
+    // The VA is covered by a large page, so someone else has already mapped it.
+    if (pte == NULL) return TRUE;
 
     // This while loop is here to provide the mechanism for the fault-handler to try again.
     // This occurs when there are no pages available, and the fault handler has to wait
@@ -388,7 +625,7 @@ BOOL page_fault_handler(PULONG_PTR faulting_va, PUSER_THREAD_INFO user_thread_in
         // If the PTE is in transition, we should be able to locate its PFN!
         if (IS_PTE_TRANSITION(pte)) {
             // If we can resolve the soft fault, we are done!
-            if (resolve_soft_fault(pte)) return TRUE;
+            if (resolve_soft_fault(pte, user_thread_info)) return TRUE;
             // Otherwise, we have our edge case in which we fault on a pte
             // that was written out to disk (on a standby page grabbed by a hard fault).
             // In this case, we simply try again.
@@ -406,8 +643,42 @@ BOOL page_fault_handler(PULONG_PTR faulting_va, PUSER_THREAD_INFO user_thread_in
         //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~//
         if (resolve_hard_fault(pte, user_thread_info)) return TRUE;
 
+#if LARGE_PAGES
+        // The region may have been mapped as a large page in the meantime.
+        if (IS_PDE_LARGE(get_PDE_from_PTE(pte))) return TRUE;
+#endif
+
         // If we get here, then we were unable to conclusively resolve the fault.
         // No worries! We will go around and try again.
     }
     return TRUE;
 }
+
+BOOL page_fault_handler(PULONG_PTR faulting_va, PUSER_THREAD_INFO user_thread_info) {
+#if TRACK_FAULT_OUTCOMES
+    // Until we resolve it ourselves, we assume someone else will.
+    user_thread_info->fault_outcome = FAULT_RACED;
+    user_thread_info->fault_waited = FALSE;
+#endif
+    TRACE_BEGIN(TRACE_FAULT, 0);
+    COUNTERS_BEGIN();
+
+#if TIME_FAULTS
+    // Time every fault by its outcome. A fault we waited on counts as waited, however it was resolved.
+    ULONG64 start = get_cycle_count();
+    BOOL handled = handle_page_fault(faulting_va, user_thread_info);
+    ULONG64 end = get_cycle_count();
+#else
+    BOOL handled = handle_page_fault(faulting_va, user_thread_info);
+#endif
+
+#if TRACK_FAULT_OUTCOMES
+    ULONG outcome = user_thread_info->fault_waited ? FAULT_WAITED : user_thread_info->fault_outcome;
+#endif
+#if TIME_FAULTS
+    record_latency(&user_thread_info->fault_latencies[outcome], end - start);
+#endif
+    COUNTERS_END(COUNTER_PATH_FAULT + outcome, 1);
+    TRACE_END(TRACE_FAULT, outcome);
+    return handled;
+}
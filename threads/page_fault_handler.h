@@ -31,6 +31,14 @@ BOOL try_acquire_page_from_list(PPFN * available_page_address, PPAGE_LIST list);
 VOID clear_disk_slot(ULONG64 disk_slot);
 
 /*
- *  Sets the given slot to occupied in the page file metadata.
+ *  Joins the queue of threads waiting for pages. Returns the page the writer handed us, unlocked, or NULL if we
+ *  should look for pages again ourselves (some went to standby while we were joining, or we timed out).
  */
-VOID set_disk_slot(UINT64 disk_slot);
\ No newline at end of file
+PPFN wait_for_page_handoff(PUSER_THREAD_INFO thread_info);
+
+/*
+ *  Direct reclaim: when there are no free or standby pages, the faulting thread writes a few modified pages
+ *  to disk itself (trimming a few first, if none are modified) and puts them in its free page cache.
+ *  Returns FALSE if it could not reclaim any, in which case the thread waits for the trimmer and writer.
+ */
+BOOL direct_reclaim_to_cache(PUSER_THREAD_INFO thread_info);
\ No newline at end of file
@@ -0,0 +1,86 @@
+#include "pressure.h"
+
+#if PRESSURE_STALL_INFO
+__declspec(thread) volatile LONG *thread_stall_depth;
+
+typedef struct __pressure_bucket {
+    double stalled[PRESSURE_KINDS];
+    double total;
+} PRESSURE_BUCKET, *PPRESSURE_BUCKET;
+
+static const ULONG pressure_window_buckets[PRESSURE_WINDOWS] = {
+    [PRESSURE_WINDOW_1S]    = 1000 / PRESSURE_BUCKET_IN_MILLISECONDS,
+    [PRESSURE_WINDOW_10S]   = 10000 / PRESSURE_BUCKET_IN_MILLISECONDS,
+    [PRESSURE_WINDOW_60S]   = 60000 / PRESSURE_BUCKET_IN_MILLISECONDS,
+};
+
+// Only the scheduler reads and writes our buckets.
+static PRESSURE_BUCKET pressure_buckets[PRESSURE_BUCKETS];
+static ULONG64 current_bucket;
+static PRESSURE_BUCKET run_pressure;
+
+static volatile LONG running_user_threads;
+
+VOID begin_stall_accounting(PUSER_THREAD_INFO thread_info) {
+    thread_info->stall_depth = 0;
+    thread_stall_depth = &thread_info->stall_depth;
+    InterlockedIncrement(&running_user_threads);
+}
+
+VOID end_stall_accounting(PUSER_THREAD_INFO thread_info) {
+    InterlockedDecrement(&running_user_threads);
+    thread_stall_depth = NULL;
+}
+
+VOID sample_pressure(double elapsed) {
+    LONG running = ReadNoFence(&running_user_threads);
+    if (running == 0) return;
+
+    LONG stalled = 0;
+    for (ULONG i = 0; i < vm.num_user_threads; i++) {
+        if (ReadNoFence(&user_thread_info[i].stall_depth) > 0) stalled++;
+    }
+
+    PPRESSURE_BUCKET bucket = &pressure_buckets[current_bucket % PRESSURE_BUCKETS];
+    if (stalled > 0) bucket->stalled[PRESSURE_SOME] += elapsed;
+    if (stalled >= running) bucket->stalled[PRESSURE_ALL] += elapsed;
+    bucket->total += elapsed;
+
+    if (stalled > 0) run_pressure.stalled[PRESSURE_SOME] += elapsed;
+    if (stalled >= running) run_pressure.stalled[PRESSURE_ALL] += elapsed;
+    run_pressure.total += elapsed;
+
+    // Once a bucket is full, we start the next -- which drops the oldest bucket out of our 60 second window.
+    if (bucket->total * 1000 >= PRESSURE_BUCKET_IN_MILLISECONDS) {
+        current_bucket++;
+        memset(&pressure_buckets[current_bucket % PRESSURE_BUCKETS], 0, sizeof(PRESSURE_BUCKET));
+    }
+}
+
+double get_pressure(ULONG kind, ULONG window) {
+    ULONG buckets = (ULONG) min(pressure_window_buckets[window], current_bucket + 1);
+
+    // The window includes the bucket we are filling now, so it is never empty for long.
+    double stalled = 0;
+    double total = 0;
+    for (ULONG i = 0; i < buckets; i++) {
+        PPRESSURE_BUCKET bucket = &pressure_buckets[(current_bucket - i) % PRESSURE_BUCKETS];
+        stalled += bucket->stalled[kind];
+        total += bucket->total;
+    }
+    return total > 0 ? stalled / total : 0;
+}
+
+VOID print_pressure(VOID) {
+    const char *kinds[PRESSURE_KINDS] = {"some", "all"};
+
+    printf("PRESSURE:");
+    for (ULONG kind = 0; kind < PRESSURE_KINDS; kind++) {
+        double run = run_pressure.total > 0 ? run_pressure.stalled[kind] / run_pressure.total : 0;
+        printf("\t%s 1s %.2f%%  10s %.2f%%  60s %.2f%%  run %.2f%%", kinds[kind],
+            100 * get_pressure(kind, PRESSURE_WINDOW_1S), 100 * get_pressure(kind, PRESSURE_WINDOW_10S),
+            100 * get_pressure(kind, PRESSURE_WINDOW_60S), 100 * run);
+    }
+    printf("\n");
+}
+#endif
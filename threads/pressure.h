@@ -0,0 +1,69 @@
+#pragma once
+#include "threads.h"
+
+/*
+ *  Pressure stall information: the share of wall time in which SOME of our user threads were stalled --
+ *  waiting for a page, throttled below min, reclaiming pages themselves, or spinning (or blocked) on a
+ *  contended lock -- and the share in which ALL of them were. Unlike our wait_time total, this tells a
+ *  sustained squeeze from one spike.
+ *
+ *  A user thread brackets each stall with STALL_BEGIN() and STALL_END(), which only touch a counter of
+ *  its own. Every tick, the scheduler looks at every running user thread, and adds the tick to the
+ *  current PRESSURE_BUCKET_IN_MILLISECONDS bucket as some, all or neither. The buckets give us sampled
+ *  sliding windows of the last 1, 10 and 60 seconds: a stall shorter than a tick may be missed, or counted
+ *  as the whole tick.
+ *
+ *  The scheduler looks further ahead under pressure (see schedule_reclaim), and the averages are
+ *  published with our live stats. Stall markers in worker threads are ignored.
+ */
+#define PRESSURE_BUCKET_IN_MILLISECONDS     100
+#define PRESSURE_BUCKETS                    600     // 60 seconds of buckets
+
+// What we measure
+#define PRESSURE_SOME                       0
+#define PRESSURE_ALL                        1
+#define PRESSURE_KINDS                      2
+
+// Our windows
+#define PRESSURE_WINDOW_1S                  0
+#define PRESSURE_WINDOW_10S                 1
+#define PRESSURE_WINDOW_60S                 2
+#define PRESSURE_WINDOWS                    3
+
+// Under pressure, the scheduler sizes reclaim for a horizon this much longer, per unit of some-pressure
+// over the last second. At 25% stalled, it looks twice as far ahead.
+#define PRESSURE_HORIZON_GAIN               4.0
+
+#if PRESSURE_STALL_INFO
+// This user thread's stall depth, or NULL in any other thread.
+extern __declspec(thread) volatile LONG *thread_stall_depth;
+
+#define STALL_BEGIN()       do { if (thread_stall_depth != NULL) (*thread_stall_depth)++; } while (0)
+#define STALL_END()         do { if (thread_stall_depth != NULL) (*thread_stall_depth)--; } while (0)
+#else
+#define STALL_BEGIN()       ((void) 0)
+#define STALL_END()         ((void) 0)
+#endif
+
+#if PRESSURE_STALL_INFO
+/*
+ *  Called by each user thread as it starts and finishes. Only running threads count toward ALL.
+ */
+VOID begin_stall_accounting(PUSER_THREAD_INFO thread_info);
+VOID end_stall_accounting(PUSER_THREAD_INFO thread_info);
+
+/*
+ *  Called by the scheduler every tick: adds the seconds since its last tick to the current bucket.
+ */
+VOID sample_pressure(double elapsed);
+
+/*
+ *  Returns the share of the window (0 to 1) in which some, or all, user threads were stalled.
+ */
+double get_pressure(ULONG kind, ULONG window);
+
+/*
+ *  Prints every window, and the whole run, for some and all.
+ */
+VOID print_pressure(VOID);
+#endif
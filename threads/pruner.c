@@ -3,6 +3,8 @@
 //
 
 #include "pruner.h"
+#include "../utils/trace.h"
+#include "../utils/probes.h"
 
 void clear_free_list_bit(ULONG index) {
     BOOL original_value = InterlockedBitTestAndReset64(&free_lists.low_list_bitmap, index);
@@ -20,11 +22,8 @@ ULONG64 prune_pages(VOID) {
                                                     &first_pfn,
                                                     MAX_PRUNE_BATCH_SIZE);
 
-    // Using recent consumption, decide if we need to signal the writer to bring in more standby pages!
-    signal_event_if_list_is_about_to_run_low(   &standby_list,
-                                                initiate_writing_event,
-                                                WRITING_THREAD_ID,
-                                                LOW_PAGE_THRESHOLD);
+    // If we have fallen below our low watermark, start reclaiming more.
+    wake_reclaim_if_below_low();
 
     if (batch_size == 0) return 0;
 
@@ -59,7 +58,9 @@ ULONG64 prune_pages(VOID) {
             clear_free_list_bit(i);
         }
     }
-    if (num_lists_to_fill == 0) return 0;
+    // Our pages are already off the standby list, so they must go somewhere. If no list is marked low,
+    // they go to the first list.
+    if (num_lists_to_fill == 0) free_lists_to_fill[num_lists_to_fill++] = 0;
     ULONG small_batch = batch_size / num_lists_to_fill;
 
     PPFN first_page_in_batch = first_pfn;
@@ -95,6 +96,7 @@ ULONG64 prune_pages(VOID) {
 
         // Update statistics
         change_list_size(target_free_list, this_batch_size);
+        PROBE_LIST_BATCH(LIST_ID_FIRST_FREE + list_index, PROBE_LIST_INSERT, this_batch_size);
     }
 
     // Update total free page count (but don't change available count, since pages moved from standby -> free).
@@ -112,28 +114,31 @@ VOID prune_pages_thread(void) {
     HANDLE events[2];
     events[ACTIVE_EVENT_INDEX] = initiate_pruning_event;
     events[EXIT_EVENT_INDEX] = system_exit_event;
+    TRACE_THREAD_NAME("pruner", 0);
 
     while (TRUE) {
 
+        TRACE_BEGIN(TRACE_WAIT, TRACE_WAIT_WORK);
         if (WaitForMultipleObjects(ARRAYSIZE(events), events, FALSE, INFINITE)
             == EXIT_EVENT_INDEX) return;
+        TRACE_END(TRACE_WAIT, TRACE_WAIT_WORK);
 
         LONGLONG start_time = get_timestamp();
 
         // Before removing pages from the standby list, we should check to see if
-        // the writer needs to start up again to replenish what we are going to take.
-        signal_event_if_list_is_about_to_run_low(   &standby_list,
-                                                    initiate_writing_event,
-                                                    WRITING_THREAD_ID,
-                                                    LOW_PAGE_THRESHOLD);
+        // reclaim needs to start up again to replenish what we are going to take.
+        wake_reclaim_if_below_low();
 
         // Once woken, begin writing a batch of pages. Then go back to sleep.
+        TRACE_BEGIN(TRACE_PRUNE_BATCH, 0);
         ULONG64 batch_size = prune_pages();
+        TRACE_END(TRACE_PRUNE_BATCH, (ULONG) batch_size);
 
         // Record the runtime to update future estimates
         LONGLONG end_time = get_timestamp();
         double difference = get_time_difference(end_time, start_time);
         update_estimated_job_time(PRUNING_THREAD_ID, difference);
+        InterlockedAdd64(&stats.prune_time, end_time - start_time);
 
 #if STATS_MODE
         record_batch_size_and_time(difference, batch_size, PRUNING_THREAD_ID);
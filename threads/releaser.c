@@ -9,10 +9,26 @@ void free_lock(PCRITICAL_SECTION lock) {
 }
 
 void unmap_all_pages(void) {
-    for (PPTE pte = PTE_base; pte < PTE_base + vm.num_ptes; pte++) {
-        if (pte->disk_format.valid) {
-            PULONG_PTR va = get_VA_from_PTE(pte);
-            unmap_pages(1, va);
+    for (ULONG64 i = 0; i < vm.num_page_tables; i++) {
+
+#if LARGE_PAGES
+        // A large page is unmapped as a unit.
+        if (IS_PDE_LARGE(&PDE_base[i])) {
+            unmap_pages(PAGES_PER_LARGE_PAGE, get_VA_from_PDE(&PDE_base[i]));
+            continue;
+        }
+#endif
+
+        // Absent page tables have nothing mapped (and no memory behind them to read).
+        if (!IS_PDE_PRESENT(&PDE_base[i])) continue;
+
+        PPTE first = PTE_base + i * PTES_PER_PAGE_TABLE;
+        PPTE last = min(first + PTES_PER_PAGE_TABLE, PTE_base + vm.num_ptes);
+        for (PPTE pte = first; pte < last; pte++) {
+            if (pte->disk_format.valid) {
+                PULONG_PTR va = get_VA_from_PTE(pte);
+                unmap_pages(1, va);
+            }
         }
     }
 }
@@ -44,10 +60,16 @@ void free_events(void) {
     free(user_thread_ids);
 
     CloseHandle(system_start_event);
-    CloseHandle(standby_pages_ready_event);
+    for (ULONG i = 0; i < vm.num_user_threads; i++) {
+        CloseHandle(user_thread_info[i].page_waiter.page_ready_event);
+    }
     CloseHandle(initiate_aging_event);
     CloseHandle(initiate_trimming_event);
+    for (ULONG i = 0; i < NUM_TRIMMER_THREADS; i++) {
+        if (i != LEAD_TRIMMER) CloseHandle(trimmer_wake_events[i]);
+    }
     CloseHandle(initiate_writing_event);
+    CloseHandle(above_min_watermark_event);
 }
 
 void free_VA_space_data(void) {
@@ -57,6 +79,12 @@ void free_VA_space_data(void) {
 
     for (ULONG i = 0; i < vm.num_user_threads; i++) {
         VirtualFree(user_thread_info[i].kernel_va_space,0, MEM_RELEASE);
+#if LARGE_PAGES
+        VirtualFree(user_thread_info[i].large_page_kernel_va, 0, MEM_RELEASE);
+#endif
+#if DIRECT_RECLAIM
+        VirtualFree(user_thread_info[i].direct_reclaim_kernel_va, 0, MEM_RELEASE);
+#endif
     }
 }
 
@@ -71,5 +99,7 @@ void free_page_file_data(void) {
 }
 
 void free_PTE_data(void) {
-    free(PTE_base);
+    VirtualFree(PTE_base, 0, MEM_RELEASE);
+    free(PDE_base);
+    free((PVOID) active_pte_bitmap);
 }
\ No newline at end of file
@@ -6,6 +6,7 @@
 #include "../data_structures/disk.h"
 #include "../data_structures/pfn.h"
 #include "threads.h"
+#include "watermarks.h"
 
 #pragma once
 
@@ -3,19 +3,36 @@
 //
 
 #include "scheduler.h"
+#include "ager.h"
+#include "../utils/trace.h"
+#include "live_stats.h"
+#include "time_series.h"
+#include "pressure.h"
 
-consumption_buffer consumption_rates;
+#if STATS_MODE
+// The consumption rate at each report interval, for print_consumption_data.
+static double consumption_rate_sum;
+static double highest_consumption_rate;
+static ULONG64 consumption_samples;
+#endif
 
 VOID print_statistics(VOID) {
 
     ULONG64 allocated_frame_count = vm.allocated_frame_count;
+    ULONG64 free_count = read_counter_exact(stats.n_free);
+    ULONG64 hard_count = read_counter_exact(&stats.n_hard);
+    ULONG64 soft_count = read_counter_exact(&stats.n_soft);
 
     ULONG64 active_page_count = vm.allocated_frame_count -
-        (*stats.n_free + *stats.n_modified + *stats.n_standby);
+        (free_count + *stats.n_modified + *stats.n_standby);
+#if LARGE_PAGES
+    // Pages held in the large page pool are free, but on no list.
+    active_page_count -= large_page_pool.page_count;
+#endif
 
     printf("\n");
     printf("FREE:\t\t%llu\t\t%.2f%%\n",
-        *stats.n_free, 100.0 * (double) *stats.n_free / (double) allocated_frame_count);
+        free_count, 100.0 * (double) free_count / (double) allocated_frame_count);
     printf("ACTIVE:\t\t%llu\t\t%.2f%%\n",
         active_page_count, 100.0 * (double) active_page_count / (double) allocated_frame_count);
     printf("MODIFIED:\t%llu\t\t%.2f%%\n",
@@ -24,42 +41,119 @@ VOID print_statistics(VOID) {
         *stats.n_standby, 100.0 * (double) *stats.n_standby / (double) allocated_frame_count);
     printf("\nEMPTY DISK SLOTS:\t%lld\n", pf.empty_disk_slots);
     printf("\nHARD:\t\t%llu\t\t%.2f%%\n",
-        stats.n_hard, 100.0 * (double) stats.n_hard / (double) (stats.n_hard + stats.n_soft));
+        hard_count, 100.0 * (double) hard_count / (double) (hard_count + soft_count));
     printf("SOFT:\t\t%llu\t\t%.2f%%\n",
-        stats.n_soft, 100.0 * (double) stats.n_soft / (double) (stats.n_hard + stats.n_soft));
+        soft_count, 100.0 * (double) soft_count / (double) (hard_count + soft_count));
+    print_policy_classes();
     printf("\nTotal time user threads spent waiting: %.3f s\n",
                     (double) stats.wait_time / (double) stats.timer_frequency);
-    printf("\nTotal hard fault misses: %llu\n", stats.hard_faults_missed);
+    printf("\nTotal waits for a page: %llu (%llu retried without one)\n", stats.n_page_waits, stats.hard_faults_missed);
+    printf("WATERMARKS:\tmin %lld\tlow %lld\thigh %lld\t(%s)\n",
+        watermarks.min, watermarks.low, watermarks.high, reclaim_active ? "reclaiming" : "idle");
+    printf("THROTTLED:\t%llu faults, %.3f s\n",
+        stats.n_throttled, (double) stats.throttle_time / (double) stats.timer_frequency);
+    print_tunables();
+#if LATENCY_SLO
+    print_latency_slo_status();
+#endif
+#if PRESSURE_STALL_INFO
+    print_pressure();
+#endif
+    printf("DEMAND (pages/s):\tfree %.0f\tstandby %.0f\tmodified %.0f\n",
+        demand_forecasts[DEMAND_FREE].level, demand_forecasts[DEMAND_STANDBY].level,
+        demand_forecasts[DEMAND_MODIFIED].level);
+#if AGING
+    printf("\nAGE (sweeps idle):");
+    for (ULONG i = 0; i < PTE_AGE_CLASSES; i++) printf(" %lld", age_histogram[i]);
+    printf("\n");
+#endif
+#if LARGE_PAGES
+    printf("\nLARGE PAGE RUNS:\t%lld\n", large_page_pool.run_count);
+    printf("LARGE PAGES MAPPED:\t%llu\n", stats.n_large_page_maps);
+    printf("LARGE PAGES SPLIT:\t%llu\n", stats.n_large_page_splits);
+#endif
 }
 
-VOID add_consumption_data(double rate, ULONG64 pages_available) {
-    ULONG64 i = consumption_rates.head % NUMBER_OF_SAMPLES;
-    consumption_rates.data[i].consumption_rate = (ULONG64) rate;
-    consumption_rates.data[i].pages_available = pages_available;
-    consumption_rates.head++;
+/*
+ *  Sums the pages each user thread has taken from each list so far.
+ */
+static VOID count_pages_taken(ULONG64 pages_taken[DEMAND_LISTS]) {
+    memset(pages_taken, 0, DEMAND_LISTS * sizeof(ULONG64));
+    for (ULONG i = 0; i < vm.num_user_threads; i++) {
+        for (ULONG list = 0; list < DEMAND_LISTS; list++) {
+            pages_taken[list] += ReadNoFence64((volatile LONG64 *) &user_thread_info[i].pages_taken[list]);
+        }
+    }
+}
+
+/*
+ *  Wakes the writer and the trimmers ahead of the shortfall we predict over the time it takes them to
+ *  trim and write one batch, and sizes their batches to cover it.
+ */
+static VOID schedule_reclaim(double tick_in_seconds) {
+    double horizon = (stats.worker_runtimes[TRIMMING_THREAD_ID] + stats.worker_runtimes[WRITING_THREAD_ID]) *
+                     reclaim_aggressiveness + tick_in_seconds;
+#if PRESSURE_STALL_INFO
+    // While our user threads are stalling, we get further ahead of them.
+    horizon *= 1 + PRESSURE_HORIZON_GAIN * get_pressure(PRESSURE_SOME, PRESSURE_WINDOW_1S);
+#endif
+
+    double available_demand = forecast_pages(&demand_forecasts[DEMAND_FREE], horizon, tick_in_seconds) +
+                              forecast_pages(&demand_forecasts[DEMAND_STANDBY], horizon, tick_in_seconds);
+    double modified_demand = forecast_pages(&demand_forecasts[DEMAND_MODIFIED], horizon, tick_in_seconds);
+
+    // If what we expect to have left at the end of our horizon is below low, write enough to cover the difference.
+    // We run every tick, so we read our available pages as the watermarks do: exactly only when the call
+    // is close, and otherwise from the shared total alone. The shortfall is approximate, as a target may be.
+    LONG64 needed = ReadNoFence64(&watermarks.low) + (LONG64) available_demand;
+    LONG64 write_shortfall = is_counter_below(&stats.n_available, needed) ?
+                             max(1, needed - read_counter_approximate(&stats.n_available)) : 0;
+    if (write_shortfall <= 0) {
+        reset_write_batch_target();
+        reset_trim_batch_target();
+        return;
+    }
+
+    set_write_batch_target((ULONG64) write_shortfall);
+    SetEvent(initiate_writing_event);
+
+    // The writer can only write what is on the modified list, less whatever soft faults take back first.
+    // Trim enough to make up the rest, split between the trimmers that are running.
+    LONG64 trim_shortfall = write_shortfall + (LONG64) modified_demand - (LONG64) *stats.n_modified;
+    if (trim_shortfall <= 0) {
+        reset_trim_batch_target();
+        return;
+    }
+
+    set_trim_batch_target((ULONG64) trim_shortfall / (ULONG64) ReadNoFence(&active_trimmer_count));
+    SetEvent(initiate_trimming_event);
 }
 
 VOID schedule_tasks(VOID) {
     DWORD status;
     LONGLONG previous_timestamp;
     LONGLONG current_timestamp = get_timestamp();
-    ULONG64 previous_hard_fault_count = 0;
-    ULONG64 current_hard_fault_count = 0;
-    double consumption_rate;
-    memset(&consumption_rates, 0, sizeof(consumption_data) * NUMBER_OF_SAMPLES);
+    LONGLONG last_report_timestamp = current_timestamp;
+    LONGLONG last_live_stats_timestamp = current_timestamp;
+    ULONG64 previous_pages_taken[DEMAND_LISTS] = {0};
+    ULONG64 current_pages_taken[DEMAND_LISTS];
 
     WaitForSingleObject(system_start_event, INFINITE);
+    TRACE_THREAD_NAME("scheduler", 0);
+
+    // Ask for a finer timer resolution, so our ticks are as short as we ask them to be.
+    timeBeginPeriod(SCHEDULER_TIMER_RESOLUTION_IN_MILLISECONDS);
+#if PUBLISH_LIVE_STATS
+    create_live_stats();
+#endif
+#if TIME_SERIES
+    initialize_time_series();
+#endif
 
     while (TRUE) {
 
         // Update statistics for next iteration
         previous_timestamp = current_timestamp;
-        previous_hard_fault_count = current_hard_fault_count;
-
-        // Print the statistics to the log, if necessary
-#if LOGGING_MODE
-        print_statistics();
-#endif
 
         // Wait for a set amount of time before scheduling again.
         // Of course, if the system exit event is received, we will immediately break out of the thread.
@@ -71,42 +165,101 @@ VOID schedule_tasks(VOID) {
         // Get data for this iteration
         current_timestamp = get_timestamp();
         double elapsed = get_time_difference(current_timestamp, previous_timestamp);
-        current_hard_fault_count = stats.n_hard;
-
-        // ************************************************
-        // * Log the consumption rate.
-        // * Consumption rate is measured in faults / sec *
-        // ************************************************
-        consumption_rate = stats.page_consumption_per_second;
-        if (current_hard_fault_count > previous_hard_fault_count)
-            consumption_rate = (double) (current_hard_fault_count - previous_hard_fault_count) / elapsed;
+        if (elapsed <= 0) continue;
+
+#if PRESSURE_STALL_INFO
+        // See how many of our user threads were stalled this tick.
+        sample_pressure(elapsed);
+#endif
+
+        // ***************************************************
+        // * Forecast demand on each list.                   *
+        // * Demand is measured in pages taken / sec         *
+        // ***************************************************
+        count_pages_taken(current_pages_taken);
+        for (ULONG list = 0; list < DEMAND_LISTS; list++) {
+            double rate = (double) (current_pages_taken[list] - previous_pages_taken[list]) / elapsed;
+            update_forecast(&demand_forecasts[list], rate);
+            previous_pages_taken[list] = current_pages_taken[list];
+        }
+
+        // Pages we consume are those taken from the free and standby lists.
+        double consumption_rate = max(0, demand_forecasts[DEMAND_FREE].level + demand_forecasts[DEMAND_STANDBY].level);
         stats.page_consumption_per_second = consumption_rate;
 
-#if STATS_MODE
-        add_consumption_data(consumption_rate, current_hard_fault_count);
+        // Run enough trimmers to keep up with consumption, and move our watermarks to match it.
+        scale_active_trimmers(consumption_rate);
+        update_watermarks(consumption_rate);
+
+        // Reclaim keeps itself going until we are back above high, but we give a running reclaim another
+        // push in case a trimmer is between batches. Otherwise, we start it if we are below low, and get
+        // ahead of any shortfall we see coming.
+        if (reclaim_active) {
+            SetEvent(initiate_trimming_event);
+            SetEvent(initiate_writing_event);
+        } else {
+            wake_reclaim_if_below_low();
+            schedule_reclaim(elapsed);
+        }
+
+#if TIME_SERIES
+        record_time_series(current_timestamp);
 #endif
-    }
-}
 
-VOID print_consumption_data(VOID) {
-    ULONG64 count = min(NUMBER_OF_CONSUMPTION_SAMPLES, consumption_rates.head);
+#if PUBLISH_LIVE_STATS
+        double live_stats_elapsed = get_time_difference(current_timestamp, last_live_stats_timestamp);
+        if (live_stats_elapsed * 1000 >= LIVE_STATS_INTERVAL_IN_MILLISECONDS) {
+            publish_live_stats(live_stats_elapsed);
+            last_live_stats_timestamp = current_timestamp;
+        }
+#endif
 
-    ULONG64 total_rate_sum = 0;
-    double largest_rate = 0;
+        double report_elapsed = get_time_difference(current_timestamp, last_report_timestamp);
+        if (report_elapsed * 1000 < SCHEDULER_REPORT_INTERVAL_IN_MILLISECONDS) continue;
+        last_report_timestamp = current_timestamp;
 
-    for (int i = 0; i < count; ++i) {
-        ULONG64 rate = consumption_rates.data[i].consumption_rate;
-        total_rate_sum += rate;
-        largest_rate = max(rate, largest_rate);
+        // Print the statistics to the log, if necessary
+#if LOGGING_MODE
+        print_statistics();
+#endif
 
-        printf("Consumption rate for timestep %d:\t%llu MB/s\n", i,
-                rate * PAGE_SIZE / MB(1));
+#if AGING
+        // Age every active page once per interval, if our policy uses ages. The trimmer also asks for a sweep when it comes up short.
+        if (replacement_policy->uses_ager) SetEvent(initiate_aging_event);
+#endif
+
+#if LATENCY_SLO
+        // Measure our tail latency and adjust how hard we reclaim to hold it.
+        update_latency_slo(report_elapsed);
+#endif
+
+#if AUTO_TUNING
+        // Score the interval just ended, and try our next batch sizes.
+        tune_batch_sizes(report_elapsed);
+#endif
+
+#if STATS_MODE
+        consumption_rate_sum += consumption_rate;
+        highest_consumption_rate = max(highest_consumption_rate, consumption_rate);
+        consumption_samples++;
+#endif
     }
-    double average_rate = (double) total_rate_sum / (double) count;
+
+#if PUBLISH_LIVE_STATS
+    // One last update with our final counts, so readers see where the run ended.
+    publish_live_stats(get_time_difference(get_timestamp(), last_live_stats_timestamp));
+    close_live_stats();
+#endif
+    timeEndPeriod(SCHEDULER_TIMER_RESOLUTION_IN_MILLISECONDS);
+}
+
+#if STATS_MODE
+VOID print_consumption_data(VOID) {
+    double average_rate = consumption_samples ? consumption_rate_sum / (double) consumption_samples : 0;
 
     printf("~~~~~~~~~~~~~~~~~~~~~\n");
     printf("\nAverage rate: %.3f MB/s\n", average_rate * PAGE_SIZE / MB(1));
-    printf("Highest rate: %.3f MB/s\n", largest_rate * PAGE_SIZE / MB(1));
+    printf("Highest rate: %.3f MB/s\n", highest_consumption_rate * PAGE_SIZE / MB(1));
     printf("~~~~~~~~~~~~~~~~~~~~~\n");
-
-}
\ No newline at end of file
+}
+#endif
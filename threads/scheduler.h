@@ -11,24 +11,23 @@
 */
 
 #pragma once
+#pragma comment(lib, "winmm.lib")
+
+#include <timeapi.h>
 #include "../data_structures/disk.h"
+#include "../data_structures/page_list.h"
 #include "threads.h"
+#include "forecast.h"
 
-#define SCHEDULER_DELAY_IN_MILLISECONDS         500
-
-#define NUMBER_OF_CONSUMPTION_SAMPLES       512
-
-typedef struct {
-    ULONG64 consumption_rate;
-    ULONG64 pages_available;
-} consumption_data;
+// We sample demand and schedule reclaim every tick. Anything slower would let a burst drain our
+// available pages between two looks at it.
+#define SCHEDULER_DELAY_IN_MILLISECONDS         1
 
-typedef struct {
-    consumption_data data[NUMBER_OF_CONSUMPTION_SAMPLES];
-    ULONG64 head;
-} consumption_buffer;
+// The timer resolution we ask Windows for while we run, so a tick is not rounded up to the default 15.6 ms.
+#define SCHEDULER_TIMER_RESOLUTION_IN_MILLISECONDS      1
 
-extern consumption_buffer consumption_rates;
+// Logging, aging, latency SLO and tuning happen on this slower interval.
+#define SCHEDULER_REPORT_INTERVAL_IN_MILLISECONDS       500
 
 /*
  * Analyzes consumption, then calls ager, trimmer, and writer appropriately.
@@ -45,12 +44,9 @@ VOID update_statistics(VOID);
  */
 VOID print_statistics(VOID);
 
+#if STATS_MODE
 /*
- *  Updates consumption statistics
- */
-VOID add_consumption_data(double rate, ULONG64 pages_available);
-
-/*
-    Prints out data on the run's page consumption
+ *  Prints the average and highest rates of page consumption, sampled once per report interval.
  */
-VOID print_consumption_data(VOID);
\ No newline at end of file
+VOID print_consumption_data(VOID);
+#endif
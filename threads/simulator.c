@@ -3,6 +3,13 @@
 //
 
 #include "simulator.h"
+#include "../utils/phase_profiler.h"
+#include "../utils/trace.h"
+#include "../utils/probes.h"
+#include "../utils/cpu_counters.h"
+#include "time_series.h"
+#include "working_set.h"
+#include "pressure.h"
 
 void do_work_to_slow_consumption(void) {
     int WORK_TIME = 10;
@@ -13,10 +20,47 @@ void do_work_to_slow_consumption(void) {
     }
 }
 
+#if AGING
+/*
+ *  Marks the page of this VA as accessed, unless this thread has already done so in the current epoch
+ *  (and no pass has cleared accessed bits since).
+ *  A filter hit costs a read of one shared, rarely written variable and one line of our own thread info,
+ *  instead of a read of the PTE and a compare-exchange on its (shared) cache line.
+ */
+void mark_page_accessed(PULONG_PTR va, PUSER_THREAD_INFO user_thread_info) {
+
+    ULONG64 page_number = ((ULONG_PTR) va - (ULONG_PTR) vm.application_va_base) / PAGE_SIZE;
+    ACCESSED_FILTER_ENTRY *entry = &user_thread_info->accessed_filter[page_number & (ACCESSED_FILTER_SIZE - 1)];
+    LONG64 epoch = ReadNoFence64(&accessed_bit_epoch);
+
+    if (entry->page_number == page_number && entry->epoch == epoch) return;
+
+    replacement_policy->on_access(va);
+
+    // While a pass is clearing accessed bits, ours may be cleared right after we set it, so we do not remember it.
+    if (epoch & ACCESSED_BIT_PASSES_MASK) return;
+    entry->page_number = page_number;
+    entry->epoch = epoch;
+}
+
+/*
+ *  Forgets this VA's page, so the next access marks it again. We do this after every fault, since the page
+ *  may have been trimmed (and its accessed bit lost) while our filter entry was still current.
+ */
+void forget_page_accessed(PULONG_PTR va, PUSER_THREAD_INFO user_thread_info) {
+    ULONG64 page_number = ((ULONG_PTR) va - (ULONG_PTR) vm.application_va_base) / PAGE_SIZE;
+    user_thread_info->accessed_filter[page_number & (ACCESSED_FILTER_SIZE - 1)].epoch = -1;
+}
+#endif
+
 void run_user_app_simulation(PUSER_THREAD_INFO user_thread_info) {
 
     // Wait for system start event before beginning!
     WaitForSingleObject(system_start_event, INFINITE);
+    TRACE_THREAD_NAME("user", user_thread_info->thread_id);
+#if PRESSURE_STALL_INFO
+    begin_stall_accounting(user_thread_info);
+#endif
 
     // Adding variables only necessary to kick off fault handler!
     BOOL page_faulted = FALSE;
@@ -49,7 +93,7 @@ void run_user_app_simulation(PUSER_THREAD_INFO user_thread_info) {
             __try {
                 *arbitrary_va = (ULONG_PTR) arbitrary_va;
 #if AGING
-                set_accessed_bit(arbitrary_va);
+                mark_page_accessed(arbitrary_va, user_thread_info);
 #endif
                 // Simulating "doing something" before accessing next VA
 #if DO_WORK_TO_SLOW_CONSUMPTION
@@ -68,9 +112,15 @@ void run_user_app_simulation(PUSER_THREAD_INFO user_thread_info) {
                 if (!fault_handler_accessed_correctly){
                     fatal_error("User app attempted to access invalid VA.");
                 }
+#if AGING
+                forget_page_accessed(arbitrary_va, user_thread_info);
+#endif
             }
         } while (page_faulted);
     }
+#if PRESSURE_STALL_INFO
+    end_stall_accounting(user_thread_info);
+#endif
 }
 
 void begin_system_test(void) {
@@ -85,13 +135,22 @@ void begin_system_test(void) {
     analyze_and_print_statistics(TRIMMING_THREAD_ID);
     analyze_and_print_statistics(WRITING_THREAD_ID);
     print_consumption_data();
+#if LATENCY_SLO
+    print_latency_slo_reports();
+#endif
 #endif
 
     // Test is finished! Tell all threads to stop.
     SetEvent(system_exit_event);
 
-    WaitForSingleObject(trimming_thread, INFINITE);
+    WaitForMultipleObjects(NUM_TRIMMER_THREADS, trimming_threads, TRUE, INFINITE);
+#if AGING
+    WaitForSingleObject(aging_thread, INFINITE);
+#endif
     WaitForSingleObject(writing_thread, INFINITE);
+#if PRUNING
+    WaitForSingleObject(pruning_thread, INFINITE);
+#endif
 #if SCHEDULING
     WaitForSingleObject(scheduling_thread, INFINITE);
 #endif
@@ -100,28 +159,61 @@ void begin_system_test(void) {
 VOID main (int argc, char** argv) {
 
     set_defaults();
-    if (argc == 5) {
+    if (argc >= 5 && argc <= 7) {
         vm.num_user_threads = strtol(argv[1], NULL, 10);  // Base 10
         vm.iterations = strtol(argv[2], NULL, 10);
         vm.allocated_frame_count = strtol(argv[3], NULL, 10);
         vm.pages_in_page_file = strtol(argv[4], NULL, 10);
+        if (argc >= 6 && !select_replacement_policy(argv[5])) {
+            printf("Unknown replacement policy: %s\n", argv[5]);
+            print_replacement_policies();
+            return;
+        }
+#if AGING && WSS_SAMPLING
+        // Our samples and heatmap come from the ager's sweeps, which only run for policies that use them.
+        // Other policies clear accessed bits themselves, so a sweep of our own would disturb them.
+        if (!replacement_policy->uses_ager) {
+            printf("WSS_SAMPLING needs a policy that uses the ager (such as sweep), not %s.\n", replacement_policy->name);
+            return;
+        }
+#endif
+#if LATENCY_SLO
+        if (argc == 7) p99_target_in_microseconds = strtod(argv[6], NULL);
+        printf("Holding p99 fault latency to %.1f us.\n", p99_target_in_microseconds);
+#endif
         printf("Physical to Virtual ratio: %.1f%%.\n", 100 * (double) vm.allocated_frame_count / (double) VA_SPAN(vm.allocated_frame_count, vm.pages_in_page_file));
 #if STATS_MODE
         printf("%d user threads\n%llu iterations each\n%llu MB of memory (%llu pages)\n%llu MB in page file (%llu pages).\n",
             vm.num_user_threads, vm.iterations,
             vm.allocated_frame_count * PAGE_SIZE / MB(1), vm.allocated_frame_count,
             vm.pages_in_page_file * PAGE_SIZE / MB(1), vm.pages_in_page_file);
+        printf("Replacement policy: %s\n", replacement_policy->name);
         printf("~~~~~~~~~~~~~~~~~~~~~\n");
 #endif
     }
     else {
-        printf("Usage: MemoryManager [# user threads] [iterations per thread] [pages of memory] [pages on disk]\n");
+        printf("Usage: MemoryManager [# user threads] [iterations per thread] [pages of memory] [pages on disk] [replacement policy (optional)] [p99 fault latency target in us (optional)]\n");
+        print_replacement_policies();
         return;
     }
 
+    // Start from the batch sizes a tuning run settled on, if one saved any. We use them whether or not
+    // we tune this time.
+    if (load_tunables(TUNING_FILE_NAME)) printf("Loaded batch sizes from %s.\n", TUNING_FILE_NAME);
+
+#if STATE_PROBES
+    // Probes cost nothing until a trace session enables our provider.
+    register_probes();
+#endif
+
     // Initialize all data structures, events, threads, and handles. Get physical pages from OS.
     initialize_system();
 
+#if CPU_COUNTERS
+    // Our counters come from a trace session, which must be listening before the first fault.
+    start_cpu_counters();
+#endif
+
     // Set up a timer to evaluate speed
     LONGLONG start_time = get_timestamp();
 
@@ -133,11 +225,73 @@ VOID main (int argc, char** argv) {
     // Grab the time to evaluate speed
     LONGLONG end_time = get_timestamp();
 
+#if CPU_COUNTERS
+    // Every counted thread has stopped, so the session has all their events.
+    stop_cpu_counters();
+#endif
+
     // Get total runtime in seconds
     double runtime = get_time_difference(end_time, start_time);
 
     // Print statistics
     printf("Test successful. Time elapsed: " COLOR_GREEN "%.3f" COLOR_RESET " seconds.\n", runtime);
+    printf("Accesses per second: %.0f\n", (double) vm.iterations * vm.num_user_threads / runtime);
+    double trim_seconds = (double) stats.trim_time / (double) stats.timer_frequency;
+    printf("Pages trimmed per second: %.0f (%d trimmers, %.3f s trimming)\n",
+        (double) stats.n_trimmed / runtime, NUM_TRIMMER_THREADS, trim_seconds);
+    printf("Pages handed to waiting threads: %llu (%llu waits, %.3f s waited, %llu faults retried)\n",
+        stats.n_page_handoffs, stats.n_page_waits, (double) stats.wait_time / (double) stats.timer_frequency,
+        stats.hard_faults_missed);
+#if DIRECT_RECLAIM
+    // Each direct reclaim stands in for one wait. We estimate its length from the waits we did have.
+    double wait_seconds = (double) stats.wait_time / (double) stats.timer_frequency;
+    double average_wait = stats.n_page_waits ? wait_seconds / (double) stats.n_page_waits : 0;
+    printf("Direct reclaims: %llu (%.3f s reclaiming, ~%.3f s of waiting avoided; %.3f s still waited)\n",
+        stats.n_direct_reclaims, (double) stats.direct_reclaim_time / (double) stats.timer_frequency,
+        average_wait * (double) stats.n_direct_reclaims, wait_seconds);
+#endif
+#if FAULT_HISTOGRAMS
+    print_fault_latencies();
+#if FAULT_LATENCY_CSV
+    write_fault_latency_csv(FAULT_LATENCY_CSV_FILE_NAME);
+#endif
+#endif
+#if LATENCY_SLO
+    print_latency_slo_summary();
+#endif
+#if PHASE_PROFILING
+    print_phase_profile();
+#endif
+#if LOCK_PROFILING
+    print_lock_profile();
+#endif
+#if PRESSURE_STALL_INFO
+    print_pressure();
+#endif
+#if TIME_SERIES
+    print_time_series_summary();
+#if TIME_SERIES_BINARY
+    write_time_series_binary(TIME_SERIES_BINARY_FILE_NAME);
+#else
+    write_time_series_csv(TIME_SERIES_FILE_NAME);
+#endif
+#endif
+#if AGING && WSS_SAMPLING
+    print_working_set();
+    write_heatmap_csv(WSS_HEATMAP_FILE_NAME);
+#endif
+#if CPU_COUNTERS
+    print_cpu_counters();
+#endif
+#if EVENT_TRACING
+    // Every traced thread has stopped, so we can read their rings.
+    write_trace_json(TRACE_FILE_NAME);
+#endif
+#if AUTO_TUNING
+    // Save where we ended up for the next run.
+    save_tunables(TUNING_FILE_NAME);
+    print_tunables();
+#endif
 #if STATS_MODE
     printf ("Each of %lu threads accessed %llu VAs.\n", vm.num_user_threads, vm.iterations);
     print_statistics();
@@ -146,6 +300,9 @@ VOID main (int argc, char** argv) {
 
 #if 0
     ASSERT(FALSE);
+#endif
+#if STATE_PROBES
+    unregister_probes();
 #endif
     // Free all memory and end the simulation.
     free_all_data_and_shut_down();
@@ -10,14 +10,24 @@ HANDLE initiate_aging_event;
 HANDLE initiate_trimming_event;
 HANDLE initiate_writing_event;
 HANDLE initiate_pruning_event;
-HANDLE standby_pages_ready_event;
 HANDLE system_exit_event;
+HANDLE trimmer_wake_events[NUM_TRIMMER_THREADS];
+
+const char *fault_outcome_names[FAULT_OUTCOMES] = {
+    [FAULT_SOFT_MODIFIED]   = "soft (modified)",
+    [FAULT_SOFT_STANDBY]    = "soft (standby)",
+    [FAULT_SOFT_IN_FLIGHT]  = "soft (mid-write or mid-trim)",
+    [FAULT_HARD_DISK]       = "hard (disk)",
+    [FAULT_ZERO_FILL]       = "zero-fill",
+    [FAULT_WAITED]          = "waited",
+    [FAULT_RACED]           = "raced",
+};
 
 // Thread handles
 PHANDLE user_threads;
 HANDLE scheduling_thread;
 HANDLE aging_thread;
-HANDLE trimming_thread;
+HANDLE trimming_threads[NUM_TRIMMER_THREADS];
 HANDLE writing_thread;
 HANDLE pruning_thread;
 HANDLE debug_thread;
@@ -25,6 +35,7 @@ HANDLE debug_thread;
 // Thread IDs
 PULONG user_thread_ids;
 PULONG worker_thread_ids;
+ULONG trimmer_thread_ids[NUM_TRIMMER_THREADS];
 ULONG aging_thread_id = 3;
 ULONG scheduling_thread_id = 4;
 
@@ -5,6 +5,8 @@
 #pragma once
 
 #include "../utils/config.h"
+#include "../utils/tuner.h"
+#include "../data_structures/histogram.h"
 
 // Thread IDs
 #define TRIMMING_THREAD_ID      0
@@ -13,6 +15,9 @@
 #define SCHEDULING_THREAD_ID    3
 #define AGING_THREAD_ID         4
 
+// The lead trimmer waits on the trimming event, and wakes the others as it needs them.
+#define LEAD_TRIMMER            0
+
 // Thread information
 #define DEFAULT_SECURITY                ((LPSECURITY_ATTRIBUTES) NULL)
 #define DEFAULT_STACK_SIZE              0
@@ -25,8 +30,44 @@
 
 #define NUM_KERNEL_READ_ADDRESSES       (16)
 
-// The size of each user thread's free page cache
-#define FREE_PAGE_CACHE_SIZE            64
+// The capacity of each user thread's free page cache, and how much of it we use unless tuned otherwise
+#define FREE_PAGE_CACHE_SIZE            256
+#define DEFAULT_FREE_PAGE_CACHE_SIZE    64
+
+// The number of entries in each user thread's filter of recently accessed pages (a power of two)
+#define ACCESSED_FILTER_SIZE            64
+
+// One entry in the accessed filter: this page's accessed bit was set (or seen set) in this epoch.
+typedef struct {
+    ULONG64 page_number;
+    LONG64 epoch;
+} ACCESSED_FILTER_ENTRY;
+
+// The lists a user thread takes pages from. Each thread counts the pages it takes from each,
+// and the scheduler forecasts demand on each list from the totals.
+#define DEMAND_FREE                     0
+#define DEMAND_STANDBY                  1
+#define DEMAND_MODIFIED                 2
+#define DEMAND_LISTS                    3
+
+// How a fault was resolved. We time each outcome separately (see fault_latency.h).
+#define FAULT_SOFT_MODIFIED             0
+#define FAULT_SOFT_STANDBY              1
+#define FAULT_SOFT_IN_FLIGHT            2       // The page was mid-write or mid-trim
+#define FAULT_HARD_DISK                 3
+#define FAULT_ZERO_FILL                 4
+#define FAULT_WAITED                    5       // Any fault during which we were throttled or waited for a page
+#define FAULT_RACED                     6       // Someone else resolved it first
+#define FAULT_OUTCOMES                  7
+
+extern const char *fault_outcome_names[FAULT_OUTCOMES];
+
+// A faulting thread waiting for the writer to hand it a page (see page_waiters.h).
+typedef struct __page_waiter {
+    struct __page_waiter *next;
+    PVOID volatile page;
+    HANDLE page_ready_event;
+} PAGE_WAITER, *PPAGE_WAITER;
 
 // Our smoothing factor, which helps us generate the exponential moving weighted average
 // for the thread runtimes (supporting scheduling)
@@ -40,25 +81,62 @@ typedef struct _USER_THREAD_INFO {
     ULONG thread_id;
     ULONG kernel_va_index;
     PULONG_PTR kernel_va_space;
+#if LARGE_PAGES
+    PULONG_PTR large_page_kernel_va;
+#endif
+#if DIRECT_RECLAIM
+    PULONG_PTR direct_reclaim_kernel_va;
+#endif
     ULONG64 random_seed;
     PVOID free_page_cache[FREE_PAGE_CACHE_SIZE];
     USHORT free_page_count;
+    PAGE_WAITER page_waiter;
+
+    // Only this thread writes these, so it needs no interlocked operations. The scheduler reads them every tick.
+    volatile ULONG64 pages_taken[DEMAND_LISTS];
+
+#if TRACK_FAULT_OUTCOMES
+    // How the current fault is being resolved, and whether we have had to wait for it.
+    ULONG fault_outcome;
+    BOOL fault_waited;
+#endif
+
+#if PRESSURE_STALL_INFO
+    // Above zero while this thread is stalled (see pressure.h). The scheduler reads it every tick.
+    volatile LONG stall_depth;
+#endif
+
+#if TIME_FAULTS
+    // How long each of this thread's faults took, by outcome.
+    LATENCY_HISTOGRAM fault_latencies[FAULT_OUTCOMES];
+#endif
+#if AGING
+    ACCESSED_FILTER_ENTRY accessed_filter[ACCESSED_FILTER_SIZE];
+#endif
 } USER_THREAD_INFO, *PUSER_THREAD_INFO;
 
+#if TRACK_FAULT_OUTCOMES
+#define SET_FAULT_OUTCOME(thread_info, outcome)     ((thread_info)->fault_outcome = (outcome))
+#define SET_FAULT_WAITED(thread_info)               ((thread_info)->fault_waited = TRUE)
+#else
+#define SET_FAULT_OUTCOME(thread_info, outcome)     ((VOID) 0)
+#define SET_FAULT_WAITED(thread_info)               ((VOID) 0)
+#endif
+
 // Events
 extern HANDLE system_start_event;
 extern HANDLE initiate_aging_event;
 extern HANDLE initiate_trimming_event;
 extern HANDLE initiate_writing_event;
 extern HANDLE initiate_pruning_event;
-extern HANDLE standby_pages_ready_event;
 extern HANDLE system_exit_event;
+extern HANDLE trimmer_wake_events[NUM_TRIMMER_THREADS];
 
 // Thread handles
 extern PHANDLE user_threads;
 extern HANDLE scheduling_thread;
 extern HANDLE aging_thread;
-extern HANDLE trimming_thread;
+extern HANDLE trimming_threads[NUM_TRIMMER_THREADS];
 extern HANDLE writing_thread;
 extern HANDLE pruning_thread;
 extern HANDLE debug_thread;
@@ -66,6 +144,7 @@ extern HANDLE debug_thread;
 // Thread IDs
 extern PULONG user_thread_ids;
 extern PULONG worker_thread_ids;
+extern ULONG trimmer_thread_ids[NUM_TRIMMER_THREADS];
 
 // The info struct for each user thread.
 extern PUSER_THREAD_INFO user_thread_info;
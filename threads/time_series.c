@@ -0,0 +1,198 @@
+#include "time_series.h"
+#include "../data_structures/disk.h"
+#include "../data_structures/page_list.h"
+
+#if TIME_SERIES
+static const char *time_series_column_names[TS_COLUMNS] = {
+    [TS_SECONDS]                    = "seconds",
+    [TS_FREE]                       = "free",
+    [TS_ACTIVE]                     = "active",
+    [TS_MODIFIED]                   = "modified",
+    [TS_STANDBY]                    = "standby",
+    [TS_AVAILABLE]                  = "available",
+    [TS_EMPTY_DISK_SLOTS]           = "empty_disk_slots",
+    [TS_HARD_FAULTS_PER_SECOND]     = "hard_faults_per_second",
+    [TS_SOFT_FAULTS_PER_SECOND]     = "soft_faults_per_second",
+    [TS_PAGES_CONSUMED_PER_SECOND]  = "pages_consumed_per_second",
+    [TS_TRIM_BUSY]                  = "trim_busy",
+    [TS_WRITE_BUSY]                 = "write_busy",
+    [TS_PRUNE_BUSY]                 = "prune_busy",
+    [TS_AGE_BUSY]                   = "age_busy",
+};
+
+// Cumulative counters we turn into rates and busy fractions, as of our last sample.
+typedef struct __time_series_totals {
+    LONGLONG timestamp;
+    LONG64 hard_faults;
+    LONG64 soft_faults;
+    LONG64 trim_time;
+    LONG64 write_time;
+    LONG64 prune_time;
+    LONG64 age_time;
+} TIME_SERIES_TOTALS;
+
+static double *time_series_columns[TS_COLUMNS];
+static ULONG64 time_series_count;
+static double time_series_interval;
+static LONGLONG time_series_start;
+static TIME_SERIES_TOTALS previous_totals;
+
+// Busy time past a full interval, carried into the next one (see take_busy_fraction).
+static double busy_carry[TS_COLUMNS];
+
+static VOID read_time_series_totals(TIME_SERIES_TOTALS *totals, LONGLONG timestamp) {
+    totals->timestamp = timestamp;
+    totals->hard_faults = read_counter_approximate(&stats.n_hard);
+    totals->soft_faults = read_counter_approximate(&stats.n_soft);
+    totals->trim_time = stats.trim_time;
+    totals->write_time = stats.write_time;
+    totals->prune_time = stats.prune_time;
+    totals->age_time = stats.age_time;
+}
+
+VOID initialize_time_series(VOID) {
+    for (ULONG column = 0; column < TS_COLUMNS; column++) {
+        time_series_columns[column] = zero_malloc(TIME_SERIES_SAMPLES * sizeof(double));
+    }
+    time_series_count = 0;
+    time_series_interval = TIME_SERIES_INTERVAL_IN_MILLISECONDS / 1000.0;
+    time_series_start = get_timestamp();
+    read_time_series_totals(&previous_totals, time_series_start);
+}
+
+/*
+ *  Merges our samples in pairs, and doubles our interval to match. Each merged sample is the average of
+ *  its pair, and ends where the second of them did. A last, unpaired sample is carried over as it is.
+ */
+static VOID halve_time_series(VOID) {
+    ULONG64 pairs = time_series_count / 2;
+    for (ULONG column = 0; column < TS_COLUMNS; column++) {
+        double *values = time_series_columns[column];
+        for (ULONG64 i = 0; i < pairs; i++) {
+            values[i] = column == TS_SECONDS ? values[2 * i + 1] : (values[2 * i] + values[2 * i + 1]) / 2;
+        }
+        if (time_series_count % 2 == 1) values[pairs] = values[time_series_count - 1];
+    }
+    time_series_count = (time_series_count + 1) / 2;
+    time_series_interval *= 2;
+}
+
+/*
+ *  Workers add a batch's time to their totals only once it ends, so an interval can see more busy time
+ *  than it held, and the next one none. We carry whatever is past a full interval into the next one. That
+ *  keeps each fraction at or below 1, and the fractions still sum to the time spent.
+ */
+static double take_busy_fraction(ULONG column, LONG64 busy_ticks, double interval_ticks) {
+    double busy = (double) busy_ticks + busy_carry[column];
+    double taken = min(busy, interval_ticks);
+    busy_carry[column] = busy - taken;
+    return taken / interval_ticks;
+}
+
+VOID record_time_series(LONGLONG timestamp) {
+    double elapsed = get_time_difference(timestamp, previous_totals.timestamp);
+    if (elapsed < time_series_interval) return;
+
+    if (time_series_count == TIME_SERIES_SAMPLES) halve_time_series();
+
+    TIME_SERIES_TOTALS totals;
+    read_time_series_totals(&totals, timestamp);
+
+    LONG64 free_pages = read_counter_approximate(stats.n_free);
+    LONG64 standby_pages = *stats.n_standby;
+    LONG64 modified_pages = *stats.n_modified;
+    LONG64 active_pages = (LONG64) vm.allocated_frame_count - (free_pages + standby_pages + modified_pages);
+#if LARGE_PAGES
+    // Pages held in the large page pool are free, but on no list.
+    active_pages -= large_page_pool.page_count;
+#endif
+
+    // Busy time is in timer ticks, and our trimmers share one total.
+    double ticks = elapsed * (double) stats.timer_frequency;
+
+    ULONG64 i = time_series_count;
+    time_series_columns[TS_SECONDS][i] = get_time_difference(timestamp, time_series_start);
+    time_series_columns[TS_FREE][i] = (double) free_pages;
+    time_series_columns[TS_ACTIVE][i] = (double) active_pages;
+    time_series_columns[TS_MODIFIED][i] = (double) modified_pages;
+    time_series_columns[TS_STANDBY][i] = (double) standby_pages;
+    time_series_columns[TS_AVAILABLE][i] = (double) read_counter_approximate(&stats.n_available);
+    time_series_columns[TS_EMPTY_DISK_SLOTS][i] = (double) pf.empty_disk_slots;
+    time_series_columns[TS_HARD_FAULTS_PER_SECOND][i] = (double) (totals.hard_faults - previous_totals.hard_faults) / elapsed;
+    time_series_columns[TS_SOFT_FAULTS_PER_SECOND][i] = (double) (totals.soft_faults - previous_totals.soft_faults) / elapsed;
+    time_series_columns[TS_PAGES_CONSUMED_PER_SECOND][i] = stats.page_consumption_per_second;
+    time_series_columns[TS_TRIM_BUSY][i] = take_busy_fraction(TS_TRIM_BUSY,
+        totals.trim_time - previous_totals.trim_time, ticks * NUM_TRIMMER_THREADS);
+    time_series_columns[TS_WRITE_BUSY][i] = take_busy_fraction(TS_WRITE_BUSY,
+        totals.write_time - previous_totals.write_time, ticks);
+    time_series_columns[TS_PRUNE_BUSY][i] = take_busy_fraction(TS_PRUNE_BUSY,
+        totals.prune_time - previous_totals.prune_time, ticks);
+    time_series_columns[TS_AGE_BUSY][i] = take_busy_fraction(TS_AGE_BUSY,
+        totals.age_time - previous_totals.age_time, ticks);
+    time_series_count++;
+
+    previous_totals = totals;
+}
+
+VOID print_time_series_summary(VOID) {
+    double total_rate = 0;
+    double largest_rate = 0;
+    for (ULONG64 i = 0; i < time_series_count; i++) {
+        double rate = time_series_columns[TS_PAGES_CONSUMED_PER_SECOND][i];
+        total_rate += rate;
+        largest_rate = max(rate, largest_rate);
+    }
+    double average_rate = time_series_count ? total_rate / (double) time_series_count : 0;
+
+    printf("~~~~~~~~~~~~~~~~~~~~~\n");
+    printf("%llu samples, every %.0f ms\n", time_series_count, time_series_interval * 1000);
+    printf("Average consumption: %.3f MB/s\n", average_rate * PAGE_SIZE / MB(1));
+    printf("Highest consumption: %.3f MB/s\n", largest_rate * PAGE_SIZE / MB(1));
+    printf("~~~~~~~~~~~~~~~~~~~~~\n");
+}
+
+VOID write_time_series_csv(const char *file_name) {
+    FILE *file = fopen(file_name, "w");
+    if (file == NULL) {
+        printf("Could not open %s to write the time series.\n", file_name);
+        return;
+    }
+
+    for (ULONG column = 0; column < TS_COLUMNS; column++) {
+        fprintf(file, "%s%s", column ? "," : "", time_series_column_names[column]);
+    }
+    fprintf(file, "\n");
+
+    for (ULONG64 i = 0; i < time_series_count; i++) {
+        for (ULONG column = 0; column < TS_COLUMNS; column++) {
+            fprintf(file, "%s%.6g", column ? "," : "", time_series_columns[column][i]);
+        }
+        fprintf(file, "\n");
+    }
+
+    fclose(file);
+    printf("Wrote %llu samples to %s.\n", time_series_count, file_name);
+}
+
+VOID write_time_series_binary(const char *file_name) {
+    FILE *file = fopen(file_name, "wb");
+    if (file == NULL) {
+        printf("Could not open %s to write the time series.\n", file_name);
+        return;
+    }
+
+    ULONG header[3] = {TIME_SERIES_MAGIC, TIME_SERIES_VERSION, TS_COLUMNS};
+    fwrite(header, sizeof(header), 1, file);
+    fwrite(&time_series_count, sizeof(time_series_count), 1, file);
+    for (ULONG column = 0; column < TS_COLUMNS; column++) {
+        fwrite(time_series_column_names[column], strlen(time_series_column_names[column]) + 1, 1, file);
+    }
+
+    for (ULONG column = 0; column < TS_COLUMNS; column++) {
+        fwrite(time_series_columns[column], sizeof(double), time_series_count, file);
+    }
+
+    fclose(file);
+    printf("Wrote %llu samples to %s.\n", time_series_count, file_name);
+}
+#endif
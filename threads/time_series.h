@@ -0,0 +1,59 @@
+#pragma once
+#include "threads.h"
+
+/*
+ *  Records how our page states and rates evolve over a run, for plotting. Every
+ *  TIME_SERIES_INTERVAL_IN_MILLISECONDS (as short as one scheduler tick), the scheduler appends one sample
+ *  of every column below. Columns are stored apart from each other in arrays allocated up front, so
+ *  recording never allocates, and a plot reads each column in one pass.
+ *
+ *  If the run outlasts our TIME_SERIES_SAMPLES, we merge our samples in pairs and double the interval, so
+ *  we always cover the whole run. At exit we write the samples as CSV, or with TIME_SERIES_BINARY on,
+ *  as a binary file (see write_time_series_binary).
+ */
+#define TS_SECONDS                      0       // Since the first sample
+#define TS_FREE                         1
+#define TS_ACTIVE                       2
+#define TS_MODIFIED                     3
+#define TS_STANDBY                      4
+#define TS_AVAILABLE                    5
+#define TS_EMPTY_DISK_SLOTS             6
+#define TS_HARD_FAULTS_PER_SECOND       7
+#define TS_SOFT_FAULTS_PER_SECOND       8
+#define TS_PAGES_CONSUMED_PER_SECOND    9       // The scheduler's forecast of pages taken from free and standby
+#define TS_TRIM_BUSY                    10      // Fraction of the interval our trimmers spent trimming, on average
+#define TS_WRITE_BUSY                   11
+#define TS_PRUNE_BUSY                   12
+#define TS_AGE_BUSY                     13
+#define TS_COLUMNS                      14
+
+#define TIME_SERIES_MAGIC               0x53454954      // "TIES"
+#define TIME_SERIES_VERSION             1
+
+#if TIME_SERIES
+/*
+ *  Allocates every column. Called by the scheduler before its first tick.
+ */
+VOID initialize_time_series(VOID);
+
+/*
+ *  Takes a sample, if at least the current interval has passed since the last one.
+ */
+VOID record_time_series(LONGLONG timestamp);
+
+/*
+ *  Prints the average and peak of our consumption rate over the run.
+ */
+VOID print_time_series_summary(VOID);
+
+/*
+ *  Writes one row per sample, with a header row of column names.
+ */
+VOID write_time_series_csv(const char *file_name);
+
+/*
+ *  Writes a header (magic, version, column count, sample count, then each column's name, NUL-terminated),
+ *  followed by each column in turn as sample count doubles.
+ */
+VOID write_time_series_binary(const char *file_name);
+#endif
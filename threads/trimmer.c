@@ -2,50 +2,101 @@
 // Created by zblickensderfer on 5/6/2025.
 //
 #include "trimmer.h"
+#include "latency_slo.h"
+#include "../utils/phase_profiler.h"
+#include "../utils/trace.h"
+#include "../utils/probes.h"
+#include "../utils/cpu_counters.h"
+
+TRIM_PARTITION trim_partitions[NUM_TRIMMER_THREADS];
+volatile LONG active_trimmer_count;
+
+// The partition the next trimmer will try first.
+volatile LONG64 next_trim_partition;
+
+VOID initialize_trimmers(VOID) {
+
+    // Partitions start on bitmap word boundaries (64 blocks, or 4096 PTEs), so no two trimmers share
+    // a word of the bitmap, a page table, or a large page.
+    ULONG64 num_words = (num_pte_blocks + 63) / 64;
+    for (ULONG i = 0; i < NUM_TRIMMER_THREADS; i++) {
+        PTRIM_PARTITION partition = &trim_partitions[i];
+        partition->hand.first_block = min(num_pte_blocks, (num_words * i / NUM_TRIMMER_THREADS) * 64);
+        partition->hand.end_block = min(num_pte_blocks, (num_words * (i + 1) / NUM_TRIMMER_THREADS) * 64);
+        partition->hand.block = partition->hand.first_block;
+        partition->busy = FALSE;
+
+        if (i == LEAD_TRIMMER) continue;
+        trimmer_wake_events[i] = CreateEvent(NULL, AUTO_RESET, FALSE, NULL);
+        NULL_CHECK(trimmer_wake_events[i], "Could not initialize trimmer wake event.");
+    }
+
+    next_trim_partition = 0;
+    active_trimmer_count = NUM_TRIMMER_THREADS;
+}
+
+VOID scale_active_trimmers(double pages_consumed_per_second) {
+
+    // Each trimmer supplies about one full batch per batch runtime.
+    double pages_per_trimmer = (double) get_tunable(TUNE_TRIM_BATCH_SIZE) / max(stats.worker_runtimes[TRIMMING_THREAD_ID], 1e-6);
+    LONG trimmers = 1 + (LONG) (pages_consumed_per_second * reclaim_aggressiveness / pages_per_trimmer);
+    trimmers = max(1, min(trimmers, NUM_TRIMMER_THREADS));
+    WriteNoFence(&active_trimmer_count, trimmers);
+}
 
-void check_to_start_writer(void) {
-    if (*stats.n_standby < LOW_PAGE_THRESHOLD / 8) {
-        SetEvent(initiate_writing_event);
+// Claims a partition no other trimmer is working, or returns NULL if they are all taken.
+PTRIM_PARTITION claim_trim_partition(VOID) {
+    for (ULONG i = 0; i < NUM_TRIMMER_THREADS; i++) {
+        ULONG64 index = (ULONG64) InterlockedIncrement64(&next_trim_partition) % NUM_TRIMMER_THREADS;
+        PTRIM_PARTITION partition = &trim_partitions[index];
+        if (InterlockedCompareExchange(&partition->busy, TRUE, FALSE) == FALSE) return partition;
     }
+    return NULL;
 }
 
-ULONG64 trim_pages(VOID) {
+/*
+ *  Lets the policy choose up to capacity victims from a partition we have claimed, and trims them into
+ *  trimmed_pages: unmapped and locked, with their PTEs in transition. Frees the partition once the
+ *  victims are locked. Returns the number of pages trimmed.
+ */
+static ULONG64 trim_partition(PTRIM_PARTITION partition, PPFN *trimmed_pages, ULONG64 capacity) {
 
     // We will keep track of the number of pages we have batched
-    ULONG64 attempts = 0;
     ULONG64 trim_batch_size = 0;
-    PPFN trimmed_pages[MAX_TRIM_BATCH_SIZE];
     PULONG_PTR trimmed_VAs[MAX_TRIM_BATCH_SIZE];
+    PPTE victims[MAX_TRIM_BATCH_SIZE];
+    LONG64 evicted[POLICY_CLASSES] = {0};
+
+#if AGING
+    // Policies that clear accessed bits themselves do so in a pass, so user threads mark every access meanwhile.
+    if (!replacement_policy->uses_ager) begin_accessed_bit_pass();
+#endif
 
-    // Initialize current pte
-    PPTE pte = pte_to_trim;
+    PHASE_BEGIN(PHASE_TRIM_SELECT);
+    ULONG64 victim_count = replacement_policy->select_victims(&partition->hand, victims, min(capacity, MAX_TRIM_BATCH_SIZE));
+    PHASE_END(PHASE_TRIM_SELECT);
+#if AGING
+    if (!replacement_policy->uses_ager) end_accessed_bit_pass();
+#endif
+    ULONG64 eviction_stamp = get_current_eviction_stamp();
 
     // The PFN of the current PTE.
     PPFN pfn;
 
-    // Walks PTE region until a valid page batch is made, beginning from one
-    // beyond previous last trimmed page.
-    while (trim_batch_size < MAX_TRIM_BATCH_SIZE && attempts < MAX_TRIM_ATTEMPTS) {
-
-        // Move on to the next pte.
-        pte++;
-        attempts++;
+    PHASE_BEGIN(PHASE_TRIM_LOCK);
+    for (ULONG64 i = 0; i < victim_count; i++) {
+        PPTE pte = victims[i];
 
-        // Wrap around!
-        if (pte == (PTE_base + vm.num_ptes)) pte = PTE_base;
-
-        // If the PTE is not valid, no need for us to try to lock it.
-        if (!IS_PTE_VALID(pte)) continue;
+        // Try to acquire the PTE lock
+        if (!try_lock_pte(pte)) continue;
 
-#if AGING
-        // If the PTE has been accessed, clear its bit and continue
-        if (IS_PTE_ACCESSED(pte)) {
-            clear_accessed_bit(pte);
+        // The PTE may have been accessed since the policy chose it. That's okay -- as before,
+        // an access between our check and our trim does not save the page.
+        if (!IS_PTE_VALID(pte)) {
+            unlock_pte(pte);
             continue;
         }
-#endif
-        // Try to acquire the PTE lock
-        if (!try_lock_pte(pte)) continue;
+        evicted[pte->memory_format.policy_class]++;
 
         // Read in the the PFN.
         pfn = get_PFN_from_PTE(pte);
@@ -58,7 +109,7 @@ ULONG64 trim_pages(VOID) {
 
         // Now that you have both locks, transition both data structures into the
         // proper transition, mid-trim states.
-        set_PTE_to_transition(pte);
+        set_PTE_to_transition(pte, eviction_stamp);
 
         // Unlock the PTE -- we don't need it anymore
         unlock_pte(pte);
@@ -68,20 +119,38 @@ ULONG64 trim_pages(VOID) {
         trimmed_VAs[trim_batch_size] = get_VA_from_PTE(pte);
         trim_batch_size++;
     }
+    PHASE_END(PHASE_TRIM_LOCK);
+
+    // Once our victims are locked, other trimmers cannot take them, so the partition is free again.
+    InterlockedExchange(&partition->busy, FALSE);
+
+    record_evictions(evicted);
 
     // If we couldn't trim anyone, return
-    if (trim_batch_size == 0) {
-        check_to_start_writer();
-        return 0;
-    }
+    if (trim_batch_size == 0) return 0;
 
     // Unmap ALL pages in one batch!
+    PHASE_BEGIN(PHASE_TRIM_UNMAP);
     if (!MapUserPhysicalPagesScatter(trimmed_VAs, trim_batch_size, NULL)) DebugBreak();
+    PHASE_END(PHASE_TRIM_UNMAP);
+
+    return trim_batch_size;
+}
+
+ULONG64 trim_pages(ULONG64 capacity) {
+
+    PPFN trimmed_pages[MAX_TRIM_BATCH_SIZE];
+    PPFN pfn;
 
-    // Update our starting point for the next run
-    pte_to_trim = pte;
+    // Take a partition of our own, and let the policy choose our victims from it.
+    PTRIM_PARTITION partition = claim_trim_partition();
+    if (partition == NULL) return 0;
+
+    ULONG64 trim_batch_size = trim_partition(partition, trimmed_pages, capacity);
+    if (trim_batch_size == 0) return 0;
 
     // We will make a temporary page list to help do a batch insert to the modified list.
+    PHASE_BEGIN(PHASE_TRIM_TO_MODIFIED);
     PAGE_LIST temp_list;
     initialize_page_list(&temp_list);
 
@@ -91,15 +160,17 @@ ULONG64 trim_pages(VOID) {
         // Grab the PFN and take a snapshot of its PTE
         pfn = trimmed_pages[i];
 
-        // Set PFN status as modified
+        // Set PFN status as modified. Trimmed pages keep their active status until now.
+        PROBE_PFN_TRANSITION(get_frame_from_PFN(pfn), pfn->fields.status, PFN_MODIFIED);
         SET_PFN_STATUS(pfn, PFN_MODIFIED);
 
         // Add page to the temp list
         insert_to_list_tail(&temp_list, pfn);
     }
 
-    // Add all pages to the modified list
+    // Add all pages to the modified list, splicing in the whole batch under one acquisition of its lock.
     insert_list_to_tail_list(&modified_list, &temp_list);
+    PROBE_LIST_BATCH(LIST_ID_MODIFIED, PROBE_LIST_INSERT, trim_batch_size);
     change_list_size(&modified_list, (LONG64) trim_batch_size);
 
     // Unlock all pages in the batch!
@@ -110,50 +181,77 @@ ULONG64 trim_pages(VOID) {
         unlock_pfn(pfn);
         pfn = next;
     }
+    PHASE_END(PHASE_TRIM_TO_MODIFIED);
 
-    // Before we return, let's see if we desperately need to write.
-    // If the standby list is dangerously low on pages, let's do a write
-    check_to_start_writer();
+    // The writer turns our pages into available ones. Let it know there is more to write.
+    SetEvent(initiate_writing_event);
 
     // Return our batch size, which is used by the statistics thread.
     return trim_batch_size;
 }
 
-VOID trim_pages_thread(VOID) {
+ULONG64 trim_pages_for_direct_reclaim(ULONG thread_id, PPFN *trimmed_pages, ULONG64 capacity) {
+
+    // Each user thread is paired with one partition. If a trimmer is already working it, we leave it be.
+    PTRIM_PARTITION partition = &trim_partitions[thread_id % NUM_TRIMMER_THREADS];
+    if (InterlockedCompareExchange(&partition->busy, TRUE, FALSE) != FALSE) return 0;
+
+    return trim_partition(partition, trimmed_pages, capacity);
+}
+
+VOID trim_pages_thread(ULONG_PTR trimmer_index) {
 
     // Create our handles for the wait for multiple objects call in the loop.
+    // The lead trimmer waits for the trimming event; the others wait for the lead to wake them.
     // We wait to trim or to exit.
     HANDLE events[2];
-    events[ACTIVE_EVENT_INDEX] = initiate_trimming_event;
+    events[ACTIVE_EVENT_INDEX] = (trimmer_index == LEAD_TRIMMER) ? initiate_trimming_event : trimmer_wake_events[trimmer_index];
     events[EXIT_EVENT_INDEX] = system_exit_event;
 
     // Wait for system start event before entering waiting state!
     WaitForSingleObject(system_start_event, INFINITE);
-
-    // Initialize target pte to begin at the start of the PTE region.
-    pte_to_trim = PTE_base;
+    TRACE_THREAD_NAME("trimmer", (ULONG) trimmer_index);
 
     // If the exit flag has been set, then it's time to go!
     while (TRUE) {
 
+        TRACE_BEGIN(TRACE_WAIT, TRACE_WAIT_WORK);
         if (WaitForMultipleObjects(ARRAYSIZE(events), events, FALSE, INFINITE)
             == EXIT_EVENT_INDEX) return;
+        TRACE_END(TRACE_WAIT, TRACE_WAIT_WORK);
 
-        // Since we are about to trim, we will reset our event
-        ResetEvent(initiate_trimming_event);
-
-        LONGLONG start = get_timestamp();
+        if (trimmer_index == LEAD_TRIMMER) {
 
-        // Once woken, begin trimming a batch of pages. Then go back to sleep.
-        ULONG64 batch_size = trim_pages();
+            // Since we are about to trim, we will reset our event
+            ResetEvent(initiate_trimming_event);
 
-        // Record the runtime and update the future runtime estimate
-        LONGLONG end = get_timestamp();
-        double difference = get_time_difference(end, start);
-        update_estimated_job_time(TRIMMING_THREAD_ID, difference);
+            // Wake as many helpers as the scheduler says we need.
+            LONG trimmers = ReadNoFence(&active_trimmer_count);
+            for (LONG i = 1; i < trimmers; i++) SetEvent(trimmer_wake_events[i]);
+        }
 
-        #if STATS_MODE
-        record_batch_size_and_time(difference, batch_size, TRIMMING_THREAD_ID);
+        // Once woken, trim batches of pages until reclaim has enough on its way. Then go back to sleep.
+        ULONG64 batch_size;
+        do {
+            LONGLONG start = get_timestamp();
+
+            TRACE_BEGIN(TRACE_TRIM_BATCH, 0);
+            COUNTERS_BEGIN();
+            batch_size = trim_pages(get_trim_batch_target());
+            COUNTERS_END(COUNTER_PATH_TRIM, batch_size);
+            TRACE_END(TRACE_TRIM_BATCH, (ULONG) batch_size);
+
+            // Record the runtime. Only the lead updates the runtime estimate: its update is a plain
+            // read-modify-write, and the lead trims every time trimming is initiated, so its batches are typical.
+            LONGLONG end = get_timestamp();
+            double difference = get_time_difference(end, start);
+            if (trimmer_index == LEAD_TRIMMER) update_estimated_job_time(TRIMMING_THREAD_ID, difference);
+            InterlockedAdd64(&stats.n_trimmed, (LONG64) batch_size);
+            InterlockedAdd64(&stats.trim_time, end - start);
+
+#if STATS_MODE
+            record_batch_size_and_time(difference, batch_size, TRIMMING_THREAD_ID);
 #endif
+        } while (batch_size > 0 && should_continue_trimming());
     }
-}
\ No newline at end of file
+}
@@ -7,12 +7,50 @@
 #include "../data_structures/pfn.h"
 #include "../data_structures/page_list.h"
 #include "threads.h"
+#include "../policies/policy.h"
 
-#define MAX_TRIM_ATTEMPTS       MAX_TRIM_BATCH_SIZE * 4
 #define TRIMMER_DELAY           10
 
-// The initial trimmer_offset in the PTE region for the trimmer -- this will change over time.
-PPTE pte_to_trim;
+/*
+ *  The PTEs are split into one partition per trimmer thread, each with its own policy hand. A trimmer
+ *  takes whichever partition is next and not already being trimmed, so no two trimmers ever scan the
+ *  same PTEs, and every partition is still trimmed when only some trimmers are running.
+ */
+typedef struct __trim_partition {
+    POLICY_HAND hand;
+    volatile LONG busy;
+} TRIM_PARTITION, *PTRIM_PARTITION;
+
+extern TRIM_PARTITION trim_partitions[NUM_TRIMMER_THREADS];
+
+/*
+ *  The number of trimmers that run each time trimming is initiated. Set by the scheduler.
+ */
+extern volatile LONG active_trimmer_count;
+
+/*
+ *  Splits the PTE blocks into partitions, on bitmap word boundaries, and creates the helper trimmers' events.
+ */
+VOID initialize_trimmers(VOID);
+
+/*
+ *  Sets the number of active trimmers so that together they keep up with the given consumption rate,
+ *  using the current estimate of how long one batch takes.
+ */
+VOID scale_active_trimmers(double pages_consumed_per_second);
+
+/*
+ *  Trims a batch of at most capacity pages from the next free partition. Returns the number of pages trimmed.
+ */
+ULONG64 trim_pages(ULONG64 capacity);
+
+/*
+ *  Direct reclaim's trim, for a user thread that is out of pages. Trims at most capacity pages from the
+ *  partition paired with this thread (unless a trimmer is working it) into trimmed_pages, leaving them
+ *  unmapped and locked, with their PTEs in transition, for the caller to write out itself. Puts nothing
+ *  on the modified list and wakes no worker. Returns the number of pages trimmed.
+ */
+ULONG64 trim_pages_for_direct_reclaim(ULONG thread_id, PPFN *trimmed_pages, ULONG64 capacity);
 
 /*
  *  This is the function called by CreateThread. It waits for the initialize_system event.
@@ -20,4 +58,4 @@ PPTE pte_to_trim;
  *  which leads to calls to the above method, trim_pages. But it also waits for the system exit event,
  *  which terminated this threas.
  */
-VOID trim_pages_thread(VOID);
\ No newline at end of file
+VOID trim_pages_thread(ULONG_PTR trimmer_index);
\ No newline at end of file
@@ -0,0 +1,92 @@
+#include "watermarks.h"
+#include "../utils/trace.h"
+#include "pressure.h"
+
+WATERMARKS watermarks;
+volatile LONG reclaim_active;
+HANDLE above_min_watermark_event;
+
+VOID update_watermarks(double pages_consumed_per_second) {
+
+    LONG64 allocated = (LONG64) vm.allocated_frame_count;
+
+    // Min is a small reserve, so the fault handler is never left with nothing at all.
+    LONG64 min_pages = max(MIN_WATERMARK_PAGES, (LONG64) (MIN_WATERMARK_FRACTION * allocated));
+
+    // Between each pair of watermarks, we leave room for everything consumed while a batch is trimmed
+    // and written -- and never less than a fixed share of memory. In latency SLO mode, we widen or
+    // narrow the gaps to hold our tail latency.
+    double reclaim_time = stats.worker_runtimes[TRIMMING_THREAD_ID] + stats.worker_runtimes[WRITING_THREAD_ID];
+    LONG64 gap = max((LONG64) (WATERMARK_GAP_FRACTION * allocated), (LONG64) (pages_consumed_per_second * reclaim_time));
+    gap = (LONG64) (gap * reclaim_aggressiveness);
+
+    // Never aim to keep more than half of memory available.
+    LONG64 high_pages = min(min_pages + 2 * gap, allocated / 2);
+    LONG64 low_pages = min(min_pages + gap, high_pages);
+
+    WriteNoFence64(&watermarks.min, min_pages);
+    WriteNoFence64(&watermarks.low, low_pages);
+    WriteNoFence64(&watermarks.high, high_pages);
+}
+
+VOID wake_reclaim_if_below_low(VOID) {
+    if (!is_counter_below(&stats.n_available, ReadNoFence64(&watermarks.low))) return;
+
+    // Only the thread that starts reclaim needs to wake the workers. Once started, they keep themselves going.
+    if (InterlockedCompareExchange(&reclaim_active, TRUE, FALSE) == FALSE) {
+        SetEvent(initiate_trimming_event);
+        SetEvent(initiate_writing_event);
+    }
+}
+
+BOOL should_continue_trimming(VOID) {
+    if (!ReadNoFence(&reclaim_active)) return FALSE;
+    return is_counter_below(&stats.n_available, ReadNoFence64(&watermarks.high) - *stats.n_modified);
+}
+
+BOOL should_continue_writing(VOID) {
+    if (!ReadNoFence(&reclaim_active)) return FALSE;
+
+    // We have reached high -- reclaim is done until we fall below low again.
+    if (!is_counter_below(&stats.n_available, ReadNoFence64(&watermarks.high))) {
+        end_reclaim();
+        return FALSE;
+    }
+
+    // If there is nothing left to write, the trimmers need to catch up first. Reclaim stays active,
+    // so they keep trimming, and the writer waits for their next batch.
+    if (*stats.n_modified == 0) SetEvent(initiate_trimming_event);
+    return TRUE;
+}
+
+VOID end_reclaim(VOID) {
+    InterlockedExchange(&reclaim_active, FALSE);
+}
+
+VOID release_throttled_threads_if_above_min(VOID) {
+    if (!is_counter_below(&stats.n_available, ReadNoFence64(&watermarks.min))) {
+        SetEvent(above_min_watermark_event);
+    }
+}
+
+BOOL throttle_if_below_min(VOID) {
+    if (!is_counter_below(&stats.n_available, ReadNoFence64(&watermarks.min))) return FALSE;
+
+    // Make sure reclaim is running, then wait for it. We may have raced with the writer setting the
+    // event, so we check once more after resetting it.
+    ResetEvent(above_min_watermark_event);
+    wake_reclaim_if_below_low();
+    if (!is_counter_below(&stats.n_available, ReadNoFence64(&watermarks.min))) return FALSE;
+
+    LONGLONG start = get_timestamp();
+    TRACE_BEGIN(TRACE_WAIT, TRACE_WAIT_THROTTLE);
+    STALL_BEGIN();
+    WaitForSingleObject(above_min_watermark_event, THROTTLE_TIMEOUT_IN_MILLISECONDS);
+    STALL_END();
+    TRACE_END(TRACE_WAIT, TRACE_WAIT_THROTTLE);
+    LONGLONG end = get_timestamp();
+
+    InterlockedIncrement64(&stats.n_throttled);
+    InterlockedAdd64(&stats.throttle_time, end - start);
+    return TRUE;
+}
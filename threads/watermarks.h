@@ -0,0 +1,69 @@
+#pragma once
+#include "initializer.h"
+#include "latency_slo.h"
+
+/*
+ *  Watermarks on available pages (free plus standby) decide when we reclaim:
+ *
+ *      below low:   background reclaim starts. The trimmers and the writer keep going, batch after batch,
+ *                   until available pages climb back above high.
+ *      below min:   faulting threads are throttled until reclaim brings us back above min.
+ *
+ *  The gap between low and high gives us hysteresis, so reclaim runs in long, steady stretches instead of
+ *  starting and stopping every time a few pages are consumed. The gaps scale with physical memory and
+ *  with how many pages we consume while one trim and one write take place.
+ */
+typedef struct __watermarks {
+    volatile LONG64 min;
+    volatile LONG64 low;
+    volatile LONG64 high;
+} WATERMARKS, *PWATERMARKS;
+
+extern WATERMARKS watermarks;
+
+// TRUE from the time we fall below low until we are back above high.
+extern volatile LONG reclaim_active;
+
+// Set while available pages are above min. Throttled threads wait on it.
+extern HANDLE above_min_watermark_event;
+
+/*
+ *  Sets the watermarks from physical memory and the given consumption rate. Called at startup,
+ *  then by the scheduler each tick.
+ */
+VOID update_watermarks(double pages_consumed_per_second);
+
+/*
+ *  Starts background reclaim if available pages are below low. Cheap enough to call on every hard fault.
+ */
+VOID wake_reclaim_if_below_low(VOID);
+
+/*
+ *  Called by the trimmers after each batch. Returns TRUE if they should trim another batch right away:
+ *  reclaim is active and the pages available (or on their way, on the modified list) are still below high.
+ */
+BOOL should_continue_trimming(VOID);
+
+/*
+ *  Called by the writer after each batch. Returns TRUE if it should keep writing: reclaim is active and
+ *  available pages are still below high. If there is nothing left to write, it wakes the trimmers, and
+ *  the writer waits for them before its next batch. Once we are back above high, it ends reclaim.
+ */
+BOOL should_continue_writing(VOID);
+
+/*
+ *  Ends background reclaim, until available pages are next seen below low. Called once they reach high.
+ */
+VOID end_reclaim(VOID);
+
+/*
+ *  Called by the writer once pages are available again. Releases throttled threads if we are back above min.
+ */
+VOID release_throttled_threads_if_above_min(VOID);
+
+/*
+ *  Called by a faulting thread before it takes a page. If available pages are below min, it waits
+ *  (for at most THROTTLE_TIMEOUT_IN_MILLISECONDS) for reclaim to bring them back above min.
+ *  Returns TRUE if it waited.
+ */
+BOOL throttle_if_below_min(VOID);
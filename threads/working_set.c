@@ -0,0 +1,204 @@
+#include "working_set.h"
+
+#if WSS_SAMPLING
+// The sweep in which each sampled page was last found accessed, counting from 1. Zero if it never was.
+// Faults stamp the sweep after the current one, so they count as touched in both.
+static volatile ULONG *sample_stamps;
+static ULONG64 sample_count;
+static volatile ULONG sweep;
+
+static LONGLONG first_sweep_start;
+static LONGLONG last_sweep_start;
+
+// Sum and peak of each window's estimate, over every sweep that window fits into.
+static double sampled_sum[WSS_WINDOWS];
+static double resident_sum[WSS_WINDOWS];
+static ULONG64 sampled_peak[WSS_WINDOWS];
+static ULONG64 resident_peak[WSS_WINDOWS];
+static ULONG64 window_sweeps[WSS_WINDOWS];
+
+// Each row sums sweeps_per_row sweeps, and starts at row_seconds.
+static ULONG64 (*heatmap)[WSS_HEATMAP_REGIONS];
+static double *row_seconds;
+static ULONG64 row_count;
+static ULONG64 sweeps_per_row;
+static ULONG64 sweeps_in_row;
+static ULONG64 ptes_per_region;
+
+// Picks one page from each group of WSS_SAMPLE_RATE, scattered by hash so that strided workloads
+// do not always land on (or always miss) the samples.
+static ULONG get_sample_offset(ULONG64 group) {
+    return (ULONG) ((group * 0x9E3779B97F4A7C15ULL) >> 58) & (WSS_SAMPLE_RATE - 1);
+}
+
+VOID initialize_working_set(VOID) {
+    sample_count = (vm.num_ptes + WSS_SAMPLE_RATE - 1) / WSS_SAMPLE_RATE;
+    sample_stamps = zero_malloc(sample_count * sizeof(ULONG));
+
+    heatmap = zero_malloc(WSS_HEATMAP_ROWS * sizeof(*heatmap));
+    row_seconds = zero_malloc(WSS_HEATMAP_ROWS * sizeof(double));
+    row_count = 0;
+    sweeps_per_row = 1;
+    sweeps_in_row = 0;
+    ptes_per_region = (vm.num_ptes + WSS_HEATMAP_REGIONS - 1) / WSS_HEATMAP_REGIONS;
+
+    sweep = 0;
+}
+
+/*
+ *  Merges the heatmap's rows in pairs, and doubles the sweeps in each row to match.
+ *  The last row merges two full rows, so it is full too.
+ */
+static VOID halve_heatmap(VOID) {
+    for (ULONG64 row = 0; row < row_count / 2; row++) {
+        for (ULONG region = 0; region < WSS_HEATMAP_REGIONS; region++) {
+            heatmap[row][region] = heatmap[2 * row][region] + heatmap[2 * row + 1][region];
+        }
+        row_seconds[row] = row_seconds[2 * row];
+    }
+    row_count /= 2;
+    sweeps_per_row *= 2;
+    sweeps_in_row = sweeps_per_row;
+}
+
+VOID begin_working_set_sweep(VOID) {
+    LONGLONG now = get_timestamp();
+    if (sweep == 0) first_sweep_start = now;
+    last_sweep_start = now;
+    sweep++;
+
+    // Start a new row once the current one holds all its sweeps.
+    if (row_count == 0 || sweeps_in_row == sweeps_per_row) {
+        if (row_count == WSS_HEATMAP_ROWS) halve_heatmap();
+
+        memset(heatmap[row_count], 0, sizeof(*heatmap));
+        row_seconds[row_count] = get_time_difference(now, first_sweep_start);
+        row_count++;
+        sweeps_in_row = 0;
+    }
+    sweeps_in_row++;
+}
+
+VOID record_working_set_page(ULONG64 pte_index, ULONG age_class) {
+    // Only pages accessed since the last sweep count as touched in this one.
+    if (age_class != 0) return;
+
+    heatmap[row_count - 1][pte_index / ptes_per_region]++;
+
+    // A fault may have stamped this sample with a later sweep already.
+    ULONG64 group = pte_index / WSS_SAMPLE_RATE;
+    if ((pte_index & (WSS_SAMPLE_RATE - 1)) == get_sample_offset(group) && sample_stamps[group] < sweep) {
+        sample_stamps[group] = sweep;
+    }
+}
+
+VOID record_working_set_fault(ULONG64 pte_index) {
+    ULONG64 group = pte_index / WSS_SAMPLE_RATE;
+    if ((pte_index & (WSS_SAMPLE_RATE - 1)) == get_sample_offset(group)) {
+        sample_stamps[group] = sweep + 1;
+    }
+}
+
+VOID end_working_set_sweep(LONG64 age_histogram[PTE_AGE_CLASSES]) {
+
+    // Count our samples by how many sweeps ago they were last touched, in powers of two:
+    // bucket w holds those touched within the last 2^w sweeps, but not the last 2^(w-1).
+    ULONG64 buckets[WSS_WINDOWS] = {0};
+    for (ULONG64 group = 0; group < sample_count; group++) {
+        ULONG stamp = sample_stamps[group];
+        if (stamp == 0) continue;
+
+        // A stamp past this sweep came from a fault during it.
+        ULONG sweeps_ago = stamp > sweep ? 0 : sweep - stamp;
+        ULONG bucket = 0;
+        if (sweeps_ago > 0) {
+            _BitScanReverse(&bucket, sweeps_ago);
+            bucket++;
+        }
+        if (bucket < WSS_WINDOWS) buckets[bucket]++;
+    }
+
+    ULONG64 sampled = 0;
+    ULONG64 resident = 0;
+    ULONG age_class = 0;
+    for (ULONG window = 0; window < WSS_WINDOWS; window++) {
+        ULONG64 window_length = 1ULL << window;
+
+        // A window longer than the run so far would only understate.
+        if (window_length > sweep) break;
+
+        sampled += buckets[window];
+        ULONG64 sampled_pages = sampled * WSS_SAMPLE_RATE;
+        sampled_sum[window] += (double) sampled_pages;
+        sampled_peak[window] = max(sampled_peak[window], sampled_pages);
+
+        // The ager's age classes give us the resident pages exactly, as far back as they remember.
+        while (age_class < window_length && age_class < PTE_AGE_BITS) {
+            resident += (ULONG64) age_histogram[age_class];
+            age_class++;
+        }
+        if (window_length <= PTE_AGE_BITS) {
+            resident_sum[window] += (double) resident;
+            resident_peak[window] = max(resident_peak[window], resident);
+        }
+
+        window_sweeps[window]++;
+    }
+}
+
+VOID print_working_set(VOID) {
+    double seconds_per_sweep = sweep > 1 ?
+        get_time_difference(last_sweep_start, first_sweep_start) / (sweep - 1) : 0;
+
+    printf("~~~~~~~~~~~~~~~~~~~~~\n");
+    printf("Working set over %lu sweeps, one every %.3f s (1 in %u pages sampled)\n",
+           sweep, seconds_per_sweep, WSS_SAMPLE_RATE);
+    printf("%8s %10s %12s %12s %12s %12s\n",
+           "sweeps", "seconds", "sampled avg", "sampled peak", "resident avg", "resident peak");
+
+    for (ULONG window = 0; window < WSS_WINDOWS; window++) {
+        if (window_sweeps[window] == 0) break;
+
+        ULONG64 window_length = 1ULL << window;
+        double n = (double) window_sweeps[window];
+
+        printf("%8llu %10.3f %9.1f MB %9.1f MB", window_length, window_length * seconds_per_sweep,
+               sampled_sum[window] / n * PAGE_SIZE / MB(1),
+               (double) sampled_peak[window] * PAGE_SIZE / MB(1));
+        if (window_length <= PTE_AGE_BITS) {
+            printf(" %9.1f MB %9.1f MB\n", resident_sum[window] / n * PAGE_SIZE / MB(1),
+                   (double) resident_peak[window] * PAGE_SIZE / MB(1));
+        } else {
+            printf(" %12s %12s\n", "-", "-");
+        }
+    }
+    printf("~~~~~~~~~~~~~~~~~~~~~\n");
+}
+
+VOID write_heatmap_csv(const char *file_name) {
+    FILE *file = fopen(file_name, "w");
+    if (file == NULL) {
+        printf("Could not open %s to write the heatmap.\n", file_name);
+        return;
+    }
+
+    // Each column is named for the offset, in MB, where its region of VA space starts.
+    fprintf(file, "seconds,sweeps");
+    for (ULONG region = 0; region < WSS_HEATMAP_REGIONS; region++) {
+        fprintf(file, ",%.1f", (double) (region * ptes_per_region) * PAGE_SIZE / MB(1));
+    }
+    fprintf(file, "\n");
+
+    for (ULONG64 row = 0; row < row_count; row++) {
+        ULONG64 sweeps = row + 1 < row_count ? sweeps_per_row : sweeps_in_row;
+        fprintf(file, "%.6g,%llu", row_seconds[row], sweeps);
+        for (ULONG region = 0; region < WSS_HEATMAP_REGIONS; region++) {
+            fprintf(file, ",%llu", heatmap[row][region]);
+        }
+        fprintf(file, "\n");
+    }
+
+    fclose(file);
+    printf("Wrote %llu heatmap rows of %u regions to %s.\n", row_count, WSS_HEATMAP_REGIONS, file_name);
+}
+#endif
@@ -0,0 +1,57 @@
+#pragma once
+#include "initializer.h"
+
+/*
+ *  With WSS_SAMPLING on, each aging sweep also tells us how much memory the workload is really using,
+ *  and where. Accesses cost nothing extra; faults cost one check of the page's index against its sample.
+ *
+ *  Working-set size (WSS) curves: how many distinct pages were touched in the last 1, 2, 4 ... 256 sweeps.
+ *
+ *      Resident:   up to PTE_AGE_BITS sweeps, exact for valid pages, straight from the ager's age classes.
+ *      Sampled:    any window. One page in every WSS_SAMPLE_RATE (chosen by hash, one per group of
+ *                  consecutive pages) keeps the number of the last sweep that found it accessed, or that
+ *                  it faulted during. Faulting pages are valid again by the next sweep, so without this
+ *                  a page trimmed and faulted back in between sweeps would look untouched. We count
+ *                  the samples touched within each window, and scale up.
+ *
+ *  Heatmap: the VA space is split into WSS_HEATMAP_REGIONS regions. Each row counts the pages in each region
+ *  that were touched, summed over a run of sweeps. If the run outlasts WSS_HEATMAP_ROWS rows, we merge
+ *  rows in pairs, so the heatmap always covers the whole run. It is written as CSV at exit.
+ *
+ *  Pages in large pages have no PTEs to age, so they are not counted. Only policies that use the ager
+ *  have sweeps to sample, so we refuse to run with any other.
+ */
+#define WSS_SAMPLE_RATE                 64          // A power of two
+#define WSS_WINDOWS                     9           // Windows of 1, 2, 4 ... 256 sweeps
+#define WSS_HEATMAP_REGIONS             128
+#define WSS_HEATMAP_ROWS                1024
+
+#if WSS_SAMPLING
+/*
+ *  Allocates our samples and heatmap. Called at startup, before any thread can fault.
+ */
+VOID initialize_working_set(VOID);
+
+/*
+ *  Called by the ager at the start and end of each sweep, and for each valid PTE in between,
+ *  with the age class it has just been given.
+ */
+VOID begin_working_set_sweep(VOID);
+VOID record_working_set_page(ULONG64 pte_index, ULONG age_class);
+VOID end_working_set_sweep(LONG64 age_histogram[PTE_AGE_CLASSES]);
+
+/*
+ *  Called by the fault handler once it has resolved a fault, soft or hard, on the page at pte_index.
+ */
+VOID record_working_set_fault(ULONG64 pte_index);
+
+/*
+ *  Prints the average and peak WSS, in MB, for each window.
+ */
+VOID print_working_set(VOID);
+
+/*
+ *  Writes the heatmap: one row per run of sweeps, one column per VA region.
+ */
+VOID write_heatmap_csv(const char *file_name);
+#endif
@@ -3,16 +3,41 @@
 //
 
 #include "writer.h"
+#include "../utils/phase_profiler.h"
+#include "../utils/trace.h"
+#include "../utils/probes.h"
+#include "../utils/cpu_counters.h"
+
+// Takes pages from the head of the (locked, freshly written) batch and gives one to each waiting thread.
+// Returns the number of pages handed off.
+ULONG64 hand_off_pages_to_waiters(PPAGE_LIST batch, ULONG64 batch_size) {
+
+    ULONG64 handed_off = 0;
+    while (handed_off < batch_size) {
+        PPAGE_WAITER waiter = dequeue_page_waiter();
+        if (waiter == NULL) break;
+
+        // The page goes straight to the waiter, as though it had gone to standby and been taken from there.
+        PPFN pfn = remove_from_head_of_list(batch);
+        map_pte_to_disk(pfn->PTE, pfn->fields.disk_index);
+        set_PFN_free(pfn);
+        hand_page_to_waiter(waiter, pfn);
+        handed_off++;
+    }
+
+    if (handed_off > 0) InterlockedAdd64(&stats.n_page_handoffs, (LONG64) handed_off);
+    return handed_off;
+}
 
 ULONG64 write_pages(VOID) {
 
     // PFN for the current page being selected for disk write.
     PPFN pfn;
 
-    // The upper bound on the size of THIS particular batch. This will be set to the max, then (possibly)
-    // brought lower by the disk slot allocation, then (possibly) brought lower by the number of pages
-    // that can be removed from the modified list.
-    ULONG64 target_page_count = MAX_WRITE_BATCH_SIZE;
+    // The upper bound on the size of THIS particular batch. This will be set to what the scheduler asked for,
+    // then (possibly) brought lower by the disk slot allocation, then (possibly) brought lower by the number
+    // of pages that can be removed from the modified list.
+    ULONG64 target_page_count = get_write_batch_target();
 
     // Let's get a sense of how many modified pages we can reasonably expect. There may be more (from trimming)
     // or fewer (from soft faults), but this gives us an estimate.
@@ -26,9 +51,11 @@ ULONG64 write_pages(VOID) {
 
     // Let's see if we need any slots at all:
     // If our stash is too small, we will get more.
+    PHASE_BEGIN(PHASE_WRITE_DISK_SLOTS);
     if (pf.num_stashed_slots < target_page_count) {
         set_and_add_slots_to_stack(target_page_count);
     }
+    PHASE_END(PHASE_WRITE_DISK_SLOTS);
 
     // If we couldn't batch enough slots, we will need to return.
     // Note that we did not release our stashed slots!
@@ -47,6 +74,7 @@ ULONG64 write_pages(VOID) {
     USHORT misses = 0;
     PPFN batch_first;
 
+    PHASE_BEGIN(PHASE_WRITE_GATHER);
     while (num_pages_in_write_batch < target_page_count) {
 
         // First, remove as many pages as we can from the modified list.
@@ -80,6 +108,7 @@ ULONG64 write_pages(VOID) {
         // Update our running total number of pages batched
         num_pages_in_write_batch += current_batch_size;
     }
+    PHASE_END(PHASE_WRITE_GATHER);
 
     // If we couldn't get any pages, we will return.
     if (num_pages_in_write_batch == 0) return 0;
@@ -92,7 +121,9 @@ ULONG64 write_pages(VOID) {
     }
 
     // Map all pages to the kernel VA space
+    PHASE_BEGIN(PHASE_WRITE_MAP);
     map_pages(num_pages_in_write_batch, vm.kernel_write_va, frame_numbers_to_map);
+    PHASE_END(PHASE_WRITE_MAP);
 
     // Flag to indicate that SOME pages were successfully written
     LONG64 pages_written = 0;
@@ -102,6 +133,7 @@ ULONG64 write_pages(VOID) {
     PAGE_LIST temp_list;
     initialize_page_list(&temp_list);
 
+    PHASE_BEGIN(PHASE_WRITE_COPY);
     for (ULONG64 i = 0; i < num_pages_in_write_batch; i++) {
 
         // Get the current page
@@ -149,31 +181,42 @@ ULONG64 write_pages(VOID) {
         }
     }
 
+    PHASE_END(PHASE_WRITE_COPY);
+
     // Un-map kernal VA
+    PHASE_BEGIN(PHASE_WRITE_UNMAP);
     unmap_pages(num_pages_in_write_batch, vm.kernel_write_va);
+    PHASE_END(PHASE_WRITE_UNMAP);
 
     // If no pages were written, exit
     if (pages_written == 0) return 0;
 
-    // Add ALL pages to standby list by updating flinks and blinks of head/tail
+    // Before anything goes on standby, serve the threads waiting for pages, in the order they arrived.
+    PHASE_BEGIN(PHASE_WRITE_RELEASE);
+    LONG64 pages_to_standby = pages_written - (LONG64) hand_off_pages_to_waiters(&temp_list, pages_written);
+    if (pages_to_standby == 0) {
+        PHASE_END(PHASE_WRITE_RELEASE);
+        return pages_written;
+    }
+
+    // Add ALL remaining pages to standby list by updating flinks and blinks of head/tail
     // of page batch as well as head/tail of standby list
     insert_list_to_tail_list(&standby_list, &temp_list);
-    change_list_size(&standby_list, pages_written);
+    change_list_size(&standby_list, pages_to_standby);
+    PROBE_LIST_BATCH(LIST_ID_STANDBY, PROBE_LIST_INSERT, pages_to_standby);
 
     // Unlock all pages in the batch!
     pfn = temp_list.head->flink;
     PPFN next;
-    for (int i = 0; i < pages_written; ++i) {
+    for (int i = 0; i < pages_to_standby; ++i) {
         next = pfn->flink;
         unlock_pfn(pfn);
         pfn = next;
     }
 
     // Increase available count
-    increase_available_count(pages_written);
-
-    // Broadcast to waiting user threads that there are standby pages ready.
-    if (pages_written > 0) SetEvent(standby_pages_ready_event);
+    increase_available_count(pages_to_standby);
+    PHASE_END(PHASE_WRITE_RELEASE);
 
     return pages_written;
 }
@@ -188,31 +231,49 @@ VOID write_pages_thread(void) {
     HANDLE events[2];
     events[ACTIVE_EVENT_INDEX] = initiate_writing_event;
     events[EXIT_EVENT_INDEX] = system_exit_event;
+    TRACE_THREAD_NAME("writer", 0);
 
     while (TRUE) {
 
+        TRACE_BEGIN(TRACE_WAIT, TRACE_WAIT_WORK);
         if (WaitForMultipleObjects(ARRAYSIZE(events), events, FALSE, INFINITE)
             == EXIT_EVENT_INDEX) return;
-
-        LONGLONG start_time = get_timestamp();
-
-        // Before removing pages from the modified list, we should check to see if
-        // the trimmer needs to start up again to replenish what we are going to take.
-        signal_event_if_list_is_about_to_run_low(   &modified_list,
-                                                    initiate_trimming_event,
-                                                    TRIMMING_THREAD_ID,
-                                                    LOW_PAGE_THRESHOLD);
-
-        // Once woken, begin writing a batch of pages. Then go back to sleep.
-        ULONG64 batch_size = write_pages();
-
-        // Record the runtime to update future estimates
-        LONGLONG end_time = get_timestamp();
-        double difference = get_time_difference(end_time, start_time);
-        update_estimated_job_time(WRITING_THREAD_ID, difference);
+        TRACE_END(TRACE_WAIT, TRACE_WAIT_WORK);
+
+        // Once woken, write batches of pages until reclaim is done. Then go back to sleep.
+        ULONG64 batch_size;
+        while (TRUE) {
+            LONGLONG start_time = get_timestamp();
+
+            TRACE_BEGIN(TRACE_WRITE_BATCH, 0);
+            COUNTERS_BEGIN();
+            batch_size = write_pages();
+            COUNTERS_END(COUNTER_PATH_WRITE, batch_size);
+            TRACE_END(TRACE_WRITE_BATCH, (ULONG) batch_size);
+
+            // Record the runtime to update future estimates
+            LONGLONG end_time = get_timestamp();
+            double difference = get_time_difference(end_time, start_time);
+            update_estimated_job_time(WRITING_THREAD_ID, difference);
+            InterlockedAdd64(&stats.n_written, (LONG64) batch_size);
+            InterlockedAdd64(&stats.write_time, end_time - start_time);
 
 #if STATS_MODE
-        record_batch_size_and_time(difference, batch_size, WRITING_THREAD_ID);
+            record_batch_size_and_time(difference, batch_size, WRITING_THREAD_ID);
 #endif
+            // The pages we wrote are available now, so throttled threads may be able to go.
+            release_throttled_threads_if_above_min();
+
+            if (!should_continue_writing()) break;
+
+            // We are still below high with nothing to write. Reclaim stays active while the trimmers catch
+            // up, and we wait for their next batch (or the scheduler's next push) before writing again.
+            if (batch_size == 0) {
+                TRACE_BEGIN(TRACE_WAIT, TRACE_WAIT_WORK);
+                if (WaitForMultipleObjects(ARRAYSIZE(events), events, FALSE, WRITER_IDLE_TIMEOUT_IN_MILLISECONDS)
+                    == EXIT_EVENT_INDEX) return;
+                TRACE_END(TRACE_WAIT, TRACE_WAIT_WORK);
+            }
+        }
     }
-}
\ No newline at end of file
+}
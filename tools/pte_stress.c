@@ -0,0 +1,249 @@
+/*
+ *  Stress test for the lock-free PTE transitions. Runs the whole memory manager on a small VA range, so
+ *  that faults, trims, writes and (with AGING) aging sweeps keep landing on the same few PTEs at once:
+ *
+ *      MemoryManagerStress [# user threads] [accesses per thread] [pages of memory] [pages on disk]
+ *
+ *  Each user thread stamps every page it touches with the page's own VA, and checks that stamp on every
+ *  access. A page that comes back from transition or disk with anything but zero (never written) or its
+ *  own VA has lost its contents to a race between valid, transition and disk.
+ *
+ *  Once every thread has stopped, we walk every PTE and PFN and check that they agree:
+ *
+ *      valid PTE       its frame is active, and points back at the PTE; its block is marked active
+ *      transition PTE  its frame is modified or standby, and points back at the PTE
+ *      disk PTE        its slot is in use, and held by no other PTE or standby page
+ *      any PTE         unlocked
+ *      any PFN         not mid-trim or mid-write; on no more and no fewer lists than its status says
+ *
+ *  Exits with 0 if all is well, or 1 after printing what went wrong.
+ */
+
+#include "../threads/initializer.h"
+#include "../threads/page_fault_handler.h"
+#include "../threads/pressure.h"
+
+#define STRESS_USER_THREADS             16
+#define STRESS_ACCESSES_PER_THREAD      (1 << 20)
+#define STRESS_PHYSICAL_PAGES           512
+#define STRESS_PAGES_IN_PAGE_FILE       512
+#define MAX_REPORTED_VIOLATIONS         32
+
+static volatile LONG64 corrupted_accesses;
+static ULONG64 violations;
+
+static VOID report_violation(const char *what, ULONG64 index, ULONG64 value) {
+    if (violations++ < MAX_REPORTED_VIOLATIONS) {
+        printf("  %s (index %llu, value 0x%llx)\n", what, index, value);
+    }
+}
+
+/*
+ *  The stress test supplies the user threads' work in place of the simulator's: uniformly random pages
+ *  of our small VA range, each one checked and stamped on every access.
+ */
+void run_user_app_simulation(PUSER_THREAD_INFO user_thread_info) {
+
+    WaitForSingleObject(system_start_event, INFINITE);
+#if PRESSURE_STALL_INFO
+    begin_stall_accounting(user_thread_info);
+#endif
+
+    ULONG64 num_pages = vm.va_size_in_bytes / PAGE_SIZE;
+
+    for (ULONG64 i = 0; i < vm.iterations; i++) {
+        ULONG64 page = xorshift64(&user_thread_info->random_seed) % num_pages;
+        PULONG_PTR va = (PULONG_PTR) ((ULONG_PTR) vm.application_va_base + page * PAGE_SIZE);
+
+        BOOL page_faulted;
+        do {
+            page_faulted = FALSE;
+            __try {
+                ULONG_PTR contents = *va;
+                if (contents != 0 && contents != (ULONG_PTR) va) {
+                    if (InterlockedIncrement64(&corrupted_accesses) <= MAX_REPORTED_VIOLATIONS) {
+                        printf("  page %llu holds 0x%llx, not its own VA\n", page, (ULONG64) contents);
+                    }
+                }
+                *va = (ULONG_PTR) va;
+#if AGING
+                set_accessed_bit(va);
+#endif
+            }
+            __except (EXCEPTION_EXECUTE_HANDLER) {
+                page_faulted = TRUE;
+                if (!page_fault_handler(va, user_thread_info)) {
+                    fatal_error("Stress test faulted on a VA outside its range.");
+                }
+            }
+        } while (page_faulted);
+    }
+#if PRESSURE_STALL_INFO
+    end_stall_accounting(user_thread_info);
+#endif
+}
+
+static BOOL is_disk_slot_in_use(ULONG64 slot) {
+    return (pf.page_file_bitmaps[BITMAP_ROW(slot)] >> BITMAP_OFFSET(slot)) & 1;
+}
+
+// Each slot may be held by one disk PTE or one standby page, never two.
+static VOID claim_disk_slot(PULONG64 claimed, ULONG64 slot, const char *holder) {
+    if (slot == NO_DISK_INDEX || slot > pf.max_disk_index) {
+        report_violation(holder, slot, 0);
+        return;
+    }
+    if (!is_disk_slot_in_use(slot)) report_violation("disk slot held but marked empty", slot, 0);
+    if (claimed[BITMAP_ROW(slot)] & (1ULL << BITMAP_OFFSET(slot))) {
+        report_violation("disk slot held twice", slot, 0);
+    }
+    claimed[BITMAP_ROW(slot)] |= 1ULL << BITMAP_OFFSET(slot);
+}
+
+static VOID check_ptes(PULONG64 claimed_slots) {
+
+    for (ULONG64 table = 0; table < vm.num_page_tables; table++) {
+        PDE pde = PDE_base[table];
+        if (IS_PDE_LOCKED(&pde)) report_violation("PDE left locked", table, pde.entire_pde);
+
+        // A large page has no PTEs in use; its frames are checked from the PFN side.
+        if (IS_PDE_LARGE(&pde) || !IS_PDE_PRESENT(&pde)) continue;
+
+        PPTE page_table = PTE_base + table * PTES_PER_PAGE_TABLE;
+        for (ULONG64 i = 0; i < PTES_PER_PAGE_TABLE && table * PTES_PER_PAGE_TABLE + i < vm.num_ptes; i++) {
+            PPTE pte = page_table + i;
+            ULONG64 index = (ULONG64) (pte - PTE_base);
+            PTE snapshot = *pte;
+
+            if (IS_PTE_LOCKED(&snapshot)) report_violation("PTE left locked", index, snapshot.entire_pte);
+
+            if (IS_PTE_VALID(&snapshot)) {
+                PPFN pfn = get_PFN_from_frame(snapshot.memory_format.frame_number);
+                if (!IS_PFN_ACTIVE(pfn)) report_violation("valid PTE's frame is not active", index, pfn->fields.status);
+                if (pfn->PTE != pte) report_violation("valid PTE's frame points elsewhere", index, (ULONG64) pfn->PTE);
+
+                ULONG64 block = PTE_BLOCK_INDEX(pte);
+                if (!(active_pte_bitmap[block / 64] & (1LL << (block % 64)))) {
+                    report_violation("valid PTE in an inactive block", index, block);
+                }
+            } else if (IS_PTE_TRANSITION(&snapshot)) {
+                PPFN pfn = get_PFN_from_frame(snapshot.transition_format.frame_number);
+                if (!IS_PFN_MODIFIED(pfn) && !IS_PFN_STANDBY(pfn)) {
+                    report_violation("transition PTE's frame is neither modified nor standby", index, pfn->fields.status);
+                }
+                if (pfn->PTE != pte) report_violation("transition PTE's frame points elsewhere", index, (ULONG64) pfn->PTE);
+            } else if (IS_PTE_ON_DISK(&snapshot)) {
+                claim_disk_slot(claimed_slots, snapshot.disk_format.disk_index, "disk PTE without a slot");
+            } else if (!IS_PTE_ZEROED(&snapshot)) {
+                report_violation("PTE in no known state", index, snapshot.entire_pte);
+            }
+        }
+    }
+}
+
+static VOID check_pfns(PULONG64 claimed_slots) {
+
+    LONG64 free_pages = 0;
+    LONG64 modified_pages = 0;
+    LONG64 standby_pages = 0;
+
+    for (ULONG64 i = 0; i < vm.allocated_frame_count; i++) {
+        ULONG_PTR frame = vm.allocated_frame_numbers[i];
+        PPFN pfn = get_PFN_from_frame(frame);
+        PPTE pte = pfn->PTE;
+
+        switch (pfn->fields.status) {
+            case PFN_FREE:
+                free_pages++;
+                break;
+
+            case PFN_ACTIVE: {
+                PPDE pde = get_PDE_from_PTE(pte);
+                if (IS_PDE_LARGE(pde)) {
+                    ULONG64 offset = (ULONG64) (pte - PTE_base) % PTES_PER_PAGE_TABLE;
+                    if (pde->large_format.frame_number + offset != frame) {
+                        report_violation("large page frame out of place", frame, pde->large_format.frame_number);
+                    }
+                } else if (!IS_PTE_VALID(pte) || pte->memory_format.frame_number != frame) {
+                    report_violation("active frame's PTE does not map it", frame, pte->entire_pte);
+                }
+                break;
+            }
+
+            case PFN_STANDBY:
+                standby_pages++;
+                claim_disk_slot(claimed_slots, pfn->fields.disk_index, "standby page without a slot");
+                // Fall through: a standby page's PTE is in transition, too.
+            case PFN_MODIFIED:
+                if (pfn->fields.status == PFN_MODIFIED) modified_pages++;
+                if (!IS_PTE_TRANSITION(pte) || pte->transition_format.frame_number != frame) {
+                    report_violation("trimmed frame's PTE is not in transition to it", frame, pte->entire_pte);
+                }
+                break;
+
+            default:
+                report_violation("frame left mid-trim or mid-write", frame, pfn->fields.status);
+                break;
+        }
+    }
+
+    // Free pages are on the free lists, in the user threads' caches, or (with LARGE_PAGES) in the pool.
+    LONG64 listed_free = read_counter_exact(&free_lists.page_count);
+    for (ULONG i = 0; i < vm.num_user_threads; i++) {
+        listed_free += user_thread_info[i].free_page_count;
+    }
+#if LARGE_PAGES
+    listed_free += large_page_pool.page_count;
+#endif
+    if (free_pages != listed_free) report_violation("free frames not all listed", free_pages, listed_free);
+    if (modified_pages != modified_list.list_size) report_violation("modified list miscounted", modified_pages, modified_list.list_size);
+    if (standby_pages != standby_list.list_size) report_violation("standby list miscounted", standby_pages, standby_list.list_size);
+}
+
+int main(int argc, char** argv) {
+
+    set_defaults();
+    vm.num_user_threads = argc > 1 ? strtol(argv[1], NULL, 10) : STRESS_USER_THREADS;
+    vm.iterations = argc > 2 ? strtoull(argv[2], NULL, 10) : STRESS_ACCESSES_PER_THREAD;
+    vm.allocated_frame_count = argc > 3 ? strtoull(argv[3], NULL, 10) : STRESS_PHYSICAL_PAGES;
+    vm.pages_in_page_file = argc > 4 ? strtoull(argv[4], NULL, 10) : STRESS_PAGES_IN_PAGE_FILE;
+
+    initialize_system();
+    printf("Stressing %llu PTEs over %llu frames with %lu threads, %llu accesses each...\n",
+           vm.num_ptes, vm.allocated_frame_count, vm.num_user_threads, vm.iterations);
+
+    LONGLONG start = get_timestamp();
+    SetEvent(system_start_event);
+    WaitForMultipleObjects(vm.num_user_threads, user_threads, TRUE, INFINITE);
+
+    // Stop every worker, so nothing moves while we check.
+    SetEvent(system_exit_event);
+    WaitForMultipleObjects(NUM_TRIMMER_THREADS, trimming_threads, TRUE, INFINITE);
+#if AGING
+    WaitForSingleObject(aging_thread, INFINITE);
+#endif
+    WaitForSingleObject(writing_thread, INFINITE);
+#if PRUNING
+    WaitForSingleObject(pruning_thread, INFINITE);
+#endif
+#if SCHEDULING
+    WaitForSingleObject(scheduling_thread, INFINITE);
+#endif
+    printf("Ran in %.3f s: %lld hard faults, %lld soft faults, %llu pages trimmed.\n",
+           get_time_difference(get_timestamp(), start),
+           read_counter_exact(&stats.n_hard), read_counter_exact(&stats.n_soft), stats.n_trimmed);
+
+    PULONG64 claimed_slots = zero_malloc(pf.page_file_bitmap_rows * sizeof(ULONG64));
+    check_ptes(claimed_slots);
+    check_pfns(claimed_slots);
+
+    violations += (ULONG64) corrupted_accesses;
+    if (violations == 0) {
+        printf("All PTE and PFN invariants hold.\n");
+    } else {
+        printf("%llu violations (%lld corrupted accesses).\n", violations, corrupted_accesses);
+    }
+
+    free_all_data_and_shut_down();
+    return violations == 0 ? 0 : 1;
+}
@@ -0,0 +1,117 @@
+/*
+ *  Tails the live statistics of a running MemoryManager (see utils/live_stats_layout.h), printing one
+ *  line per interval until the run finishes. Start it before or during a run:
+ *
+ *      MemoryManagerStats [interval in milliseconds (optional)]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../utils/live_stats_layout.h"
+
+#define DEFAULT_READ_INTERVAL_IN_MILLISECONDS       1000
+#define WAIT_FOR_RUN_IN_MILLISECONDS                250
+#define MAX_READ_ATTEMPTS                           1000
+
+/*
+ *  Copies the shared stats, retrying while the scheduler is partway through an update.
+ *  Returns FALSE if we could not get a consistent copy in MAX_READ_ATTEMPTS tries.
+ */
+static BOOL read_live_stats(PLIVE_STATS shared, PLIVE_STATS copy) {
+
+    for (ULONG attempt = 0; attempt < MAX_READ_ATTEMPTS; attempt++) {
+        LONG64 before = ReadAcquire64(&shared->sequence);
+
+        // An odd sequence means an update is in progress.
+        if (before & 1) {
+            YieldProcessor();
+            continue;
+        }
+
+        memcpy(copy, (const void *) shared, sizeof(LIVE_STATS));
+
+        // Our copy must be complete before we look at the sequence again.
+        MemoryBarrier();
+        if (ReadNoFence64(&shared->sequence) == before) return TRUE;
+    }
+    return FALSE;
+}
+
+/*
+ *  Waits for a run to publish its stats, then maps them.
+ */
+static PLIVE_STATS open_live_stats(PHANDLE section) {
+
+    BOOL announced = FALSE;
+    while (TRUE) {
+        *section = OpenFileMappingA(FILE_MAP_READ, FALSE, LIVE_STATS_MAPPING_NAME);
+        if (*section != NULL) {
+            PLIVE_STATS shared = MapViewOfFile(*section, FILE_MAP_READ, 0, 0, sizeof(LIVE_STATS));
+            if (shared != NULL && ReadAcquire((volatile LONG *) &shared->magic) == LIVE_STATS_MAGIC) return shared;
+
+            if (shared != NULL) UnmapViewOfFile(shared);
+            CloseHandle(*section);
+        }
+
+        if (!announced) {
+            printf("Waiting for a MemoryManager run...\n");
+            announced = TRUE;
+        }
+        Sleep(WAIT_FOR_RUN_IN_MILLISECONDS);
+    }
+}
+
+static VOID print_live_stats(PLIVE_STATS s) {
+    printf("%8.1f s  avail %8lld (free %8lld  standby %8lld  modified %8lld  active %8lld)  "
+           "hard %9.0f/s  soft %9.0f/s  consumed %9.0f/s  slots %8lld  stalled %5.1f%% %5.1f%% %5.1f%%  %s\n",
+        s->seconds_elapsed, s->available_pages, s->free_pages, s->standby_pages, s->modified_pages,
+        s->active_pages, s->hard_faults_per_second, s->soft_faults_per_second, s->pages_consumed_per_second,
+        s->empty_disk_slots, 100 * s->pressure_some[0], 100 * s->pressure_some[1], 100 * s->pressure_some[2],
+        s->reclaim_active ? "reclaiming" : "idle");
+}
+
+int main(int argc, char **argv) {
+
+    ULONG interval = DEFAULT_READ_INTERVAL_IN_MILLISECONDS;
+    if (argc > 1) interval = max(1, strtoul(argv[1], NULL, 10));
+
+    HANDLE section;
+    PLIVE_STATS shared = open_live_stats(&section);
+
+    if (shared->version != LIVE_STATS_VERSION) {
+        printf("This run publishes live stats version %lu, but we read version %d.\n",
+            shared->version, LIVE_STATS_VERSION);
+        return 1;
+    }
+    printf("Watching process %lu (%llu pages of memory).\n", shared->process_id, shared->allocated_pages);
+
+    // If the run dies before it can mark itself finished, we stop once its process is gone.
+    HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, shared->process_id);
+
+    LIVE_STATS copy;
+    while (TRUE) {
+        if (!read_live_stats(shared, &copy)) {
+            printf("Could not get a consistent read of the live stats.\n");
+        } else if (copy.finished) {
+            print_live_stats(&copy);
+            printf("Run finished: %lld hard faults, %lld soft faults, %lld pages trimmed, %lld written, "
+                   "%lld faults throttled.\n",
+                copy.hard_faults, copy.soft_faults, copy.pages_trimmed, copy.pages_written, copy.throttled_faults);
+            break;
+        } else {
+            print_live_stats(&copy);
+        }
+
+        if (process != NULL && WaitForSingleObject(process, interval) == WAIT_OBJECT_0) {
+            printf("Process %lu exited without finishing its run.\n", copy.process_id);
+            break;
+        }
+        if (process == NULL) Sleep(interval);
+    }
+
+    if (process != NULL) CloseHandle(process);
+    UnmapViewOfFile(shared);
+    CloseHandle(section);
+    return 0;
+}
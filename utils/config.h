@@ -6,23 +6,47 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <Windows.h>
+#include "../data_structures/sharded_counter.h"
 
 // These switches turn on particular configurations for the program.
 #define LOGGING_MODE                0       // Outputs statistics to the console
 #define RUN_FOREVER                 0       // Does not stop user threads
 #define STATS_MODE                  0       // Collects data on page consumption
+#define TIME_SERIES                 0       // Records page states and rates over time, and writes them out (see time_series.h)
 #define AGING                       1       // Initiates aging of PTEs when accessed / trimmed
+#define WSS_SAMPLING                0       // Ager estimates working-set size and records a VA heatmap (see working_set.h)
 #define SCHEDULING                  1       // Adds a scheduling thread
 #define PRUNING                     0       // Turns on the pruning thread
 #define USER_SIMULATION             1       // Changes how memory is accessed (if 0, entirely random)
 #define DO_WORK_TO_SLOW_CONSUMPTION 0       // Adds additional work after successful access to VA
+#define LARGE_PAGES                 0       // Maps untouched, aligned 2 MB regions with a single large page
+#define DIRECT_RECLAIM              1       // Faulting threads reclaim pages themselves rather than wait for them
+#define AUTO_TUNING                 0       // Hill-climbs batch sizes while running, and saves them for later runs (not with LATENCY_SLO)
+#define LATENCY_SLO                 0       // Scheduler holds p99 fault latency to a target (see latency_slo.h)
+#define FAULT_HISTOGRAMS            0       // Times every fault, by outcome, and prints their percentiles at the end
+#define FAULT_LATENCY_CSV           0       // Also writes those percentiles to FAULT_LATENCY_CSV_FILE_NAME
+#define PHASE_PROFILING             0       // Breaks faults, writes and trims down into timed phases (see phase_profiler.h)
+#define EVENT_TRACING               0       // Records a timeline of every thread's events (see trace.h)
+#define LOCK_PROFILING              0       // Counts contention on each class of lock (see lock_profiler.h)
+#define CPU_COUNTERS                0       // Counts IPC, cache and TLB misses per fault and batch, through ETW (see cpu_counters.h)
+#define STATE_PROBES                1       // ETW probes on PFN, PTE and list transitions, free until enabled (see probes.h)
+#define PUBLISH_LIVE_STATS          1       // Publishes live counters to shared memory, for tools/stats_reader.c
+#define PRESSURE_STALL_INFO         1       // Tracks how much of the time user threads are stalled (see pressure.h)
+
+// We time faults for either of the above.
+#define TIME_FAULTS                 (LATENCY_SLO || FAULT_HISTOGRAMS)
+
+// We note how each fault was resolved for timing, tracing and CPU counters, and only then.
+#define TRACK_FAULT_OUTCOMES        (TIME_FAULTS || EVENT_TRACING || CPU_COUNTERS)
 
 #define NUM_WORKER_THREADS          5       // Writing, trimming, pruning, aging, scheduling
+#define NUM_TRIMMER_THREADS         4       // Trimmers, each working one partition of the PTEs at a time
 
 // Default runtimes to guide batch sizes and event signalling.
 #define DEFAULT_WRITE_DURATION                      0.01
 #define DEFAULT_TRIM_DURATION                       0.01
 #define DEFAULT_PRUNE_DURATION                      0.01
+#define DEFAULT_AGE_DURATION                        0.01
 #define AVAILABLE_PAGE_THRESHOLD                    4096
 #define ADDITIONAL_PAGE_BUFFER                      128
 #define DEFAULT_PAGE_CONSUMPTION_RATE               (1.0 * MB(300) / PAGE_SIZE)
@@ -46,6 +70,7 @@ typedef struct __vm_state {
     PULONG_PTR application_va_base;
     PULONG_PTR kernel_write_va;
     ULONG64 num_ptes;
+    ULONG64 num_page_tables;
 
     // PFN Data Structures
     ULONG_PTR max_frame_number;
@@ -69,15 +94,31 @@ extern VM vm;
 // Statistics struct
 typedef struct __stats {
     double page_consumption_per_second;
-    volatile LONG64 n_available;
-    volatile LONG64 *n_free;
+    SHARDED_COUNTER n_available;
+    PSHARDED_COUNTER n_free;
     volatile LONG64 *n_modified;
     volatile LONG64 *n_standby;
-    volatile LONG64 n_hard;
-    volatile LONG64 n_soft;
+    SHARDED_COUNTER n_hard;
+    SHARDED_COUNTER n_soft;
     volatile LONG64 wait_time;
-    volatile LONG64 hard_faults_missed;
+    volatile LONG64 n_page_waits;           // Every wait for a page handoff, served or not
+    volatile LONG64 hard_faults_missed;     // Waits that ended without a page, so the fault was retried
+    volatile LONG64 n_large_page_maps;
+    volatile LONG64 n_large_page_splits;
+    volatile LONG64 n_ghost_hits;
+    volatile LONG64 n_trimmed;
+    volatile LONG64 trim_time;
+    volatile LONG64 n_throttled;
+    volatile LONG64 throttle_time;
+    volatile LONG64 n_direct_reclaims;
+    volatile LONG64 direct_reclaim_time;
+    volatile LONG64 n_page_handoffs;
+    volatile LONG64 n_written;
+    volatile LONG64 write_time;
+    volatile LONG64 prune_time;
+    volatile LONG64 age_time;
     LONGLONG timer_frequency;
+    double cycles_per_second;
     double worker_runtimes[NUM_WORKER_THREADS];
 } STATS, *PSTATS;
 
@@ -89,18 +130,61 @@ extern STATS stats;
 #define DEFAULT_ITERATIONS              (MB(1))
 #define FREE_LIST_COUNT                 16
 
-// We will begin trimming and writing when our standby + free page count falls below this threshold.
-#define LOW_PAGE_THRESHOLD              512
+// Watermarks on available pages (see watermarks.h). Min is a share of memory; the low and high
+// watermarks are each at least one gap above the one beneath them.
+#define MIN_WATERMARK_PAGES             128
+#define MIN_WATERMARK_FRACTION          (0.002)
+#define WATERMARK_GAP_FRACTION          (0.01)
+#define THROTTLE_TIMEOUT_IN_MILLISECONDS    10
+
+// While reclaim is active but there is nothing to write, the writer waits this long for the trimmers.
+#define WRITER_IDLE_TIMEOUT_IN_MILLISECONDS 10
+
+// A thread waiting for a page gives up and looks again after this long.
+#define PAGE_WAIT_TIMEOUT_IN_MILLISECONDS   5
+
+// We will begin pruning when a free list is expected to fall below this threshold.
 #define PRUNING_THRESHOLD               128
 
-// These will change as we decide how many pages to write, read, or trim at once.
-#define MAX_WRITE_BATCH_SIZE            4096
+// These are capacities. The batch sizes we actually use start from the defaults, and are tuned
+// while we run (see tuner.h). The prune batch is not tuned, so it is always the full size.
+#define MAX_WRITE_BATCH_SIZE            8192
 #define MIN_WRITE_BATCH_SIZE            1
 #define MAX_READ_BATCH_SIZE             1
-#define MAX_TRIM_BATCH_SIZE             2048
+#define MAX_TRIM_BATCH_SIZE             4096
 #define MAX_FREE_BATCH_SIZE             1
 #define MAX_PRUNE_BATCH_SIZE            256
 
+#define DEFAULT_WRITE_BATCH_SIZE        4096
+#define DEFAULT_TRIM_BATCH_SIZE         2048
+
+// The p99 fault latency we hold to in latency SLO mode, unless one is given on the command line.
+#define DEFAULT_P99_TARGET_IN_MICROSECONDS      50.0
+
+// Per-outcome fault latency percentiles are written here, with FAULT_LATENCY_CSV on.
+#define FAULT_LATENCY_CSV_FILE_NAME             "fault_latencies.csv"
+
+// With TIME_SERIES on, we sample this often (down to one scheduler tick), into this many preallocated
+// samples, and write them here at exit -- as CSV, or with TIME_SERIES_BINARY on, as raw columns.
+#define TIME_SERIES_INTERVAL_IN_MILLISECONDS    10
+#define TIME_SERIES_SAMPLES                     (1 << 16)
+#define TIME_SERIES_BINARY                      0
+#define TIME_SERIES_FILE_NAME                   "time_series.csv"
+#define TIME_SERIES_BINARY_FILE_NAME            "time_series.bin"
+
+// With WSS_SAMPLING on, the heatmap of VA regions by access frequency is written here at exit.
+#define WSS_HEATMAP_FILE_NAME                   "heatmap.csv"
+
+// With EVENT_TRACING on, the timeline is written here as Chrome trace JSON.
+#define TRACE_FILE_NAME                         "trace.json"
+
+// Tuned batch sizes are saved here at the end of each tuning run, and loaded at the start of every run.
+#define TUNING_FILE_NAME                "MemoryManager.tuning"
+#define DIRECT_RECLAIM_BATCH_SIZE       8
+
+// At most this fraction of physical memory is set aside, at startup, as contiguous runs for large pages.
+#define LARGE_PAGE_POOL_FRACTION        (0.5)
+
 // Default pages in memory and page file, which are used to calculate VA span
 #define DEFAULT_NUMBER_OF_PHYSICAL_PAGES        (KB(256))
 #define DEFAULT_PAGES_IN_PAGE_FILE              (KB(128))
@@ -0,0 +1,391 @@
+#include <stddef.h>
+#include <evntrace.h>
+#include <evntcons.h>
+#include "cpu_counters.h"
+
+#if CPU_COUNTERS
+// {8d2e4b61-3c7a-4f15-9e08-b6a1d4c52f93}
+TRACELOGGING_DEFINE_PROVIDER(cpu_counters_provider,
+                             "MemoryManagerCounters",
+                             (0x8d2e4b61, 0x3c7a, 0x4f15, 0x9e, 0x08, 0xb6, 0xa1, 0xd4, 0xc5, 0x2f, 0x93));
+
+// The kernel's thread and performance event classes, and the two events we attach our counters to
+static const GUID thread_event_guid =
+    { 0x3d6fa8d1, 0xfe05, 0x11d0, { 0x9d, 0xda, 0x00, 0xc0, 0x4f, 0xd7, 0xba, 0x7c } };
+static const GUID perf_info_event_guid =
+    { 0xce1dbfb4, 0x137e, 0x4da6, { 0x87, 0xb0, 0x3f, 0x59, 0xaa, 0x10, 0x2c, 0xbc } };
+#define CONTEXT_SWITCH_OPCODE           36
+#define SYSTEM_CALL_ENTER_OPCODE        51
+
+#define PROFILE_SOURCE_LIST_SIZE        (64 * 1024)
+#define NO_PMC_SLOT                     MAXULONG
+
+// Our session's buffers, in KB. Every system call on the machine lands in them, so we give them plenty.
+#define COUNTER_SESSION_BUFFER_SIZE     1024
+#define COUNTER_SESSION_MIN_BUFFERS     64
+#define COUNTER_SESSION_MAX_BUFFERS     512
+
+// The names a counter's profile source may go by, in the order we look for them.
+static const WCHAR *pmc_source_names[PMC_COUNTERS][2] = {
+    [PMC_CYCLES]        = { L"UnhaltedCoreCycles", L"TotalCycles" },
+    [PMC_INSTRUCTIONS]  = { L"InstructionRetired", L"TotalIssues" },
+    [PMC_LLC_MISSES]    = { L"LLCMisses", NULL },
+    [PMC_DTLB_MISSES]   = { L"DTLBMisses", NULL },
+};
+
+// Where each counter sits in the values ETW attaches to an event, or NO_PMC_SLOT if we are not counting it.
+static ULONG pmc_slots[PMC_COUNTERS];
+static ULONG pmc_slot_count;
+
+typedef struct __session_properties {
+    EVENT_TRACE_PROPERTIES properties;
+    WCHAR name[ARRAYSIZE(COUNTER_SESSION_NAME)];
+} SESSION_PROPERTIES;
+
+static TRACEHANDLE counter_session;
+static TRACEHANDLE counter_consumer;
+static HANDLE counter_consumer_thread;
+static ULONG64 events_lost;
+static ULONG64 buffers_lost;
+
+// What a CPU's counters read at its last context switch, and at its last event with counters since.
+typedef struct __processor_counters {
+    BOOL switched;
+    ULONG64 at_switch[PMC_COUNTERS];
+    ULONG64 latest[PMC_COUNTERS];
+} PROCESSOR_COUNTERS, *PPROCESSOR_COUNTERS;
+
+// One of our threads: its counts over every time slice it has finished, and where its current path began.
+typedef struct __counted_thread {
+    ULONG thread_id;
+    BOOL in_path;
+    ULONG64 switches;
+    ULONG64 counts[PMC_COUNTERS];
+    ULONG64 path_start_switches;
+    ULONG64 path_start[PMC_COUNTERS];
+} COUNTED_THREAD, *PCOUNTED_THREAD;
+
+typedef struct __path_counters {
+    ULONG64 events;
+    ULONG64 units;
+    ULONG64 switches;
+    ULONG64 counts[PMC_COUNTERS];
+} PATH_COUNTERS, *PPATH_COUNTERS;
+
+// Only the consumer thread touches these until it has stopped.
+static PPROCESSOR_COUNTERS processors;
+static ULONG processor_count;
+static COUNTED_THREAD counted_threads[MAX_COUNTED_THREADS];
+static PATH_COUNTERS path_counters[COUNTER_PATHS];
+static ULONG64 paths_not_counted;
+
+static const char *get_counter_path_name(ULONG path) {
+    if (path == COUNTER_PATH_TRIM) return "page trimmed";
+    if (path == COUNTER_PATH_WRITE) return "page written";
+    return fault_outcome_names[path - COUNTER_PATH_FAULT];
+}
+
+static BOOL find_profile_source(PUCHAR source_list, const WCHAR *name, PULONG source) {
+    PPROFILE_SOURCE_INFO info = (PPROFILE_SOURCE_INFO) source_list;
+    while (TRUE) {
+        if (wcscmp(info->Description, name) == 0) {
+            *source = info->Source;
+            return TRUE;
+        }
+        if (info->NextEntryOffset == 0) return FALSE;
+        info = (PPROFILE_SOURCE_INFO) ((PUCHAR) info + info->NextEntryOffset);
+    }
+}
+
+// Picks a profile source for each counter this machine offers, and gives it the next slot.
+static BOOL find_pmc_sources(ULONG sources[PMC_COUNTERS]) {
+    PUCHAR source_list = zero_malloc(PROFILE_SOURCE_LIST_SIZE);
+    ULONG length = 0;
+    if (TraceQueryInformation(0, TraceProfileSourceListInfo, source_list, PROFILE_SOURCE_LIST_SIZE, &length)
+        != ERROR_SUCCESS || length == 0) {
+        free(source_list);
+        return FALSE;
+    }
+
+    pmc_slot_count = 0;
+    for (ULONG counter = 0; counter < PMC_COUNTERS; counter++) {
+        pmc_slots[counter] = NO_PMC_SLOT;
+        for (ULONG i = 0; i < ARRAYSIZE(pmc_source_names[counter]); i++) {
+            const WCHAR *name = pmc_source_names[counter][i];
+            if (name == NULL || !find_profile_source(source_list, name, &sources[pmc_slot_count])) continue;
+            pmc_slots[counter] = pmc_slot_count++;
+            break;
+        }
+    }
+
+    free(source_list);
+    return pmc_slot_count > 0;
+}
+
+static VOID initialize_session_properties(SESSION_PROPERTIES *properties) {
+    memset(properties, 0, sizeof(SESSION_PROPERTIES));
+    properties->properties.Wnode.BufferSize = sizeof(SESSION_PROPERTIES);
+    properties->properties.Wnode.Flags = WNODE_FLAG_TRACED_GUID;
+    properties->properties.Wnode.ClientContext = 1;
+    properties->properties.LogFileMode = EVENT_TRACE_REAL_TIME_MODE | EVENT_TRACE_SYSTEM_LOGGER_MODE;
+    properties->properties.BufferSize = COUNTER_SESSION_BUFFER_SIZE;
+    properties->properties.MinimumBuffers = COUNTER_SESSION_MIN_BUFFERS;
+    properties->properties.MaximumBuffers = COUNTER_SESSION_MAX_BUFFERS;
+    properties->properties.LoggerNameOffset = offsetof(SESSION_PROPERTIES, name);
+}
+
+static PCOUNTED_THREAD find_counted_thread(ULONG thread_id, BOOL add) {
+
+    // Thread IDs are multiples of four.
+    ULONG index = (thread_id / 4) % MAX_COUNTED_THREADS;
+    for (ULONG probes = 0; probes < MAX_COUNTED_THREADS; probes++) {
+        PCOUNTED_THREAD thread = &counted_threads[index];
+        if (thread->thread_id == thread_id) return thread;
+        if (thread->thread_id == 0) {
+            if (!add) return NULL;
+            thread->thread_id = thread_id;
+            return thread;
+        }
+        index = (index + 1) % MAX_COUNTED_THREADS;
+    }
+    return NULL;
+}
+
+static PULONG64 get_pmc_values(PEVENT_RECORD record) {
+    for (USHORT i = 0; i < record->ExtendedDataCount; i++) {
+        PEVENT_HEADER_EXTENDED_DATA_ITEM item = &record->ExtendedData[i];
+        if (item->ExtType == EVENT_HEADER_EXT_TYPE_PMC_COUNTERS && item->DataSize >= pmc_slot_count * sizeof(ULONG64)) {
+            return (PULONG64) item->DataPtr;
+        }
+    }
+    return NULL;
+}
+
+static VOID record_context_switch(PPROCESSOR_COUNTERS processor, PEVENT_RECORD record, PULONG64 values) {
+
+    // The CSwitch payload begins with the thread switched in, then the thread switched out. The thread
+    // switched out has had this CPU since its last switch, so everything counted since is its own.
+    if (processor->switched && record->UserDataLength >= 2 * sizeof(ULONG)) {
+        PCOUNTED_THREAD thread = find_counted_thread(((PULONG) record->UserData)[1], FALSE);
+        if (thread != NULL) {
+            for (ULONG slot = 0; slot < pmc_slot_count; slot++) {
+                thread->counts[slot] += values[slot] - processor->at_switch[slot];
+            }
+            thread->switches++;
+        }
+    }
+    memcpy(processor->at_switch, values, pmc_slot_count * sizeof(ULONG64));
+    processor->switched = TRUE;
+}
+
+static VOID record_path_event(PPROCESSOR_COUNTERS processor, PEVENT_RECORD record) {
+    PCOUNTED_THREAD thread = find_counted_thread(record->EventHeader.ThreadId, TRUE);
+    if (thread == NULL) return;
+
+    // Until this CPU has switched once, we cannot tell whose its counts are.
+    if (!processor->switched) {
+        if (thread->in_path) paths_not_counted++;
+        thread->in_path = FALSE;
+        return;
+    }
+
+    // Our counts so far: every time slice we have finished, plus this one up to the system call that wrote
+    // our event -- the last event with counters on this CPU.
+    ULONG64 counts[PMC_COUNTERS];
+    for (ULONG slot = 0; slot < pmc_slot_count; slot++) {
+        counts[slot] = thread->counts[slot] + processor->latest[slot] - processor->at_switch[slot];
+    }
+
+    if (record->EventHeader.EventDescriptor.Opcode == WINEVENT_OPCODE_START) {
+        memcpy(thread->path_start, counts, pmc_slot_count * sizeof(ULONG64));
+        thread->path_start_switches = thread->switches;
+        thread->in_path = TRUE;
+        return;
+    }
+
+    // A path that began before we were listening has no start to count from.
+    if (!thread->in_path || record->UserDataLength < sizeof(ULONG) + sizeof(ULONG64)) {
+        paths_not_counted++;
+        return;
+    }
+    thread->in_path = FALSE;
+
+    // TraceLogging packs our fields with no padding: the path, then the units of work.
+    ULONG path;
+    ULONG64 units;
+    memcpy(&path, record->UserData, sizeof(ULONG));
+    memcpy(&units, (PUCHAR) record->UserData + sizeof(ULONG), sizeof(ULONG64));
+    if (path >= COUNTER_PATHS) return;
+
+    PPATH_COUNTERS totals = &path_counters[path];
+    totals->events++;
+    totals->units += units;
+    totals->switches += thread->switches - thread->path_start_switches;
+    for (ULONG slot = 0; slot < pmc_slot_count; slot++) {
+        totals->counts[slot] += counts[slot] - thread->path_start[slot];
+    }
+}
+
+static VOID WINAPI on_counter_event(PEVENT_RECORD record) {
+    ULONG cpu = GetEventProcessorIndex(record);
+    if (cpu >= processor_count) return;
+
+    PPROCESSOR_COUNTERS processor = &processors[cpu];
+    PEVENT_HEADER header = &record->EventHeader;
+    PULONG64 values = get_pmc_values(record);
+
+    if (values != NULL) {
+        if (IsEqualGUID(&header->ProviderId, &thread_event_guid) &&
+            header->EventDescriptor.Opcode == CONTEXT_SWITCH_OPCODE) {
+            record_context_switch(processor, record, values);
+        }
+        memcpy(processor->latest, values, pmc_slot_count * sizeof(ULONG64));
+        return;
+    }
+
+    if (IsEqualGUID(&header->ProviderId, TraceLoggingProviderId(cpu_counters_provider))) {
+        record_path_event(processor, record);
+    }
+}
+
+static DWORD WINAPI consume_counter_events(LPVOID parameter) {
+    UNREFERENCED_PARAMETER(parameter);
+
+    // Returns once our session has stopped, and we have had its last events.
+    ProcessTrace(&counter_consumer, 1, NULL, NULL);
+    return 0;
+}
+
+VOID start_cpu_counters(VOID) {
+    processor_count = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+    processors = zero_malloc(processor_count * sizeof(PROCESSOR_COUNTERS));
+
+    ULONG sources[PMC_COUNTERS];
+    if (!find_pmc_sources(sources)) {
+        printf("This machine offers none of our profile sources. CPU counters are off.\n");
+        return;
+    }
+    if (FAILED(TraceLoggingRegister(cpu_counters_provider))) {
+        printf("Could not register the MemoryManagerCounters trace provider. CPU counters are off.\n");
+        return;
+    }
+
+    // A run that did not exit cleanly may have left our session running. We stop it, then start our own.
+    SESSION_PROPERTIES properties;
+    initialize_session_properties(&properties);
+    ControlTraceW(0, COUNTER_SESSION_NAME, &properties.properties, EVENT_TRACE_CONTROL_STOP);
+
+    initialize_session_properties(&properties);
+    ULONG status = StartTraceW(&counter_session, COUNTER_SESSION_NAME, &properties.properties);
+    if (status != ERROR_SUCCESS) {
+        printf("Could not start the CPU counter session (error %lu). It needs administrator rights.\n", status);
+        counter_session = 0;
+        TraceLoggingUnregister(cpu_counters_provider);
+        return;
+    }
+
+    // Attach our counters to context switches and system calls, then turn both on, along with our provider.
+    CLASSIC_EVENT_ID events[2];
+    memset(events, 0, sizeof(events));
+    events[0].EventGuid = thread_event_guid;
+    events[0].Type = CONTEXT_SWITCH_OPCODE;
+    events[1].EventGuid = perf_info_event_guid;
+    events[1].Type = SYSTEM_CALL_ENTER_OPCODE;
+
+    ULONG enable_flags[8] = { EVENT_TRACE_FLAG_CSWITCH | EVENT_TRACE_FLAG_SYSTEMCALL };
+
+    if ((status = TraceSetInformation(counter_session, TracePmcCounterListInfo, sources,
+                                      pmc_slot_count * sizeof(ULONG))) != ERROR_SUCCESS ||
+        (status = TraceSetInformation(counter_session, TracePmcEventListInfo, events,
+                                      sizeof(events))) != ERROR_SUCCESS ||
+        (status = TraceSetInformation(counter_session, TraceSystemTraceEnableFlagsInfo, enable_flags,
+                                      sizeof(enable_flags))) != ERROR_SUCCESS ||
+        (status = EnableTraceEx2(counter_session, TraceLoggingProviderId(cpu_counters_provider),
+                                 EVENT_CONTROL_CODE_ENABLE_PROVIDER, TRACE_LEVEL_VERBOSE,
+                                 0, 0, 0, NULL)) != ERROR_SUCCESS) {
+        printf("Could not configure the CPU counter session (error %lu). CPU counters are off.\n", status);
+        stop_cpu_counters();
+        return;
+    }
+
+    EVENT_TRACE_LOGFILEW log_file;
+    memset(&log_file, 0, sizeof(log_file));
+    log_file.LoggerName = (LPWSTR) COUNTER_SESSION_NAME;
+    log_file.ProcessTraceMode = PROCESS_TRACE_MODE_REAL_TIME | PROCESS_TRACE_MODE_EVENT_RECORD;
+    log_file.EventRecordCallback = on_counter_event;
+
+    counter_consumer = OpenTraceW(&log_file);
+    if (counter_consumer == INVALID_PROCESSTRACE_HANDLE) {
+        printf("Could not open the CPU counter session (error %lu). CPU counters are off.\n", GetLastError());
+        stop_cpu_counters();
+        return;
+    }
+
+    counter_consumer_thread = CreateThread(DEFAULT_SECURITY,
+                                           DEFAULT_STACK_SIZE,
+                                           consume_counter_events,
+                                           NULL,
+                                           DEFAULT_CREATION_FLAGS,
+                                           NULL);
+    ASSERT(counter_consumer_thread);
+}
+
+VOID stop_cpu_counters(VOID) {
+    if (counter_session == 0) return;
+
+    // Stopping the session flushes its buffers to our consumer, which returns once it has read them.
+    SESSION_PROPERTIES properties;
+    initialize_session_properties(&properties);
+    ControlTraceW(counter_session, NULL, &properties.properties, EVENT_TRACE_CONTROL_STOP);
+    events_lost = properties.properties.EventsLost;
+    buffers_lost = properties.properties.RealTimeBuffersLost;
+    counter_session = 0;
+
+    if (counter_consumer_thread != NULL) {
+        WaitForSingleObject(counter_consumer_thread, INFINITE);
+        CloseHandle(counter_consumer_thread);
+        CloseTrace(counter_consumer);
+        counter_consumer_thread = NULL;
+    }
+    TraceLoggingUnregister(cpu_counters_provider);
+}
+
+// Prints a counter per unit of work, or "-" if we are not counting it.
+static VOID print_per_unit(PPATH_COUNTERS counters, ULONG counter, const char *format) {
+    if (pmc_slots[counter] == NO_PMC_SLOT) {
+        printf("\t%12s", "-");
+        return;
+    }
+    printf(format, (double) counters->counts[pmc_slots[counter]] / (double) counters->units);
+}
+
+VOID print_cpu_counters(VOID) {
+    if (pmc_slot_count == 0) return;
+
+    printf("\nHardware counters per unit of work (%llu events and %llu buffers lost, %llu paths not counted):\n",
+        events_lost, buffers_lost, paths_not_counted);
+    printf("\t%-30s\t%12s\t%12s\t%12s\t%8s\t%12s\t%12s\t%10s\n", "", "count", "cycles", "instructions", "IPC",
+        "LLC misses", "dTLB misses", "switches");
+
+    BOOL has_ipc = pmc_slots[PMC_CYCLES] != NO_PMC_SLOT && pmc_slots[PMC_INSTRUCTIONS] != NO_PMC_SLOT;
+    for (ULONG path = 0; path < COUNTER_PATHS; path++) {
+        PPATH_COUNTERS counters = &path_counters[path];
+        if (counters->units == 0) continue;
+
+        printf("\t%-30s\t%12llu", get_counter_path_name(path), counters->units);
+        print_per_unit(counters, PMC_CYCLES, "\t%12.0f");
+        print_per_unit(counters, PMC_INSTRUCTIONS, "\t%12.0f");
+
+        ULONG64 cycles = has_ipc ? counters->counts[pmc_slots[PMC_CYCLES]] : 0;
+        if (cycles != 0) {
+            printf("\t%8.2f", (double) counters->counts[pmc_slots[PMC_INSTRUCTIONS]] / (double) cycles);
+        } else {
+            printf("\t%8s", "-");
+        }
+
+        print_per_unit(counters, PMC_LLC_MISSES, "\t%12.2f");
+        print_per_unit(counters, PMC_DTLB_MISSES, "\t%12.2f");
+        printf("\t%10.3f\n", (double) counters->switches / (double) counters->units);
+    }
+}
+#endif
@@ -0,0 +1,76 @@
+#pragma once
+#include <TraceLoggingProvider.h>
+#include <winmeta.h>
+#include "utils.h"
+
+/*
+ *  Counts hardware events -- core cycles, instructions retired, last-level cache misses and data TLB
+ *  misses -- for each fault (by outcome), each trim batch and each write batch, and prints IPC and misses
+ *  per unit of work at exit.
+ *
+ *  We read the CPU's performance counters through ETW, in our own process. At start, we open a real-time
+ *  system trace session that attaches the counters to every context switch and every system call, and a
+ *  thread of ours that consumes it. Each path is bracketed by two events from our "MemoryManagerCounters"
+ *  provider. Writing an event is itself a system call, so the counters arrive just before each bracket.
+ *  Context switches tell us which thread the counters belong to, so each thread's counts stay its own
+ *  even while it is switched out mid-fault.
+ *
+ *  The session is system-wide and needs administrator rights (SeSystemProfilePrivilege). Every system call
+ *  on the machine costs an event, so faults slow down noticeably in this mode. A counter this machine does
+ *  not offer as a profile source (xperf -pmcsources lists them) is left out, and printed as "-".
+ *
+ *  With CPU_COUNTERS off, the macros are empty.
+ */
+
+// Paths we count. Faults are counted by outcome (see FAULT_SOFT_MODIFIED), from COUNTER_PATH_FAULT onward.
+#define COUNTER_PATH_FAULT              0
+#define COUNTER_PATH_TRIM               (COUNTER_PATH_FAULT + FAULT_OUTCOMES)
+#define COUNTER_PATH_WRITE              (COUNTER_PATH_TRIM + 1)
+#define COUNTER_PATHS                   (COUNTER_PATH_WRITE + 1)
+
+// The hardware events we count, each found by its profile source name
+#define PMC_CYCLES                      0
+#define PMC_INSTRUCTIONS                1
+#define PMC_LLC_MISSES                  2
+#define PMC_DTLB_MISSES                 3
+#define PMC_COUNTERS                    4
+
+// Our threads' counts are kept by thread ID. Threads beyond this many are not counted.
+#define MAX_COUNTED_THREADS             1024
+
+#define COUNTER_SESSION_NAME            L"MemoryManagerCounters"
+
+#if CPU_COUNTERS
+TRACELOGGING_DECLARE_PROVIDER(cpu_counters_provider);
+
+#define COUNTERS_BEGIN()                                                                    \
+    TraceLoggingWrite(cpu_counters_provider, "PathBegin",                                   \
+                      TraceLoggingOpcode(WINEVENT_OPCODE_START))
+
+#define COUNTERS_END(path, units)                                                           \
+    TraceLoggingWrite(cpu_counters_provider, "PathEnd",                                     \
+                      TraceLoggingOpcode(WINEVENT_OPCODE_STOP),                             \
+                      TraceLoggingUInt32((ULONG) (path), "Path"),                           \
+                      TraceLoggingUInt64((ULONG64) (units), "Units"))
+#else
+#define COUNTERS_BEGIN()
+#define COUNTERS_END(path, units)
+#endif
+
+#if CPU_COUNTERS
+/*
+ *  Starts our trace session and the thread that consumes it. If we cannot, we say why and run without.
+ */
+VOID start_cpu_counters(VOID);
+
+/*
+ *  Stops the session, once every counted thread has stopped, and waits for its last events.
+ */
+VOID stop_cpu_counters(VOID);
+
+/*
+ *  Prints cycles, instructions, IPC, cache and TLB misses and context switches per unit of work
+ *  (one per fault, or the pages in a batch).
+ */
+VOID print_cpu_counters(VOID);
+#endif
@@ -28,35 +28,8 @@ VOID fatal_error(char *msg) {
 }
 
 #if DEBUG
-TraceEntry g_traceBuffer[TRACE_BUFFER_SIZE];
-volatile LONG g_traceIndex;
-
-// Initially generated by Copilot, then modified for specific issues.
-void log_stack_trace(ULONG64 disk_slot, PULONG_PTR pfn, PULONG_PTR pte) {
-    // Atomically bump our write index (wraparound via modulo)
-    LONG raw = InterlockedIncrement(&g_traceIndex);
-    LONG idx = raw % TRACE_BUFFER_SIZE;
-    if (idx < 0) idx += TRACE_BUFFER_SIZE;  // guard against negative modulo
-
-    // Capture up to MAX_STACK_FRAMES, skipping this Log function (skip 1)
-    USHORT count = RtlCaptureStackBackTrace(
-        1,                  // Frames to skip
-        MAX_STACK_FRAMES,   // Max frames to capture
-        g_traceBuffer[idx].frames,
-        NULL                // optionally retrieve hash
-    );
-
-    // Populate metadata
-    g_traceBuffer[idx].frameCount = count;
-    g_traceBuffer[idx].threadId   = GetCurrentThreadId();
-    g_traceBuffer[idx].timestamp  = GetTickCount64();
-    g_traceBuffer[idx].disk_slot = disk_slot;
-    g_traceBuffer[idx].pfn = pfn;
-    g_traceBuffer[idx].pte   = pte;
-}
-
 void validate_free_counts(void) {
-    ULONG total_count = free_lists.page_count;
+    ULONG total_count = (ULONG) read_counter_exact(&free_lists.page_count);
     ULONG num_free_lists = free_lists.number_of_lists;
     ULONG sum = 0;
     PPAGE_LIST list;
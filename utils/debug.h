@@ -4,8 +4,6 @@
 
 #pragma once
 #include "../threads/threads.h"
-#include <winternl.h>  // for RtlCaptureStackBackTrace
-#pragma comment(lib, "ntdll.lib")
 
 /*
  * This is my central controller for editing with a debug mode. All debug settings are enabled
@@ -37,28 +35,9 @@
 #define COLOR_RESET "\x1b[0m"
 #define COLOR_GREEN "\x1b[32m"
 
-// Here is some code to help me track stack traces
-#define MAX_STACK_FRAMES    16
-#define TRACE_BUFFER_SIZE   1024
-
 #define ACCEPTABLE_MISS     1000
 
 #if DEBUG
-typedef struct {
-    DWORD    threadId;
-    ULONG64  timestamp;      // e.g. GetTickCount64()
-    USHORT   frameCount;
-    ULONG64  disk_slot;
-    PULONG_PTR pte;
-    PULONG_PTR pfn;
-    PVOID    frames[MAX_STACK_FRAMES];
-} TraceEntry;
-
-extern TraceEntry g_traceBuffer[TRACE_BUFFER_SIZE];
-extern volatile LONG g_traceIndex;
-
-void log_stack_trace(ULONG64 disk_slot, PULONG_PTR pfn, PULONG_PTR pte);
-
 VOID debug_thread_function(VOID);
 
 VOID validate_free_counts(VOID);
@@ -0,0 +1,61 @@
+#pragma once
+#include <Windows.h>
+
+/*
+ *  The layout of the live statistics we publish in shared memory, for tools/stats_reader.c and anything
+ *  else that wants to watch a run. It depends on nothing but Windows.h, so a reader can include it alone.
+ *
+ *  The scheduler is the only writer. It guards each update with a sequence lock: it makes sequence odd,
+ *  writes every field, then makes it even again. A reader copies the struct between two reads of
+ *  sequence, and keeps its copy only if both reads were the same even number. The writer never waits
+ *  for a reader. From the time a run sets the section up until its first full update, sequence is odd.
+ *
+ *  Bump LIVE_STATS_VERSION whenever the layout changes, so old readers refuse new runs.
+ */
+#define LIVE_STATS_MAPPING_NAME         "Local\\MemoryManagerLiveStats"
+#define LIVE_STATS_MAGIC                0x5354534C      // "LSTS"
+#define LIVE_STATS_VERSION              2
+
+typedef struct __live_stats {
+    ULONG magic;
+    ULONG version;
+    volatile LONG64 sequence;               // Odd while an update is in progress
+
+    ULONG process_id;
+    BOOL finished;                          // Set once, when the run ends
+    double seconds_elapsed;
+
+    // Pages
+    ULONG64 allocated_pages;
+    LONG64 free_pages;
+    LONG64 standby_pages;
+    LONG64 modified_pages;
+    LONG64 active_pages;
+    LONG64 available_pages;
+    LONG64 empty_disk_slots;
+
+    // Watermarks on available pages, and whether background reclaim is running
+    LONG64 min_watermark;
+    LONG64 low_watermark;
+    LONG64 high_watermark;
+    BOOL reclaim_active;
+
+    // Faults, in total and per second since the last update
+    LONG64 hard_faults;
+    LONG64 soft_faults;
+    double hard_faults_per_second;
+    double soft_faults_per_second;
+    double pages_consumed_per_second;
+
+    // Estimated seconds for one trim batch and one write batch
+    double trim_runtime;
+    double write_runtime;
+
+    LONG64 pages_trimmed;
+    LONG64 pages_written;
+    LONG64 throttled_faults;
+
+    // Share of the last 1, 10 and 60 seconds in which some, or all, user threads were stalled (0 to 1)
+    double pressure_some[3];
+    double pressure_all[3];
+} LIVE_STATS, *PLIVE_STATS;
@@ -0,0 +1,98 @@
+#include "lock_profiler.h"
+#include "utils.h"
+#include "thread_table.h"
+
+#if LOCK_PROFILING
+typedef struct __lock_class_stats {
+    ULONG64 acquisitions;
+    ULONG64 contended;
+    ULONG64 failed_try_locks;
+    ULONG64 spins;
+    ULONG64 wait_cycles;
+    ULONG64 exclusive_fallbacks;
+} LOCK_CLASS_STATS, *PLOCK_CLASS_STATS;
+
+typedef struct __lock_profile {
+    LOCK_CLASS_STATS classes[LOCK_CLASSES];
+} LOCK_PROFILE, *PLOCK_PROFILE;
+
+static const char *lock_class_names[LOCK_CLASSES] = {
+    [LOCK_CLASS_PTE]            = "PTE",
+    [LOCK_CLASS_PFN]            = "PFN",
+    [LOCK_CLASS_LIST_HEAD]      = "list head",
+    [LOCK_CLASS_FREE_LIST]      = "free list",
+    [LOCK_CLASS_STANDBY_LIST]   = "standby list",
+    [LOCK_CLASS_MODIFIED_LIST]  = "modified list",
+    [LOCK_CLASS_OTHER]          = "other",
+};
+
+static LOCK_PROFILE shared_lock_profile;
+static THREAD_TABLES lock_profiles = THREAD_TABLES_OF(LOCK_PROFILE, &shared_lock_profile);
+static __declspec(thread) PLOCK_PROFILE thread_lock_profile;
+
+static PLOCK_CLASS_STATS get_lock_class_stats(ULONG lock_class) {
+    return &GET_THREAD_TABLE(&lock_profiles, thread_lock_profile)->classes[lock_class];
+}
+
+// Only called once get_lock_class_stats has found this thread's table.
+static VOID add_to_lock_count(ULONG64 *count, ULONG64 amount) {
+    ADD_TO_THREAD_TABLE(&lock_profiles, thread_lock_profile, *count, amount);
+}
+
+VOID record_lock_acquired(ULONG lock_class, ULONG64 spins, ULONG64 wait_cycles) {
+    PLOCK_CLASS_STATS class_stats = get_lock_class_stats(lock_class);
+
+    add_to_lock_count(&class_stats->acquisitions, 1);
+    if (spins == 0 && wait_cycles == 0) return;
+
+    add_to_lock_count(&class_stats->contended, 1);
+    add_to_lock_count(&class_stats->spins, spins);
+    add_to_lock_count(&class_stats->wait_cycles, wait_cycles);
+}
+
+VOID record_failed_try_lock(ULONG lock_class) {
+    add_to_lock_count(&get_lock_class_stats(lock_class)->failed_try_locks, 1);
+}
+
+VOID record_exclusive_fallback(ULONG lock_class) {
+    add_to_lock_count(&get_lock_class_stats(lock_class)->exclusive_fallbacks, 1);
+}
+
+VOID print_lock_profile(VOID) {
+    LOCK_PROFILE total = shared_lock_profile;
+    ULONG64 most_waited[LOCK_CLASSES] = {0};
+
+    ULONG count = get_thread_table_count(&lock_profiles);
+    for (ULONG i = 0; i < count; i++) {
+        PLOCK_PROFILE profile = lock_profiles.tables[i];
+        for (ULONG c = 0; c < LOCK_CLASSES; c++) {
+            LOCK_CLASS_STATS *thread_stats = &profile->classes[c];
+            total.classes[c].acquisitions += thread_stats->acquisitions;
+            total.classes[c].contended += thread_stats->contended;
+            total.classes[c].failed_try_locks += thread_stats->failed_try_locks;
+            total.classes[c].spins += thread_stats->spins;
+            total.classes[c].wait_cycles += thread_stats->wait_cycles;
+            total.classes[c].exclusive_fallbacks += thread_stats->exclusive_fallbacks;
+            most_waited[c] = max(most_waited[c], thread_stats->wait_cycles);
+        }
+    }
+
+    printf("\nLock contention (%lu threads):\n", count);
+    printf("\t%-14s\t%12s\t%10s\t%12s\t%12s\t%10s\t%10s\t%10s\n", "class", "acquired", "contended",
+        "failed tries", "spins", "waited (ms)", "worst thrd", "exclusive");
+
+    for (ULONG c = 0; c < LOCK_CLASSES; c++) {
+        LOCK_CLASS_STATS *class_stats = &total.classes[c];
+        if (class_stats->acquisitions == 0 && class_stats->failed_try_locks == 0) continue;
+
+        double contended = 100.0 * (double) class_stats->contended / (double) max(class_stats->acquisitions, 1);
+        double worst_share = class_stats->wait_cycles ?
+            100.0 * (double) most_waited[c] / (double) class_stats->wait_cycles : 0;
+
+        printf("\t%-14s\t%12llu\t%9.2f%%\t%12llu\t%12llu\t%12.1f\t%9.1f%%\t%10llu\n", lock_class_names[c],
+            class_stats->acquisitions, contended, class_stats->failed_try_locks, class_stats->spins,
+            cycles_to_microseconds(class_stats->wait_cycles) / 1000.0, worst_share,
+            class_stats->exclusive_fallbacks);
+    }
+}
+#endif
@@ -0,0 +1,55 @@
+#pragma once
+#include "config.h"
+
+/*
+ *  Counts how often each class of lock is contended, and what that costs us: acquisitions, failed
+ *  try_locks, spin iterations (YieldProcessor calls while backing off), cycles spent waiting, and the
+ *  fallbacks to an exclusive list lock after too many failed attempts. Each thread counts into its own
+ *  table, and we sum them by class at exit. An uncontended acquisition is only counted, never timed.
+ *
+ *  PFN locks are counted in release builds only -- with DEBUG on, they are critical sections.
+ *  With LOCK_PROFILING off, the macros are empty.
+ */
+
+// Lock classes
+#define LOCK_CLASS_PTE                  0
+#define LOCK_CLASS_PFN                  1       // The lock of a page
+#define LOCK_CLASS_LIST_HEAD            2       // The lock of a list's head, which links to its first and last pages
+#define LOCK_CLASS_FREE_LIST            3       // Our free list bit locks, and any SRW lock of a free list
+#define LOCK_CLASS_STANDBY_LIST         4       // The standby list's SRW lock
+#define LOCK_CLASS_MODIFIED_LIST        5       // The modified list's SRW lock
+#define LOCK_CLASS_OTHER                6       // Page directory entries, page waiters, the large page pool
+#define LOCK_CLASSES                    7
+
+#if LOCK_PROFILING
+#define LOCK_ACQUIRED(lock_class, spins, wait_cycles)   record_lock_acquired(lock_class, spins, wait_cycles)
+#define LOCK_TRY_FAILED(lock_class)                     record_failed_try_lock(lock_class)
+#define LOCK_EXCLUSIVE_FALLBACK(lock_class)             record_exclusive_fallback(lock_class)
+#else
+#define LOCK_ACQUIRED(lock_class, spins, wait_cycles)
+#define LOCK_TRY_FAILED(lock_class)
+#define LOCK_EXCLUSIVE_FALLBACK(lock_class)
+#endif
+
+#if LOCK_PROFILING
+/*
+ *  Counts an acquisition. It was contended if we spun or waited for it at all.
+ */
+VOID record_lock_acquired(ULONG lock_class, ULONG64 spins, ULONG64 wait_cycles);
+
+/*
+ *  Counts a try_lock that found the lock held.
+ */
+VOID record_failed_try_lock(ULONG lock_class);
+
+/*
+ *  Counts a fallback to the exclusive lock of a list, after MAX_*_ACCESS_ATTEMPTS failed attempts.
+ */
+VOID record_exclusive_fallback(ULONG lock_class);
+
+/*
+ *  Sums every thread's counts and prints them by lock class, with the share of waiting done by
+ *  the thread that waited most.
+ */
+VOID print_lock_profile(VOID);
+#endif
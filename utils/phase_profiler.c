@@ -0,0 +1,88 @@
+#include "phase_profiler.h"
+#include "thread_table.h"
+
+#if PHASE_PROFILING
+typedef struct __phase_profile {
+    ULONG64 cycles[NUM_PHASES];
+    ULONG64 calls[NUM_PHASES];
+} PHASE_PROFILE, *PPHASE_PROFILE;
+
+#define PHASE_GROUP_HARD                0
+#define PHASE_GROUP_SOFT                1
+#define PHASE_GROUP_WRITE               2
+#define PHASE_GROUP_TRIM                3
+#define NUM_PHASE_GROUPS                4
+
+static const struct {
+    const char *name;
+    ULONG group;
+} phases[NUM_PHASES] = {
+    [PHASE_HARD_ACQUIRE_PAGE]   = { "acquire page",     PHASE_GROUP_HARD },
+    [PHASE_HARD_PTE_LOCK]       = { "PTE lock",         PHASE_GROUP_HARD },
+    [PHASE_HARD_MAP]            = { "map",              PHASE_GROUP_HARD },
+    [PHASE_HARD_DISK_READ]      = { "disk read",        PHASE_GROUP_HARD },
+    [PHASE_HARD_ZERO]           = { "zero",             PHASE_GROUP_HARD },
+    [PHASE_HARD_KERNEL_UNMAP]   = { "kernel VA unmap",  PHASE_GROUP_HARD },
+    [PHASE_SOFT_LOCKS]          = { "PTE + PFN locks",  PHASE_GROUP_SOFT },
+    [PHASE_SOFT_LIST_REMOVE]    = { "list remove",      PHASE_GROUP_SOFT },
+    [PHASE_SOFT_MAP]            = { "map",              PHASE_GROUP_SOFT },
+    [PHASE_WRITE_DISK_SLOTS]    = { "disk slots",       PHASE_GROUP_WRITE },
+    [PHASE_WRITE_GATHER]        = { "gather modified",  PHASE_GROUP_WRITE },
+    [PHASE_WRITE_MAP]           = { "map",              PHASE_GROUP_WRITE },
+    [PHASE_WRITE_COPY]          = { "copy to disk",     PHASE_GROUP_WRITE },
+    [PHASE_WRITE_UNMAP]         = { "unmap",            PHASE_GROUP_WRITE },
+    [PHASE_WRITE_RELEASE]       = { "to waiters/standby", PHASE_GROUP_WRITE },
+    [PHASE_TRIM_SELECT]         = { "select victims",   PHASE_GROUP_TRIM },
+    [PHASE_TRIM_LOCK]           = { "lock victims",     PHASE_GROUP_TRIM },
+    [PHASE_TRIM_UNMAP]          = { "unmap",            PHASE_GROUP_TRIM },
+    [PHASE_TRIM_TO_MODIFIED]    = { "to modified",      PHASE_GROUP_TRIM },
+};
+
+static const char *phase_group_names[NUM_PHASE_GROUPS] = {
+    "hard fault", "soft fault", "page written", "page trimmed"
+};
+
+static PHASE_PROFILE shared_profile;
+static THREAD_TABLES phase_profiles = THREAD_TABLES_OF(PHASE_PROFILE, &shared_profile);
+static __declspec(thread) PPHASE_PROFILE thread_profile;
+
+VOID record_phase(ULONG phase, ULONG64 cycles) {
+    PPHASE_PROFILE profile = GET_THREAD_TABLE(&phase_profiles, thread_profile);
+    ADD_TO_THREAD_TABLE(&phase_profiles, profile, profile->cycles[phase], cycles);
+    ADD_TO_THREAD_TABLE(&phase_profiles, profile, profile->calls[phase], 1);
+}
+
+VOID print_phase_profile(VOID) {
+    PHASE_PROFILE total = shared_profile;
+    ULONG count = get_thread_table_count(&phase_profiles);
+    for (ULONG i = 0; i < count; i++) {
+        PPHASE_PROFILE profile = phase_profiles.tables[i];
+        for (ULONG phase = 0; phase < NUM_PHASES; phase++) {
+            total.cycles[phase] += profile->cycles[phase];
+            total.calls[phase] += profile->calls[phase];
+        }
+    }
+
+    LONG64 events[NUM_PHASE_GROUPS];
+    events[PHASE_GROUP_HARD] = read_counter_exact(&stats.n_hard);
+    events[PHASE_GROUP_SOFT] = read_counter_exact(&stats.n_soft);
+    events[PHASE_GROUP_WRITE] = stats.n_written;
+    events[PHASE_GROUP_TRIM] = stats.n_trimmed;
+
+    for (ULONG group = 0; group < NUM_PHASE_GROUPS; group++) {
+        ULONG64 group_cycles = 0;
+        for (ULONG phase = 0; phase < NUM_PHASES; phase++) {
+            if (phases[phase].group == group) group_cycles += total.cycles[phase];
+        }
+        if (group_cycles == 0 || events[group] == 0) continue;
+
+        printf("\nCycles per %s (%lld):\n", phase_group_names[group], events[group]);
+        for (ULONG phase = 0; phase < NUM_PHASES; phase++) {
+            if (phases[phase].group != group) continue;
+            printf("\t%-20s\t%10.0f\t%5.1f%%\t(%llu calls)\n", phases[phase].name,
+                (double) total.cycles[phase] / (double) events[group],
+                100.0 * (double) total.cycles[phase] / (double) group_cycles, total.calls[phase]);
+        }
+    }
+}
+#endif
@@ -0,0 +1,60 @@
+#pragma once
+#include "utils.h"
+
+/*
+ *  Breaks the time spent in faults, writes and trims down into phases. Wrap a phase in
+ *  PHASE_BEGIN(phase) and PHASE_END(phase), in the same block: each thread adds the cycles in between
+ *  to its own totals, and we print a table of cycles per phase per fault (or per page) at exit.
+ *
+ *  With PHASE_PROFILING off, the macros are empty -- the disabled build does no extra work at all.
+ */
+
+// Hard faults
+#define PHASE_HARD_ACQUIRE_PAGE         0       // Free cache, free lists, standby, direct reclaim
+#define PHASE_HARD_PTE_LOCK             1
+#define PHASE_HARD_MAP                  2       // map_both_va_to_same_page
+#define PHASE_HARD_DISK_READ            3       // memcpy from the page file
+#define PHASE_HARD_ZERO                 4       // memset of a zero-fill page
+#define PHASE_HARD_KERNEL_UNMAP         5       // Unmapping our kernel VAs, once every NUM_KERNEL_READ_ADDRESSES faults
+
+// Soft faults
+#define PHASE_SOFT_LOCKS                6       // PTE lock, then PFN lock
+#define PHASE_SOFT_LIST_REMOVE          7
+#define PHASE_SOFT_MAP                  8
+
+// Writes
+#define PHASE_WRITE_DISK_SLOTS          9
+#define PHASE_WRITE_GATHER              10      // Taking pages off the modified list
+#define PHASE_WRITE_MAP                 11
+#define PHASE_WRITE_COPY                12      // memcpy to the page file, and relocking each page
+#define PHASE_WRITE_UNMAP               13
+#define PHASE_WRITE_RELEASE             14      // Handing pages to waiters, and the rest to standby
+
+// Trims
+#define PHASE_TRIM_SELECT               15
+#define PHASE_TRIM_LOCK                 16      // Locking victims and moving them to transition
+#define PHASE_TRIM_UNMAP                17
+#define PHASE_TRIM_TO_MODIFIED          18
+
+#define NUM_PHASES                      19
+
+#if PHASE_PROFILING
+#define PHASE_BEGIN(phase)              ULONG64 phase##_start = get_cycle_count()
+#define PHASE_END(phase)                record_phase(phase, get_cycle_count() - phase##_start)
+#else
+#define PHASE_BEGIN(phase)
+#define PHASE_END(phase)
+#endif
+
+#if PHASE_PROFILING
+/*
+ *  Adds cycles to this thread's total for the phase.
+ */
+VOID record_phase(ULONG phase, ULONG64 cycles);
+
+/*
+ *  Sums every thread's totals and prints cycles per phase, per hard fault, soft fault, page written
+ *  and page trimmed.
+ */
+VOID print_phase_profile(VOID);
+#endif
@@ -0,0 +1,19 @@
+#include "probes.h"
+
+#if STATE_PROBES
+// {3f0c7a52-9b1e-4d6a-8e27-5c4b1f9d2a61}
+TRACELOGGING_DEFINE_PROVIDER(memory_manager_provider,
+                             "MemoryManager",
+                             (0x3f0c7a52, 0x9b1e, 0x4d6a, 0x8e, 0x27, 0x5c, 0x4b, 0x1f, 0x9d, 0x2a, 0x61));
+
+VOID register_probes(VOID) {
+    // Failing to register only costs us our probes, so we carry on without them.
+    if (FAILED(TraceLoggingRegister(memory_manager_provider))) {
+        printf("Could not register the MemoryManager trace provider. State probes are off.\n");
+    }
+}
+
+VOID unregister_probes(VOID) {
+    TraceLoggingUnregister(memory_manager_provider);
+}
+#endif
@@ -0,0 +1,70 @@
+#pragma once
+#include <Windows.h>
+#include <TraceLoggingProvider.h>
+#include <winmeta.h>
+#include "config.h"
+
+/*
+ *  Static probes on every PFN and PTE state transition, and on every batch taken from or added to a list.
+ *  They are ETW TraceLogging events from our provider, "MemoryManager". Until a trace session enables
+ *  the provider, each probe is a single test and branch, and its arguments are never evaluated -- so we
+ *  can leave them in optimized builds, and attach to a live run with no rebuild:
+ *
+ *      wpr / tracelog / xperf, enabling provider MemoryManager (GUID below, or the name with a '*' prefix)
+ *
+ *  Every event carries a timestamp and thread ID from ETW itself. Keyed by frame number, PFN events
+ *  give us (for example) the time from trim to standby for each page.
+ *
+ *  With STATE_PROBES off, the macros are empty.
+ */
+
+// Keywords, so a session can enable one kind of probe at a time
+#define PROBE_KEYWORD_PFN               0x1
+#define PROBE_KEYWORD_PTE               0x2
+#define PROBE_KEYWORD_LIST              0x4
+
+// PTE states
+#define PROBE_PTE_STATE_VALID           0
+#define PROBE_PTE_STATE_TRANSITION      1
+#define PROBE_PTE_STATE_ON_DISK         2
+
+// List batch operations
+#define PROBE_LIST_REMOVE               0
+#define PROBE_LIST_INSERT               1
+
+#if STATE_PROBES
+TRACELOGGING_DECLARE_PROVIDER(memory_manager_provider);
+
+#define PROBE_PFN_TRANSITION(frame, from, to)                                               \
+    TraceLoggingWrite(memory_manager_provider, "PfnTransition",                             \
+                      TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),                            \
+                      TraceLoggingKeyword(PROBE_KEYWORD_PFN),                               \
+                      TraceLoggingUInt64((frame), "Frame"),                                 \
+                      TraceLoggingUInt8((UINT8) (from), "From"),                            \
+                      TraceLoggingUInt8((UINT8) (to), "To"))
+
+#define PROBE_PTE_TRANSITION(index, to)                                                     \
+    TraceLoggingWrite(memory_manager_provider, "PteTransition",                             \
+                      TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),                            \
+                      TraceLoggingKeyword(PROBE_KEYWORD_PTE),                               \
+                      TraceLoggingUInt64((index), "Pte"),                                   \
+                      TraceLoggingUInt8((UINT8) (to), "To"))
+
+#define PROBE_LIST_BATCH(list_id, operation, pages)                                         \
+    TraceLoggingWrite(memory_manager_provider, "ListBatch",                                 \
+                      TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),                            \
+                      TraceLoggingKeyword(PROBE_KEYWORD_LIST),                              \
+                      TraceLoggingUInt32((list_id), "List"),                                \
+                      TraceLoggingUInt8((UINT8) (operation), "Operation"),                  \
+                      TraceLoggingUInt64((pages), "Pages"))
+
+/*
+ *  Registers and unregisters our provider. Probes fired outside of these are dropped.
+ */
+VOID register_probes(VOID);
+VOID unregister_probes(VOID);
+#else
+#define PROBE_PFN_TRANSITION(frame, from, to)
+#define PROBE_PTE_TRANSITION(index, to)
+#define PROBE_LIST_BATCH(list_id, operation, pages)
+#endif
@@ -0,0 +1,15 @@
+#include "thread_table.h"
+#include "utils.h"
+
+PVOID claim_thread_table(PTHREAD_TABLES tables) {
+    LONG index = InterlockedIncrement(&tables->thread_count) - 1;
+    if (index >= MAX_TABLE_THREADS && tables->shared_table != NULL) return tables->shared_table;
+
+    PVOID table = zero_malloc(tables->table_size);
+    if (index < MAX_TABLE_THREADS) tables->tables[index] = table;
+    return table;
+}
+
+ULONG get_thread_table_count(PTHREAD_TABLES tables) {
+    return min((ULONG) tables->thread_count, MAX_TABLE_THREADS);
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <Windows.h>
+
+/*
+ *  Per-thread tables for our profilers. Each thread updates a table of its own, with no interlocked
+ *  operations, and we sum every thread's table at exit.
+ *
+ *  A thread claims its table the first time it needs one, and keeps a pointer to it in a thread-local
+ *  variable of the profiler's own; GET_THREAD_TABLE does both. Threads past MAX_TABLE_THREADS share
+ *  the profiler's overflow table, so their updates must be interlocked (see ADD_TO_THREAD_TABLE). A
+ *  profiler with no overflow table gives those threads tables of their own, which are never summed.
+ */
+#define MAX_TABLE_THREADS               256
+
+typedef struct __thread_tables {
+    SIZE_T table_size;
+    PVOID shared_table;
+    PVOID tables[MAX_TABLE_THREADS];
+    volatile LONG thread_count;
+} THREAD_TABLES, *PTHREAD_TABLES;
+
+// Declares tables of a given type, overflowing into shared (a table of that type), or into none if it is NULL.
+#define THREAD_TABLES_OF(type, shared)              { sizeof(type), (shared) }
+
+// This thread's table, claimed on first use. thread_table must be a __declspec(thread) pointer.
+#define GET_THREAD_TABLE(tables, thread_table)      \
+    ((thread_table) != NULL ? (thread_table) : ((thread_table) = claim_thread_table(tables)))
+
+// Adds to a count in a table, interlocked only if the table is shared.
+#define ADD_TO_THREAD_TABLE(tables, table, count, amount)                                   \
+    ((PVOID) (table) == (tables)->shared_table                                              \
+        ? (VOID) InterlockedAdd64((volatile LONG64 *) &(count), (LONG64) (amount))          \
+        : (VOID) ((count) += (amount)))
+
+/*
+ *  Allocates a zeroed table for this thread, and lists it to be summed -- or, once the list is full,
+ *  returns the shared table. Call through GET_THREAD_TABLE.
+ */
+PVOID claim_thread_table(PTHREAD_TABLES tables);
+
+/*
+ *  Returns how many tables are listed, for summing. The shared table is not among them.
+ */
+ULONG get_thread_table_count(PTHREAD_TABLES tables);
@@ -0,0 +1,135 @@
+#include "trace.h"
+#include "thread_table.h"
+
+#if EVENT_TRACING
+typedef struct __trace_ring {
+    TRACE_EVENT events[TRACE_RING_SIZE];
+    ULONG64 head;
+    ULONG thread_id;
+    const char *name;
+    ULONG index;
+} TRACE_RING, *PTRACE_RING;
+
+// A ring has only one writer, so threads past MAX_TABLE_THREADS get rings of their own that are not exported.
+static THREAD_TABLES trace_rings = THREAD_TABLES_OF(TRACE_RING, NULL);
+static __declspec(thread) PTRACE_RING thread_ring;
+
+static const char *trace_event_names[TRACE_EVENT_TYPES] = {
+    [TRACE_FAULT]           = "fault",
+    [TRACE_TRIM_BATCH]      = "trim batch",
+    [TRACE_WRITE_BATCH]     = "write batch",
+    [TRACE_PRUNE_BATCH]     = "prune batch",
+    [TRACE_AGE_SWEEP]       = "age sweep",
+    [TRACE_WAIT]            = "wait",
+    [TRACE_LIST_EXCLUSIVE]  = "list exclusive lock",
+};
+
+static const char *wait_names[] = {
+    [TRACE_WAIT_PAGE]       = "page",
+    [TRACE_WAIT_THROTTLE]   = "throttle",
+    [TRACE_WAIT_WORK]       = "work",
+};
+
+static PTRACE_RING get_thread_ring(VOID) {
+    if (thread_ring != NULL) return thread_ring;
+
+    PTRACE_RING ring = claim_thread_table(&trace_rings);
+    ring->thread_id = GetCurrentThreadId();
+    ring->name = "thread";
+    thread_ring = ring;
+    return ring;
+}
+
+VOID record_trace_event(USHORT type, USHORT phase, ULONG argument) {
+    PTRACE_RING ring = get_thread_ring();
+    PTRACE_EVENT event = &ring->events[ring->head & (TRACE_RING_SIZE - 1)];
+    event->timestamp = get_cycle_count();
+    event->type = type;
+    event->phase = phase;
+    event->argument = argument;
+    ring->head++;
+}
+
+VOID name_trace_thread(const char *name, ULONG index) {
+    PTRACE_RING ring = get_thread_ring();
+    ring->name = name;
+    ring->index = index;
+}
+
+// Writes the arguments of an event, if it has any worth showing.
+static VOID write_trace_arguments(FILE *file, PTRACE_EVENT event) {
+    switch (event->type) {
+        case TRACE_FAULT:
+            if (event->phase == TRACE_PHASE_END && event->argument < FAULT_OUTCOMES) {
+                fprintf(file, ",\"args\":{\"outcome\":\"%s\"}", fault_outcome_names[event->argument]);
+            }
+            return;
+        case TRACE_WAIT:
+            if (event->argument < ARRAYSIZE(wait_names)) {
+                fprintf(file, ",\"args\":{\"for\":\"%s\"}", wait_names[event->argument]);
+            }
+            return;
+        case TRACE_LIST_EXCLUSIVE:
+            fprintf(file, ",\"args\":{\"list\":%lu}", event->argument);
+            return;
+        default:
+            if (event->phase == TRACE_PHASE_END) fprintf(file, ",\"args\":{\"pages\":%lu}", event->argument);
+    }
+}
+
+VOID write_trace_json(const char *file_name) {
+    FILE *file = fopen(file_name, "w");
+    if (file == NULL) {
+        printf("Could not write trace to %s.\n", file_name);
+        return;
+    }
+
+    ULONG ring_count = get_thread_table_count(&trace_rings);
+
+    // Our timeline starts at the oldest event we still have.
+    ULONG64 start = MAXULONG64;
+    for (ULONG i = 0; i < ring_count; i++) {
+        PTRACE_RING ring = trace_rings.tables[i];
+        if (ring->head == 0) continue;
+        ULONG64 oldest = ring->head > TRACE_RING_SIZE ? ring->head - TRACE_RING_SIZE : 0;
+        start = min(start, ring->events[oldest & (TRACE_RING_SIZE - 1)].timestamp);
+    }
+
+    fprintf(file, "{\"traceEvents\":[\n");
+    BOOL first = TRUE;
+    for (ULONG i = 0; i < ring_count; i++) {
+        PTRACE_RING ring = trace_rings.tables[i];
+
+        fprintf(file, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%lu,\"args\":{\"name\":\"%s %lu\"}}",
+            first ? "" : ",\n", ring->thread_id, ring->name, ring->index);
+        first = FALSE;
+
+        // If the ring has wrapped, its oldest events may end spans whose beginnings were overwritten. We skip those.
+        ULONG64 oldest = ring->head > TRACE_RING_SIZE ? ring->head - TRACE_RING_SIZE : 0;
+        ULONG depth = 0;
+        for (ULONG64 j = oldest; j < ring->head; j++) {
+            PTRACE_EVENT event = &ring->events[j & (TRACE_RING_SIZE - 1)];
+            const char *phase = "i";
+            if (event->phase == TRACE_PHASE_BEGIN) {
+                phase = "B";
+                depth++;
+            } else if (event->phase == TRACE_PHASE_END) {
+                if (depth == 0) continue;
+                phase = "E";
+                depth--;
+            }
+
+            fprintf(file, ",\n{\"ph\":\"%s\",\"name\":\"%s\",\"pid\":1,\"tid\":%lu,\"ts\":%.3f",
+                phase, trace_event_names[event->type], ring->thread_id,
+                cycles_to_microseconds(event->timestamp - start));
+            if (event->phase == TRACE_PHASE_INSTANT) fprintf(file, ",\"s\":\"t\"");
+            write_trace_arguments(file, event);
+            fprintf(file, "}");
+        }
+    }
+    fprintf(file, "\n]}\n");
+
+    fclose(file);
+    printf("Wrote trace to %s.\n", file_name);
+}
+#endif
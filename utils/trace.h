@@ -0,0 +1,71 @@
+#pragma once
+#include "utils.h"
+
+/*
+ *  Each thread records compact binary events -- faults, batches, waits and exclusive-lock fallbacks --
+ *  into a ring buffer of its own, stamped with the cycle counter. A ring has only one writer, so
+ *  recording needs no locks or interlocked operations, and is cheap enough for optimized builds.
+ *  Once full, a ring overwrites its oldest events.
+ *
+ *  At exit, we convert every ring into Chrome trace JSON, which chrome://tracing and Perfetto
+ *  (ui.perfetto.dev) both open as a timeline with one track per thread.
+ *
+ *  With EVENT_TRACING off, the macros are empty.
+ */
+#define TRACE_RING_SIZE                 (1 << 16)       // Events per thread, a power of two
+
+// Event types
+#define TRACE_FAULT                     0       // Argument at end: the fault's outcome (see FAULT_SOFT_MODIFIED)
+#define TRACE_TRIM_BATCH                1       // Argument at end: pages trimmed
+#define TRACE_WRITE_BATCH               2       // Argument at end: pages written
+#define TRACE_PRUNE_BATCH               3       // Argument at end: pages pruned
+#define TRACE_AGE_SWEEP                 4
+#define TRACE_WAIT                      5       // Argument: what we are waiting for (see below)
+#define TRACE_LIST_EXCLUSIVE            6       // Argument: which list (see get_list_id)
+#define TRACE_EVENT_TYPES               7
+
+// What a TRACE_WAIT waits for
+#define TRACE_WAIT_PAGE                 0       // A page from the writer
+#define TRACE_WAIT_THROTTLE             1       // Available pages to climb back above min
+#define TRACE_WAIT_WORK                 2       // A worker, waiting to be woken
+
+// Event phases
+#define TRACE_PHASE_BEGIN               0
+#define TRACE_PHASE_END                 1
+#define TRACE_PHASE_INSTANT             2
+
+typedef struct __trace_event {
+    ULONG64 timestamp;
+    USHORT type;
+    USHORT phase;
+    ULONG argument;
+} TRACE_EVENT, *PTRACE_EVENT;
+
+#if EVENT_TRACING
+#define TRACE_BEGIN(type, argument)         record_trace_event(type, TRACE_PHASE_BEGIN, argument)
+#define TRACE_END(type, argument)           record_trace_event(type, TRACE_PHASE_END, argument)
+#define TRACE_INSTANT(type, argument)       record_trace_event(type, TRACE_PHASE_INSTANT, argument)
+#define TRACE_THREAD_NAME(name, index)      name_trace_thread(name, index)
+#else
+#define TRACE_BEGIN(type, argument)
+#define TRACE_END(type, argument)
+#define TRACE_INSTANT(type, argument)
+#define TRACE_THREAD_NAME(name, index)
+#endif
+
+#if EVENT_TRACING
+/*
+ *  Adds an event to this thread's ring.
+ */
+VOID record_trace_event(USHORT type, USHORT phase, ULONG argument);
+
+/*
+ *  Names this thread's track in the timeline, e.g. "trimmer" 2.
+ */
+VOID name_trace_thread(const char *name, ULONG index);
+
+/*
+ *  Converts every thread's ring to Chrome trace JSON. Call only once the traced threads have stopped.
+ */
+VOID write_trace_json(const char *file_name);
+#endif
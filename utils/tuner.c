@@ -0,0 +1,131 @@
+#include <string.h>
+#include "tuner.h"
+#include "../threads/threads.h"
+
+TUNABLE tunables[NUM_TUNABLES] = {
+    [TUNE_WRITE_BATCH_SIZE]     = { "write_batch_size",     DEFAULT_WRITE_BATCH_SIZE,   64, MAX_WRITE_BATCH_SIZE },
+    [TUNE_TRIM_BATCH_SIZE]      = { "trim_batch_size",      DEFAULT_TRIM_BATCH_SIZE,    64, MAX_TRIM_BATCH_SIZE },
+    [TUNE_FREE_PAGE_CACHE_SIZE] = { "free_page_cache_size", DEFAULT_FREE_PAGE_CACHE_SIZE, 8, FREE_PAGE_CACHE_SIZE },
+};
+
+// Our hill climber. Only the scheduler touches it.
+static struct {
+    ULONG index;                // The size we are tuning now
+    LONG direction;             // Whether we are growing it (1) or shrinking it (-1)
+    ULONG failed_directions;    // How many directions in a row have not helped this size
+    BOOL trial;                 // Whether the interval just ended ran with a trial change
+    LONG64 previous_value;      // The value to revert to, if the trial did not help
+    double best_score;
+    LONG64 previous_reclaimed;
+    LONG64 previous_worker_time;
+    LONG64 previous_wait_time;
+} climber = { .direction = 1 };
+
+static LONG64 clamp_tunable(PTUNABLE tunable, LONG64 value) {
+    return max(tunable->min, min(value, tunable->max));
+}
+
+BOOL load_tunables(const char *file_name) {
+    FILE *file = fopen(file_name, "r");
+    if (file == NULL) return FALSE;
+
+    char name[64];
+    LONG64 value;
+    while (fscanf(file, "%63s %lld", name, &value) == 2) {
+        for (ULONG i = 0; i < NUM_TUNABLES; i++) {
+            if (strcmp(name, tunables[i].name) == 0) tunables[i].value = clamp_tunable(&tunables[i], value);
+        }
+    }
+
+    fclose(file);
+    return TRUE;
+}
+
+VOID save_tunables(const char *file_name) {
+    FILE *file = fopen(file_name, "w");
+    if (file == NULL) {
+        printf("Could not save tuning file %s.\n", file_name);
+        return;
+    }
+
+    for (ULONG i = 0; i < NUM_TUNABLES; i++) fprintf(file, "%s %lld\n", tunables[i].name, tunables[i].value);
+    fclose(file);
+}
+
+VOID print_tunables(VOID) {
+    printf("TUNED SIZES:");
+    for (ULONG i = 0; i < NUM_TUNABLES; i++) printf("\t%s %lld", tunables[i].name, tunables[i].value);
+    printf("\n");
+}
+
+/*
+ *  Scales the current size one step in the current direction. Returns FALSE if it is already at its limit.
+ */
+static BOOL try_step(VOID) {
+    PTUNABLE tunable = &tunables[climber.index];
+    LONG64 value = tunable->value;
+    LONG64 next = climber.direction > 0 ? (LONG64) (value * TUNING_STEP_FACTOR) + 1
+                                        : (LONG64) (value / TUNING_STEP_FACTOR);
+    next = clamp_tunable(tunable, next);
+    if (next == value) return FALSE;
+
+    climber.previous_value = value;
+    WriteNoFence64(&tunable->value, next);
+    climber.trial = TRUE;
+    return TRUE;
+}
+
+/*
+ *  The current direction has not helped. Try the other one, or -- if neither helps -- move on to the next size.
+ */
+static VOID give_up_direction(VOID) {
+    climber.direction = -climber.direction;
+    if (++climber.failed_directions < 2) return;
+
+    climber.failed_directions = 0;
+    climber.index = (climber.index + 1) % NUM_TUNABLES;
+}
+
+VOID tune_batch_sizes(double elapsed_seconds) {
+
+    // Gather what our workers and user threads did in the interval just ended.
+    LONG64 reclaimed = stats.n_trimmed + stats.n_written;
+    LONG64 worker_time = stats.trim_time + stats.write_time;
+    LONG64 wait_time = stats.wait_time + stats.throttle_time;
+
+    LONG64 pages = reclaimed - climber.previous_reclaimed;
+    double worker_seconds = (double) (worker_time - climber.previous_worker_time) / (double) stats.timer_frequency;
+    double wait_seconds = (double) (wait_time - climber.previous_wait_time) / (double) stats.timer_frequency;
+
+    climber.previous_reclaimed = reclaimed;
+    climber.previous_worker_time = worker_time;
+    climber.previous_wait_time = wait_time;
+
+    // If nothing was reclaimed, this interval tells us nothing. We leave any trial running for another.
+    if (pages == 0 || worker_seconds <= 0) return;
+
+    double waiting = min(1.0, wait_seconds / (elapsed_seconds * vm.num_user_threads));
+    double score = (double) pages / worker_seconds * (1 - waiting);
+
+    if (climber.trial) {
+        climber.trial = FALSE;
+
+        if (score > climber.best_score * (1 + TUNING_MIN_IMPROVEMENT)) {
+
+            // It helped -- keep going the same way.
+            climber.best_score = score;
+            climber.failed_directions = 0;
+        } else {
+
+            // It did not -- put it back. We measure the restored value again before the next trial.
+            WriteNoFence64(&tunables[climber.index].value, climber.previous_value);
+            give_up_direction();
+            return;
+        }
+    } else {
+        climber.best_score = score;
+    }
+
+    // Try the next step. If this size cannot go any further this way, we turn around on the next interval.
+    if (!try_step()) give_up_direction();
+}
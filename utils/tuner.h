@@ -0,0 +1,60 @@
+#pragma once
+#include "config.h"
+
+/*
+ *  Batch and cache sizes we tune while running. The MAX_ sizes in config.h (and FREE_PAGE_CACHE_SIZE
+ *  in threads.h) are now only capacities: the sizes we actually use live here, start from the values
+ *  we used to compile in, and can be loaded from the tuning file a previous run saved.
+ *
+ *  Every run loads the tuning file, if there is one. Only runs with AUTO_TUNING on change the sizes
+ *  and save them again. With AUTO_TUNING on, the scheduler hill-climbs them one at a time: it scales a size by
+ *  TUNING_STEP_FACTOR, measures for one interval, and keeps the change only if our score improved.
+ *  Our score is the pages each worker reclaims per second of work, discounted by the share of their
+ *  time user threads spent waiting on a page. The pruner's batch is not tuned: pruning moves pages
+ *  from standby to free without reclaiming any, so our score cannot see it.
+ *
+ *  Leave AUTO_TUNING off under LATENCY_SLO. Both adjust reclaim from the same interval's measurements,
+ *  so each would score the other's changes as its own.
+ */
+#define TUNE_WRITE_BATCH_SIZE           0
+#define TUNE_TRIM_BATCH_SIZE            1
+#define TUNE_FREE_PAGE_CACHE_SIZE       2
+#define NUM_TUNABLES                    3
+
+#define TUNING_STEP_FACTOR              1.25
+
+// A change must improve our score by at least this fraction to be kept, so we do not chase noise.
+#define TUNING_MIN_IMPROVEMENT          0.02
+
+typedef struct __tunable {
+    const char *name;
+    volatile LONG64 value;
+    LONG64 min;
+    LONG64 max;
+} TUNABLE, *PTUNABLE;
+
+extern TUNABLE tunables[NUM_TUNABLES];
+
+#define get_tunable(index)              ((ULONG64) ReadNoFence64(&tunables[index].value))
+
+/*
+ *  Loads tuned sizes saved by an earlier run. Sizes missing from the file keep their defaults, and
+ *  every size is clamped to its capacity. Returns FALSE if there is no tuning file.
+ */
+BOOL load_tunables(const char *file_name);
+
+/*
+ *  Saves our current sizes for later runs to load.
+ */
+VOID save_tunables(const char *file_name);
+
+/*
+ *  Called by the scheduler once per interval. Scores the interval just ended, then keeps or reverts
+ *  the last change and tries the next one.
+ */
+VOID tune_batch_sizes(double elapsed_seconds);
+
+/*
+ *  Prints our current sizes.
+ */
+VOID print_tunables(VOID);
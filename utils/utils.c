@@ -45,19 +45,19 @@ VOID change_volatile_data(volatile LONG64 *pdata_to_change, LONG64 delta) {
 }
 
 VOID increment_available_count(VOID) {
-    change_volatile_data(&stats.n_available, 1);
+    add_to_counter(&stats.n_available, 1);
 }
 
 VOID decrement_available_count(VOID) {
-    change_volatile_data(&stats.n_available, -1);
+    add_to_counter(&stats.n_available, -1);
 }
 
 VOID increase_available_count(LONG64 amt) {
-    change_volatile_data(&stats.n_available, amt);
+    add_to_counter(&stats.n_available, amt);
 }
 
 VOID decrease_available_count(LONG64 amt) {
-    change_volatile_data(&stats.n_available, -amt);
+    add_to_counter(&stats.n_available, -amt);
 }
 
 LONGLONG get_timestamp(VOID) {
@@ -70,6 +70,17 @@ double get_time_difference(LONGLONG end, LONGLONG start) {
     return (double) (end - start) / (double) stats.timer_frequency;
 }
 
+VOID calibrate_cycle_counter(VOID) {
+    LONGLONG start = get_timestamp();
+    ULONG64 start_cycles = get_cycle_count();
+
+    Sleep(CYCLE_CALIBRATION_IN_MILLISECONDS);
+
+    LONGLONG end = get_timestamp();
+    ULONG64 end_cycles = get_cycle_count();
+    stats.cycles_per_second = (double) (end_cycles - start_cycles) / get_time_difference(end, start);
+}
+
 ULONG64 xorshift64(ULONG64 *seed) {
     uint64_t x = *seed;
     x ^= x >> 12;